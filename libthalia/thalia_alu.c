@@ -2,18 +2,203 @@
 #include "thalia_gb.h"
 #include "thalia_alu.h"
 
+// The F register, which is only up to date when no operation is pending.
+#define THALIA_ALU_F(gb) ((gb)->reg.named.f)
+
+// Computes the flags set by the pending operation 'f'.
+static inline guint8 thalia_alu_compute_flags(const thalia_alu_flags_t* f)
+{
+    guint8 ret = 0;
+    switch(f->op) {
+    case THALIA_ALU_OP_ADD:
+        if(((f->a + f->b + f->carry) & 0xFF) == 0)
+            ret |= THALIA_ALU_FLAG_ZERO;
+        if((f->a & 0x0F) + (f->b & 0x0F) + f->carry > 0x0F)
+            ret |= THALIA_ALU_FLAG_HALFCARRY;
+        if(f->a + f->b + f->carry > 0xFF)
+            ret |= THALIA_ALU_FLAG_CARRY;
+        break;
+    case THALIA_ALU_OP_SUB:
+        ret = THALIA_ALU_FLAG_OPERATION;
+        if(((f->a - f->b - f->carry) & 0xFF) == 0)
+            ret |= THALIA_ALU_FLAG_ZERO;
+        if((f->a & 0x0F) < (f->b & 0x0F) + f->carry)
+            ret |= THALIA_ALU_FLAG_HALFCARRY;
+        if(f->a < f->b + f->carry)
+            ret |= THALIA_ALU_FLAG_CARRY;
+        break;
+    case THALIA_ALU_OP_ZERO:
+        ret = f->b | (f->a ? 0 : THALIA_ALU_FLAG_ZERO);
+        break;
+    }
+    return ret;
+}
+
+// Returns the current flags in F register format.
+static inline guint8 thalia_alu_flags(ThaliaGB* gb)
+{
+    const thalia_alu_flags_t* f = &gb->flags;
+    if(G_LIKELY(f->op == THALIA_ALU_OP_NONE))
+        return THALIA_ALU_F(gb);
+    return (THALIA_ALU_F(gb) & f->keep) |
+           (thalia_alu_compute_flags(f) & ~f->keep);
+}
+
+// Returns the current flags, for when they are needed outside the ALU.
+guint8 thalia_alu_get_flags(ThaliaGB* gb)
+{
+    return thalia_alu_flags(gb);
+}
+
+// Computes the flags of the pending operation into F.
+void thalia_alu_sync_flags(ThaliaGB* gb)
+{
+    THALIA_ALU_F(gb) = thalia_alu_flags(gb);
+    gb->flags.op = THALIA_ALU_OP_NONE;
+}
+
+// Overwrites all flags, dropping the pending operation.
+void thalia_alu_set_flags(ThaliaGB* gb, guint8 flags)
+{
+    THALIA_ALU_F(gb) = flags & 0xF0;
+    gb->flags.op = THALIA_ALU_OP_NONE;
+}
+
+// Records operation 'op' on 'a' and 'b', leaving its flags to be computed
+// once they are read. Define THALIA_ALU_EAGER_FLAGS to compute them at once.
+static inline void thalia_alu_defer(ThaliaGB* gb, thalia_alu_op_t op,
+                                    guint8 a, guint8 b, guint8 carry,
+                                    guint8 keep)
+{
+    // The flags kept come from the operation before, if that is pending.
+    if(keep)
+        thalia_alu_sync_flags(gb);
+
+    gb->flags.op = op;
+    gb->flags.a = a;
+    gb->flags.b = b;
+    gb->flags.carry = carry;
+    gb->flags.keep = keep;
+#ifdef THALIA_ALU_EAGER_FLAGS
+    thalia_alu_sync_flags(gb);
+#endif
+}
+
+// Shifts and rotates, in the order of their lookup tables.
+typedef enum {
+    THALIA_ALU_SHIFT_RRC = 0,
+    THALIA_ALU_SHIFT_RLC,
+    THALIA_ALU_SHIFT_RR,
+    THALIA_ALU_SHIFT_RL,
+    THALIA_ALU_SHIFT_SRA,
+    THALIA_ALU_SHIFT_SLA,
+    THALIA_ALU_SHIFT_SRL,
+    THALIA_ALU_SHIFT_SWAP,
+    THALIA_ALU_SHIFT_COUNT
+} thalia_alu_shift_t;
+
+// Lookup tables, filled in by thalia_alu_init_tables. Flags for additions
+// and subtractions are indexed by the carry in and both operands, the other
+// tables hold the result in the high byte and the flags in the low byte.
+static guint8 thalia_alu_add_table[2][256][256];
+static guint8 thalia_alu_sub_table[2][256][256];
+static guint8 thalia_alu_inc_table[256];
+static guint8 thalia_alu_dec_table[256];
+static guint16 thalia_alu_daa_table[8][256];
+static guint16 thalia_alu_shift_table[THALIA_ALU_SHIFT_COUNT][2][256];
+
+// Sets the flags from a lookup table, except for those in 'keep'.
+static inline void thalia_alu_lookup(ThaliaGB* gb, guint8 flags, guint8 keep)
+{
+    if(keep)
+        flags = (thalia_alu_flags(gb) & keep) | (flags & ~keep);
+    thalia_alu_set_flags(gb, flags);
+}
+
+// Looks up the result and flags of shift 'op' on 'a' with carry 'carry'.
+static inline guint8 thalia_alu_lookup_shift(ThaliaGB* gb,
+                                             thalia_alu_shift_t op,
+                                             guint8 a, guint8 carry)
+{
+    guint16 entry = thalia_alu_shift_table[op][carry][a];
+    thalia_alu_set_flags(gb, entry & 0xFF);
+    return entry >> 8;
+}
+
+// Fills the lookup tables by running every input through the arithmetic
+// path, so both paths agree by construction.
+static void thalia_alu_init_tables()
+{
+    static guint8 (* const shifts[])(ThaliaGB*, guint8) = {
+        thalia_alu_rrc, thalia_alu_rlc, thalia_alu_rr, thalia_alu_rl,
+        thalia_alu_sra, thalia_alu_sla, thalia_alu_srl, thalia_alu_swap
+    };
+    // Only the registers and flags of this are ever touched.
+    ThaliaGB* gb = g_new0(ThaliaGB, 1);
+    guint a, b, carry, op, res;
+
+    for(carry = 0; carry < 2; carry++)
+        for(a = 0; a < 256; a++)
+            for(b = 0; b < 256; b++) {
+                thalia_alu_set_flags(gb, carry ? THALIA_ALU_FLAG_CARRY : 0);
+                thalia_alu_add_carry(gb, a, b);
+                thalia_alu_add_table[carry][a][b] = thalia_alu_flags(gb);
+                thalia_alu_set_flags(gb, carry ? THALIA_ALU_FLAG_CARRY : 0);
+                thalia_alu_sub_carry(gb, a, b);
+                thalia_alu_sub_table[carry][a][b] = thalia_alu_flags(gb);
+            }
+
+    for(a = 0; a < 256; a++) {
+        thalia_alu_set_flags(gb, 0);
+        thalia_alu_inc(gb, a);
+        thalia_alu_inc_table[a] = thalia_alu_flags(gb);
+        thalia_alu_set_flags(gb, 0);
+        thalia_alu_dec(gb, a);
+        thalia_alu_dec_table[a] = thalia_alu_flags(gb);
+
+        // DAA only looks at N, H and C.
+        for(b = 0; b < 8; b++) {
+            thalia_alu_set_flags(gb, b << 4);
+            res = thalia_alu_daa(gb, a);
+            thalia_alu_daa_table[b][a] = res << 8 | thalia_alu_flags(gb);
+        }
+
+        for(op = 0; op < THALIA_ALU_SHIFT_COUNT; op++)
+            for(carry = 0; carry < 2; carry++) {
+                thalia_alu_set_flags(gb, carry ? THALIA_ALU_FLAG_CARRY : 0);
+                res = shifts[op](gb, a);
+                thalia_alu_shift_table[op][carry][a] =
+                    res << 8 | thalia_alu_flags(gb);
+            }
+    }
+    g_free(gb);
+}
+
+// Selects whether 'gb' looks flags up in tables rather than computing them.
+// The tables are built the first time they are asked for.
+void thalia_alu_use_tables(ThaliaGB* gb, gboolean tables)
+{
+    static gsize initialized = 0;
+    if(tables && g_once_init_enter(&initialized)) {
+        thalia_alu_init_tables();
+        g_once_init_leave(&initialized, 1);
+    }
+    gb->alu_tables = tables;
+}
+
 // Tells us whether condition code 'cond' is satisfied.
 gboolean thalia_alu_condition_satisfied(ThaliaGB* gb, thalia_cond_t cond)
 {
+    guint8 flags = thalia_alu_flags(gb);
     switch(cond) {
     case THALIA_COND_Z:
-        return gb->reg.named.flag_zero ? TRUE : FALSE;
+        return flags & THALIA_ALU_FLAG_ZERO ? TRUE : FALSE;
     case THALIA_COND_NZ:
-        return gb->reg.named.flag_zero ? FALSE : TRUE;
+        return flags & THALIA_ALU_FLAG_ZERO ? FALSE : TRUE;
     case THALIA_COND_C:
-        return gb->reg.named.flag_carry ? TRUE : FALSE;
+        return flags & THALIA_ALU_FLAG_CARRY ? TRUE : FALSE;
     case THALIA_COND_NC:
-        return gb->reg.named.flag_carry ? FALSE : TRUE;
+        return flags & THALIA_ALU_FLAG_CARRY ? FALSE : TRUE;
     }
 
     g_error("Unknown condition code: %d\r\n", cond);
@@ -22,86 +207,103 @@ gboolean thalia_alu_condition_satisfied(ThaliaGB* gb, thalia_cond_t cond)
 // Performs an 8bit addition on the ALU.
 guint8 thalia_alu_add(ThaliaGB* gb, guint8 a, guint8 b, gboolean update_carry)
 {
-    guint8 res = a + b;
-    gb->reg.named.flag_zero = res == 0;
-    gb->reg.named.flag_operation = FALSE;
-    gb->reg.named.flag_halfcarry = (a & 0x0F) + (b & 0x0F) > 0x0F;
-    if(update_carry)
-        gb->reg.named.flag_carry = a > G_MAXUINT8 - b;
-    return res;
+    if(gb->alu_tables) {
+        thalia_alu_lookup(gb, thalia_alu_add_table[0][a][b],
+                          update_carry ? 0 : THALIA_ALU_FLAG_CARRY);
+        return a + b;
+    }
+    thalia_alu_defer(gb, THALIA_ALU_OP_ADD, a, b, 0,
+                     update_carry ? 0 : THALIA_ALU_FLAG_CARRY);
+    return a + b;
 }
 
 // Performs an 8bit addition with carry on the ALU.
 guint8 thalia_alu_add_carry(ThaliaGB* gb, guint8 a, guint8 b)
 {
-    // The ternary operator is necessary because the bitfield is read as though
-    // it were a signed byte. This causes TRUE to be read as -1.
-    guint8 carry = (gb->reg.named.flag_carry ? 1 : 0);
-    guint8 res = a + b + carry;
-    gb->reg.named.flag_zero = res == 0;
-    gb->reg.named.flag_operation = FALSE;
-
-    // We cannot pass control to thalia_alu_add because the flags are
-    // calculated differently with regard to overflow
-    gb->reg.named.flag_halfcarry = (a & 0x0F) + (b & 0x0F) + carry > 0x0F;
-    gb->reg.named.flag_carry = a > G_MAXUINT8 - b - carry;
-    return res;
+    guint8 carry = thalia_alu_flags(gb) & THALIA_ALU_FLAG_CARRY ? 1 : 0;
+    if(gb->alu_tables)
+        thalia_alu_set_flags(gb, thalia_alu_add_table[carry][a][b]);
+    else
+        thalia_alu_defer(gb, THALIA_ALU_OP_ADD, a, b, carry, 0);
+    return a + b + carry;
+}
+
+// Increments 'a' on the ALU, leaving the carry flag alone.
+guint8 thalia_alu_inc(ThaliaGB* gb, guint8 a)
+{
+    if(gb->alu_tables) {
+        thalia_alu_lookup(gb, thalia_alu_inc_table[a], THALIA_ALU_FLAG_CARRY);
+        return a + 1;
+    }
+    return thalia_alu_add(gb, a, 1, FALSE);
 }
 
 // Performs a 16bit addition of a 16bit number and an 8bit signed number.
 guint16 thalia_alu_add_16bit_mixed(ThaliaGB* gb, guint16 a, gint8 b)
 {
     guint16 other = (guint16) (((gint16) (b << 8)) >> 8);
-    gb->reg.named.flag_zero = FALSE;
-    gb->reg.named.flag_operation = FALSE;
-    gb->reg.named.flag_halfcarry = (a & 0x000F) + (other & 0x000F) > 0x000F;
-    gb->reg.named.flag_carry = (a & 0x00FF) + (other & 0x00FF) > 0x00FF;
+    guint8 flags = 0;
+    if((a & 0x000F) + (other & 0x000F) > 0x000F)
+        flags |= THALIA_ALU_FLAG_HALFCARRY;
+    if((a & 0x00FF) + (other & 0x00FF) > 0x00FF)
+        flags |= THALIA_ALU_FLAG_CARRY;
+    thalia_alu_set_flags(gb, flags);
     return a + other;
 }
 
 // Performs a 16bit addition on the ALU.
 guint16 thalia_alu_add_16bit(ThaliaGB* gb, guint16 a, guint16 b)
 {
-    gb->reg.named.flag_operation = FALSE;
+    guint8 flags = thalia_alu_flags(gb) & THALIA_ALU_FLAG_ZERO;
     // Note how the halfcarry is from bit 11, not bit 7 as you might expect.
-    gb->reg.named.flag_halfcarry = (a & 0x07FF) + (b & 0x07FF) > 0x07FF;
-    gb->reg.named.flag_carry = a > G_MAXUINT16 - b;
+    if((a & 0x07FF) + (b & 0x07FF) > 0x07FF)
+        flags |= THALIA_ALU_FLAG_HALFCARRY;
+    if(a > G_MAXUINT16 - b)
+        flags |= THALIA_ALU_FLAG_CARRY;
+    thalia_alu_set_flags(gb, flags);
     return a + b;
 }
 
 // Performs an 8bit subtraction on the ALU.
 guint8 thalia_alu_sub(ThaliaGB* gb, guint8 a, guint8 b, gboolean update_carry)
 {
-    guint8 res = a - b;
-    gb->reg.named.flag_zero = res == 0;
-    gb->reg.named.flag_operation = TRUE;
-    gb->reg.named.flag_halfcarry = (a & 0x0F) < (b & 0x0F);
-    if(update_carry)
-        gb->reg.named.flag_carry = a < b;
-    return res;
+    if(gb->alu_tables) {
+        thalia_alu_lookup(gb, thalia_alu_sub_table[0][a][b],
+                          update_carry ? 0 : THALIA_ALU_FLAG_CARRY);
+        return a - b;
+    }
+    thalia_alu_defer(gb, THALIA_ALU_OP_SUB, a, b, 0,
+                     update_carry ? 0 : THALIA_ALU_FLAG_CARRY);
+    return a - b;
 }
 
 // Performs an 8bit subtraction with carry on the ALU.
 guint8 thalia_alu_sub_carry(ThaliaGB* gb, guint8 a, guint8 b)
 {
-    // See thalia_alu_add_carry for comment on the ternary operator.
-    guint8 carry = (gb->reg.named.flag_carry ? 1 : 0);
-    guint8 res = a - (b + carry);
-    gb->reg.named.flag_zero = res == 0;
-    gb->reg.named.flag_operation = TRUE;
-    gb->reg.named.flag_halfcarry = (a & 0x0F) < (b & 0x0F) + carry;
-    gb->reg.named.flag_carry = a < b + carry;
-    return res;
+    guint8 carry = thalia_alu_flags(gb) & THALIA_ALU_FLAG_CARRY ? 1 : 0;
+    if(gb->alu_tables)
+        thalia_alu_set_flags(gb, thalia_alu_sub_table[carry][a][b]);
+    else
+        thalia_alu_defer(gb, THALIA_ALU_OP_SUB, a, b, carry, 0);
+    return a - (b + carry);
+}
+
+// Decrements 'a' on the ALU, leaving the carry flag alone.
+guint8 thalia_alu_dec(ThaliaGB* gb, guint8 a)
+{
+    if(gb->alu_tables) {
+        thalia_alu_lookup(gb, thalia_alu_dec_table[a], THALIA_ALU_FLAG_CARRY);
+        return a - 1;
+    }
+    return thalia_alu_sub(gb, a, 1, FALSE);
 }
 
 // Performs an 8bit bitwise AND on the ALU.
 guint8 thalia_alu_and(ThaliaGB* gb, guint8 a, guint8 b)
 {
     guint8 res = a & b;
-    gb->reg.named.flag_zero = res == 0;
-    gb->reg.named.flag_operation = FALSE;
-    gb->reg.named.flag_halfcarry = TRUE;
-    gb->reg.named.flag_carry = FALSE;
+    thalia_alu_defer(gb, THALIA_ALU_OP_ZERO, res, THALIA_ALU_FLAG_HALFCARRY,
+                     0, 0);
     return res;
 }
 
@@ -109,10 +311,7 @@ guint8 thalia_alu_and(ThaliaGB* gb, guint8 a, guint8 b)
 guint8 thalia_alu_xor(ThaliaGB* gb, guint8 a, guint8 b)
 {
     guint8 res = a ^ b;
-    gb->reg.named.flag_zero = res == 0;
-    gb->reg.named.flag_operation = FALSE;
-    gb->reg.named.flag_halfcarry = FALSE;
-    gb->reg.named.flag_carry = FALSE;
+    thalia_alu_defer(gb, THALIA_ALU_OP_ZERO, res, 0, 0, 0);
     return res;
 }
 
@@ -120,20 +319,27 @@ guint8 thalia_alu_xor(ThaliaGB* gb, guint8 a, guint8 b)
 guint8 thalia_alu_or(ThaliaGB* gb, guint8 a, guint8 b)
 {
     guint8 res = a | b;
-    gb->reg.named.flag_zero = res == 0;
-    gb->reg.named.flag_operation = FALSE;
-    gb->reg.named.flag_halfcarry = FALSE;
-    gb->reg.named.flag_carry = FALSE;
+    thalia_alu_defer(gb, THALIA_ALU_OP_ZERO, res, 0, 0, 0);
     return res;
 }
 
 // Adjusts the operand for binary-coded decimal representation on the ALU.
 guint8 thalia_alu_daa(ThaliaGB* gb, guint8 a)
 {
-    guint16 adjust = gb->reg.named.flag_carry ? 0x60 : 0x00;
-    if(gb->reg.named.flag_halfcarry)
+    guint8 flags = thalia_alu_flags(gb);
+    guint16 adjust = flags & THALIA_ALU_FLAG_CARRY ? 0x60 : 0x00;
+    guint16 entry;
+
+    if(gb->alu_tables) {
+        entry = thalia_alu_daa_table[(flags >> 4) & 0x07][a];
+        thalia_alu_set_flags(gb, entry & 0xFF);
+        return entry >> 8;
+    }
+
+
+    if(flags & THALIA_ALU_FLAG_HALFCARRY)
         adjust |= 0x06;
-    if(!gb->reg.named.flag_operation) {
+    if(!(flags & THALIA_ALU_FLAG_OPERATION)) {
         if((a & 0x0F) > 0x09)
             adjust |= 0x06;
         if(a > 0x99)
@@ -142,52 +348,64 @@ guint8 thalia_alu_daa(ThaliaGB* gb, guint8 a)
     } else
         a -= adjust;
 
-    gb->reg.named.flag_carry = adjust >= 0x60 ? TRUE : FALSE;
-  gb->reg.named.flag_halfcarry = FALSE;
-  gb->reg.named.flag_zero = a == 0 ? TRUE : FALSE;
-  return a;
+    flags &= THALIA_ALU_FLAG_OPERATION;
+    if(adjust >= 0x60)
+        flags |= THALIA_ALU_FLAG_CARRY;
+    if(a == 0)
+        flags |= THALIA_ALU_FLAG_ZERO;
+    thalia_alu_set_flags(gb, flags);
+    return a;
 }
 
 // Performs an 8bit complement on the ALU.
 guint8 thalia_alu_cpl(ThaliaGB* gb, guint8 a)
 {
-    gb->reg.named.flag_operation = TRUE;
-    gb->reg.named.flag_halfcarry = TRUE;
+    guint8 flags = thalia_alu_flags(gb);
+    thalia_alu_set_flags(
+        gb,
+        (flags & (THALIA_ALU_FLAG_ZERO | THALIA_ALU_FLAG_CARRY)) |
+        THALIA_ALU_FLAG_OPERATION | THALIA_ALU_FLAG_HALFCARRY
+    );
     return ~a;
 }
 
 // Sets the carry flag on the ALU.
 void thalia_alu_scf(ThaliaGB* gb)
 {
-    gb->reg.named.flag_carry = TRUE;
-    gb->reg.named.flag_operation = FALSE;
-    gb->reg.named.flag_halfcarry = FALSE;
+    guint8 flags = thalia_alu_flags(gb);
+    thalia_alu_set_flags(
+        gb,
+        (flags & THALIA_ALU_FLAG_ZERO) | THALIA_ALU_FLAG_CARRY
+    );
 }
 
 // Complements the carry flag on the ALU.
 void thalia_alu_ccf(ThaliaGB* gb)
 {
-    gb->reg.named.flag_carry = !gb->reg.named.flag_carry;
-    gb->reg.named.flag_operation = FALSE;
-    gb->reg.named.flag_halfcarry = FALSE;
+    guint8 flags = thalia_alu_flags(gb);
+    thalia_alu_set_flags(
+        gb,
+        (flags & THALIA_ALU_FLAG_ZERO) |
+        ((flags & THALIA_ALU_FLAG_CARRY) ^ THALIA_ALU_FLAG_CARRY)
+    );
 }
 
 // Updates the flags register after a shift operation, with 'res' being the
 // result of said operation and 'leaving' representing the leaving bit.
-guint8 thalia_alu_update_flags_shift(ThaliaGB* gb, guint8 res,
-                                     gboolean leaving)
-{
-    gb->reg.named.flag_zero = res == 0;
-    gb->reg.named.flag_operation = FALSE;
-    gb->reg.named.flag_halfcarry = FALSE;
-    // Ternary operator necessary due to bitfield behavior.
-    gb->reg.named.flag_carry = leaving ? TRUE : FALSE;
+static inline guint8 thalia_alu_update_flags_shift(ThaliaGB* gb,
+                                                   guint8 res,
+                                                   gboolean leaving)
+{
+    thalia_alu_defer(gb, THALIA_ALU_OP_ZERO, res,
+                     leaving ? THALIA_ALU_FLAG_CARRY : 0, 0, 0);
     return res;
 }
 
 // Performs a rotate right with carry on the ALU.
 guint8 thalia_alu_rrc(ThaliaGB* gb, guint8 a)
 {
+    if(gb->alu_tables)
+        return thalia_alu_lookup_shift(gb, THALIA_ALU_SHIFT_RRC, a, 0);
     guint8 leaving = a & 0x01;
     guint8 res = (a >> 1) | (leaving << 7);
     return thalia_alu_update_flags_shift(gb, res, leaving);
@@ -196,6 +414,8 @@ guint8 thalia_alu_rrc(ThaliaGB* gb, guint8 a)
 // Performs a rotate left with carry on the ALU.
 guint8 thalia_alu_rlc(ThaliaGB* gb, guint8 a)
 {
+    if(gb->alu_tables)
+        return thalia_alu_lookup_shift(gb, THALIA_ALU_SHIFT_RLC, a, 0);
     guint8 leaving = a & 0x80;
     guint8 res = (a << 1) | (leaving >> 7);
     return thalia_alu_update_flags_shift(gb, res, leaving);
@@ -205,7 +425,10 @@ guint8 thalia_alu_rlc(ThaliaGB* gb, guint8 a)
 guint8 thalia_alu_rr(ThaliaGB* gb, guint8 a)
 {
     guint8 leaving = a & 0x01;
-    guint8 res = (a >> 1) | (gb->reg.named.flag_carry ? 0x80 : 0x00);
+    guint8 carry = thalia_alu_flags(gb) & THALIA_ALU_FLAG_CARRY ? 0x80 : 0x00;
+    if(gb->alu_tables)
+        return thalia_alu_lookup_shift(gb, THALIA_ALU_SHIFT_RR, a, carry != 0);
+    guint8 res = (a >> 1) | carry;
     return thalia_alu_update_flags_shift(gb, res, leaving);
 }
 
@@ -213,13 +436,18 @@ guint8 thalia_alu_rr(ThaliaGB* gb, guint8 a)
 guint8 thalia_alu_rl(ThaliaGB* gb, guint8 a)
 {
     guint8 leaving = a & 0x80;
-    guint8 res = (a << 1) | (gb->reg.named.flag_carry ? 0x01 : 0x00);
+    guint8 carry = thalia_alu_flags(gb) & THALIA_ALU_FLAG_CARRY ? 0x01 : 0x00;
+    if(gb->alu_tables)
+        return thalia_alu_lookup_shift(gb, THALIA_ALU_SHIFT_RL, a, carry != 0);
+    guint8 res = (a << 1) | carry;
     return thalia_alu_update_flags_shift(gb, res, leaving);
 }
 
 // Performs an arithmetic shift right on the ALU (preserving sign bit).
 guint8 thalia_alu_sra(ThaliaGB* gb, guint8 a)
 {
+    if(gb->alu_tables)
+        return thalia_alu_lookup_shift(gb, THALIA_ALU_SHIFT_SRA, a, 0);
     guint8 leaving = a & 0x01;
 #if (-2 >> 1) == -1
     // Right shift on signed numbers implemented as an arithmetic shift right.
@@ -240,6 +468,8 @@ guint8 thalia_alu_sra(ThaliaGB* gb, guint8 a)
 // Performs a logical shift left on the ALU (shifting in zeroes).
 guint8 thalia_alu_sla(ThaliaGB* gb, guint8 a)
 {
+    if(gb->alu_tables)
+        return thalia_alu_lookup_shift(gb, THALIA_ALU_SHIFT_SLA, a, 0);
     guint8 leaving = a & 0x80;
     guint8 res = a << 1;
     return thalia_alu_update_flags_shift(gb, res, leaving);
@@ -248,6 +478,8 @@ guint8 thalia_alu_sla(ThaliaGB* gb, guint8 a)
 // Performs a logical shift right on the ALU (shifting in zeroes).
 guint8 thalia_alu_srl(ThaliaGB* gb, guint8 a)
 {
+    if(gb->alu_tables)
+        return thalia_alu_lookup_shift(gb, THALIA_ALU_SHIFT_SRL, a, 0);
     guint8 leaving = a & 0x01;
     guint8 res = a >> 1;
     return thalia_alu_update_flags_shift(gb, res, leaving);
@@ -256,20 +488,18 @@ guint8 thalia_alu_srl(ThaliaGB* gb, guint8 a)
 // Swaps the high and low nibbles (4 bits) of the target on the ALU.
 guint8 thalia_alu_swap(ThaliaGB* gb, guint8 a)
 {
+    if(gb->alu_tables)
+        return thalia_alu_lookup_shift(gb, THALIA_ALU_SHIFT_SWAP, a, 0);
     guint8 res = (a >> 4) | (a << 4);
-    gb->reg.named.flag_zero = res == 0;
-    gb->reg.named.flag_operation = FALSE;
-    gb->reg.named.flag_halfcarry = FALSE;
-    gb->reg.named.flag_carry = FALSE;
+    thalia_alu_defer(gb, THALIA_ALU_OP_ZERO, res, 0, 0, 0);
     return res;
 }
 
 // Tests whether 'bit' is set in the target on the ALU.
 void thalia_alu_bit(ThaliaGB* gb, guint8 a, guint8 bit)
 {
-    gb->reg.named.flag_zero = !(a & (1 << bit));
-    gb->reg.named.flag_operation = FALSE;
-    gb->reg.named.flag_halfcarry = TRUE;
+    thalia_alu_defer(gb, THALIA_ALU_OP_ZERO, a & (1 << bit),
+                     THALIA_ALU_FLAG_HALFCARRY, 0, THALIA_ALU_FLAG_CARRY);
 }
 
 // Resets 'bit' in the target on the ALU.
@@ -12,18 +12,51 @@ typedef enum {
     THALIA_COND_C  = 3
 } thalia_cond_t;
 
+// Masks of the flags within the F register.
+#define THALIA_ALU_FLAG_ZERO      0x80
+#define THALIA_ALU_FLAG_OPERATION 0x40
+#define THALIA_ALU_FLAG_HALFCARRY 0x20
+#define THALIA_ALU_FLAG_CARRY     0x10
+
+// Operations whose flags have not been computed yet.
+typedef enum {
+    THALIA_ALU_OP_NONE = 0, // F is up to date
+    THALIA_ALU_OP_ADD,      // a + b + carry
+    THALIA_ALU_OP_SUB,      // a - b - carry
+    THALIA_ALU_OP_ZERO      // Zero flag from a, the other flags are in b
+} thalia_alu_op_t;
+
+// Last ALU operation, recorded so its flags are only computed when something
+// reads them. Flags in 'keep' are left as they are in F.
+typedef struct {
+    guint8 op;
+    guint8 a, b;
+    guint8 carry;
+    guint8 keep;
+} thalia_alu_flags_t;
+#endif
+
+#ifdef __THALIA_GB_T__
+// Flags
+guint8 thalia_alu_get_flags(ThaliaGB* gb);
+void thalia_alu_sync_flags(ThaliaGB* gb);
+void thalia_alu_set_flags(ThaliaGB* gb, guint8 flags);
+void thalia_alu_use_tables(ThaliaGB* gb, gboolean tables);
+
 // Conditions
 gboolean thalia_alu_condition_satisfied(ThaliaGB* gb, thalia_cond_t cond);
 
 // Addition
 guint8 thalia_alu_add(ThaliaGB* gb, guint8 a, guint8 b, gboolean update_carry);
 guint8 thalia_alu_add_carry(ThaliaGB* gb, guint8 a, guint8 b);
+guint8 thalia_alu_inc(ThaliaGB* gb, guint8 a);
 guint16 thalia_alu_add_16bit(ThaliaGB* gb, guint16 a, guint16 b);
 guint16 thalia_alu_add_16bit_mixed(ThaliaGB* gb, guint16 a, gint8 b);
 
 // Subtraction
 guint8 thalia_alu_sub(ThaliaGB* gb, guint8 a, guint8 b, gboolean update_carry);
 guint8 thalia_alu_sub_carry(ThaliaGB* gb, guint8 a, guint8 b);
+guint8 thalia_alu_dec(ThaliaGB* gb, guint8 a);
 
 // Bitwise boolean operators
 guint8 thalia_alu_and(ThaliaGB* gb, guint8 a, guint8 b);
@@ -50,5 +83,4 @@ guint8 thalia_alu_swap(ThaliaGB* gb, guint8 a);
 void thalia_alu_bit(ThaliaGB* gb, guint8 a, guint8 bit);
 guint8 thalia_alu_res(ThaliaGB* gb, guint8 a, guint8 bit);
 guint8 thalia_alu_set(ThaliaGB* gb, guint8 a, guint8 bit);
-
 #endif
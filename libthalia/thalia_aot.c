@@ -0,0 +1,120 @@
+#include <glib.h>
+#include <gmodule.h>
+#include "thalia_gb.h"
+#include "thalia_aot.h"
+#include "thalia_mmu.h"
+#include "thalia_proc.h"
+
+// Key of a block in the table of translated blocks.
+#define THALIA_AOT_KEY(bank, pc) GUINT_TO_POINTER((bank) << 16 | (pc))
+
+// Computes the hash of the ROM contents that translations are stored under.
+gchar* thalia_aot_hash(ThaliaGB* gb)
+{
+    GChecksum* checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    gchar* ret;
+    gint i;
+
+    for(i = 0; i < gb->mmu.rom_size / THALIA_MMU_BANK_SIZE; i++)
+        g_checksum_update(checksum, gb->mmu.rom_banks[i],
+                          THALIA_MMU_BANK_SIZE);
+
+    ret = g_strdup(g_checksum_get_string(checksum));
+    g_checksum_free(checksum);
+    return ret;
+}
+
+// Returns where the translation of the ROM with 'hash' is cached on disk.
+gchar* thalia_aot_path(const gchar* hash, const gchar* extension)
+{
+    gchar* name = g_strconcat(hash, extension, NULL);
+    gchar* ret = g_build_filename(
+        g_get_user_cache_dir(),
+        "thalia",
+        "aot",
+        name,
+        NULL
+    );
+    g_free(name);
+    return ret;
+}
+
+// Gathers the functions translated code calls back into.
+static const thalia_aot_api_t* thalia_aot_get_api()
+{
+    static thalia_aot_api_t api;
+    guint8 length, cycles;
+    guint16 i;
+
+    if(!api.step) {
+        api.step = (void (*)(gpointer)) thalia_gb_step;
+        for(i = 0; i < G_N_ELEMENTS(api.handlers); i++)
+            api.handlers[i] = thalia_proc_describe(i, &length, &cycles);
+    }
+    return &api;
+}
+
+// Loads the translation of the current ROM, if one has been cached on disk,
+// and selects the AOT mode to run it.
+void thalia_aot_load(ThaliaGB* gb)
+{
+    void (*init)(const thalia_aot_api_t*);
+    const thalia_aot_block_t* blocks;
+    const guint* abi;
+    gchar* hash = thalia_aot_hash(gb);
+    gchar* path = thalia_aot_path(hash, "." G_MODULE_SUFFIX);
+
+    if(!g_file_test(path, G_FILE_TEST_EXISTS))
+        goto out;
+
+    gb->aot.module = g_module_open(path, G_MODULE_BIND_LOCAL);
+    if(!gb->aot.module) {
+        g_warning("Could not load translated ROM: %s", g_module_error());
+        goto out;
+    }
+
+    // Refuse code translated for a different ThaliaGB layout.
+    if(!g_module_symbol(gb->aot.module, "thalia_aot_abi", (gpointer*) &abi) ||
+       !g_module_symbol(gb->aot.module, "thalia_aot_init", (gpointer*) &init) ||
+       !g_module_symbol(gb->aot.module, "thalia_aot_blocks",
+                        (gpointer*) &blocks) ||
+       *abi != THALIA_AOT_ABI) {
+        g_warning("Translated ROM %s is stale, ignoring it", path);
+        thalia_aot_free(gb);
+        goto out;
+    }
+
+    init(thalia_aot_get_api());
+    gb->aot.blocks = g_hash_table_new(g_direct_hash, g_direct_equal);
+    for(; blocks->code; blocks++)
+        g_hash_table_insert(
+            gb->aot.blocks,
+            THALIA_AOT_KEY(blocks->bank, blocks->pc),
+            blocks->code
+        );
+    gb->mode = THALIA_PROC_MODE_AOT;
+
+out:
+    g_free(path);
+    g_free(hash);
+}
+
+// Returns the translation of the block at 'pc' in 'bank', or NULL if there is
+// none, in which case the block is left to the interpreter.
+gpointer thalia_aot_lookup(ThaliaGB* gb, guint16 bank, guint16 pc)
+{
+    if(!gb->aot.blocks)
+        return NULL;
+    return g_hash_table_lookup(gb->aot.blocks, THALIA_AOT_KEY(bank, pc));
+}
+
+// Unloads the translation of the current ROM.
+void thalia_aot_free(ThaliaGB* gb)
+{
+    if(gb->aot.blocks)
+        g_hash_table_destroy(gb->aot.blocks);
+    if(gb->aot.module)
+        g_module_close(gb->aot.module);
+    gb->aot.blocks = NULL;
+    gb->aot.module = NULL;
+}
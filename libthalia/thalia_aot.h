@@ -0,0 +1,38 @@
+#ifndef __THALIA_AOT_H__
+#define __THALIA_AOT_H__
+
+#include <glib.h>
+#include <gmodule.h>
+#include "thalia_gb.h"
+
+// Bump whenever translated code would no longer work with this library.
+#define THALIA_AOT_VERSION 5
+#define THALIA_AOT_ABI ((THALIA_AOT_VERSION << 16) ^ sizeof(ThaliaGB))
+
+// Functions handed to translated code when it is loaded.
+typedef struct {
+    void (*step)(gpointer gb);
+    void (*handlers[0x200])(gpointer gb, guint8 opcode, guint16 operand);
+} thalia_aot_api_t;
+
+// Entry in the block table of a translated ROM, terminated by a NULL entry.
+typedef struct {
+    guint16 bank;
+    guint16 pc;
+    void (*code)(gpointer gb);
+} thalia_aot_block_t;
+
+// Translated code loaded for the current ROM.
+typedef struct {
+    GModule* module;               // NULL if no translation is loaded
+    GHashTable* blocks;            // Native code, keyed by bank and address
+} thalia_aot_t;
+#endif
+
+#ifdef __THALIA_GB_T__
+gchar* thalia_aot_hash(ThaliaGB* gb);
+gchar* thalia_aot_path(const gchar* hash, const gchar* extension);
+void thalia_aot_load(ThaliaGB* gb);
+gpointer thalia_aot_lookup(ThaliaGB* gb, guint16 bank, guint16 pc);
+void thalia_aot_free(ThaliaGB* gb);
+#endif
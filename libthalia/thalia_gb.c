@@ -1,14 +1,48 @@
 #include <glib.h>
+#include <string.h>
 #include "thalia_gb.h"
 #include "thalia_proc.h"
 #include "thalia_mmu.h"
+#include "thalia_mbc.h"
+#include "thalia_rom.h"
+#include "thalia_save.h"
 #include "thalia_gpu.h"
+#include "thalia_line.h"
 #include "thalia_reg.h"
+#include "thalia_keypad.h"
 #include "thalia_timer.h"
+#include "thalia_serial.h"
+#include "thalia_sched.h"
+#include "thalia_jit.h"
+#include "thalia_aot.h"
 
 // Export the ThaliaGB type for external bindings.
 G_DEFINE_TYPE(ThaliaGB, thalia_gb, G_TYPE_OBJECT);
 
+// Byte offset of 'field' in the ThaliaGB type.
+#define THALIA_GB_OFFSET(field) ((gsize) G_STRUCT_OFFSET(ThaliaGB, field))
+
+// Keep the layout of ThaliaGB as described there. What opcodes touch fits in
+// the first three cache lines, interrupt flags and enable bits share one, and
+// the page tables come before bulk memory.
+G_STATIC_ASSERT(THALIA_GB_OFFSET(sched) + sizeof(thalia_sched_t) <= 3 * 64);
+G_STATIC_ASSERT(THALIA_GB_OFFSET(cache.stale) < 3 * 64);
+G_STATIC_ASSERT(THALIA_GB_OFFSET(mmu.ram_io.unpacked.int_flag) -
+                THALIA_GB_OFFSET(mmu.ram_page0.unpacked.int_enable) < 64);
+G_STATIC_ASSERT(THALIA_GB_OFFSET(mmu.ram_page0) < 8 * 64);
+G_STATIC_ASSERT(THALIA_GB_OFFSET(mmu.read_pages) < 10 * 64);
+G_STATIC_ASSERT(THALIA_GB_OFFSET(mmu.code_page) <
+                THALIA_GB_OFFSET(mmu.ram_oam));
+G_STATIC_ASSERT(THALIA_GB_OFFSET(mmu.ram_int) < THALIA_GB_OFFSET(gpu));
+
+// Memory mapped registers must sit at their addresses.
+G_STATIC_ASSERT(G_STRUCT_OFFSET(thalia_io_t, time_divider) == 0x04);
+G_STATIC_ASSERT(G_STRUCT_OFFSET(thalia_io_t, int_flag) == 0x0F);
+G_STATIC_ASSERT(G_STRUCT_OFFSET(thalia_io_t, scroll_y) == 0x42);
+G_STATIC_ASSERT(G_STRUCT_OFFSET(thalia_io_t, window_x) == 0x4B);
+G_STATIC_ASSERT(sizeof(thalia_io_t) <= 0x80);
+G_STATIC_ASSERT(sizeof(thalia_sprite_t) * THALIA_GPU_N_SPRITES == 0xA0);
+
 // The error quark used by this namespace.
 GQuark thalia_error_quark()
 {
@@ -21,6 +55,9 @@ ThaliaGB* thalia_gb_new()
     ThaliaGB* gb = THALIA_GB(g_object_new(THALIA_TYPE_GB, NULL));
     g_mutex_init(&gb->gpu.mutex);
     g_mutex_init(&gb->keypad.mutex);
+    g_cond_init(&gb->keypad.changed);
+    g_mutex_init(&gb->save.mutex);
+    g_cond_init(&gb->save.wake);
 
     return gb;
 }
@@ -35,16 +72,16 @@ void thalia_gb_destroy(ThaliaGB* gb)
 static void thalia_gb_finalize (GObject *obj)
 {
     ThaliaGB* gb = THALIA_GB(obj);
-    guint i;
-    // Free the space allocated for memory banks.
-    if(gb->mmu->rom_banks) {
-        for(i = 0; i < THALIA_MMU_MAX_BANK_COUNT; i++)
-            if(gb->mmu->rom_banks[i])
-                g_free(gb->mmu->rom_banks[i]);
-        g_free(gb->mmu->rom_banks);
-    }
+    // Write back what is left of the save. Other instances may still be using
+    // the ROM.
+    thalia_save_close(gb);
+    if(gb->rom)
+        thalia_rom_unref(gb->rom);
 
-    g_free(gb->mmu);
+    g_free(gb->cache.blocks);
+    thalia_jit_free(gb);
+    thalia_aot_free(gb);
+    thalia_gpu_free(gb);
     g_object_unref(gb->gpu.screen);
 
     // Pass on finalization to the parent class.
@@ -63,16 +100,15 @@ static void thalia_gb_init(ThaliaGB* gb)
     gb->sp = 0xFFFE;
     gb->pc = 0x0100;
 
-    gb->mmu = g_new0(thalia_mmu_t, 1);
-    gb->mmu->ram_io.unpacked.lcd_operation = TRUE;
-    gb->mmu->ram_io.unpacked.lcd_wd_display = TRUE;
-    gb->mmu->ram_io.unpacked.lcd_bg_display = TRUE;
-    gb->mmu->ram_io.unpacked.lcd_tile_data = TRUE;
+    gb->mmu.ram_io.unpacked.lcd_operation = TRUE;
+    gb->mmu.ram_io.unpacked.lcd_wd_display = TRUE;
+    gb->mmu.ram_io.unpacked.lcd_bg_display = TRUE;
+    gb->mmu.ram_io.unpacked.lcd_tile_data = TRUE;
 
     gb->interrupts = TRUE;
-    gb->mmu->mbc.ram_bank = 0;
-    gb->mmu->mbc.rom_bank = 1;
-    gb->mmu->mbc.enable_ext_ram = TRUE;
+    gb->save.fd = -1;
+    thalia_mbc_init(gb);
+    thalia_mmu_map(gb);
 
     // Create a pixel buffer to blit pixels in, start with a black screen
     gb->gpu.screen = gdk_pixbuf_new(
@@ -82,6 +118,13 @@ static void thalia_gb_init(ThaliaGB* gb)
         THALIA_GPU_SCREEN_HEIGHT
     );
     gdk_pixbuf_fill(gb->gpu.screen, 0x00000000);
+    thalia_gpu_set_isa(gb, thalia_line_best_isa());
+
+    // Nothing is drawn yet, so everything counts as changed.
+    memset(&gb->gpu.dirty.tiles, 0xFF, sizeof(gb->gpu.dirty.tiles));
+    memset(&gb->gpu.dirty.rows, 0xFF, sizeof(gb->gpu.dirty.rows));
+    gb->gpu.dirty.oam = (G_GUINT64_CONSTANT(1) << THALIA_GPU_N_SPRITES) - 1;
+    gb->gpu.dirty.frame = TRUE;
 }
 
 // Initialize the ThaliaGB class by setting up methods and signals.
@@ -107,8 +150,9 @@ static void thalia_gb_class_init(ThaliaGBClass* klass)
 // Grab useful values from the ROM header.
 static void thalia_gb_decode_header(ThaliaGB* gb)
 {
-    gb->cartridge = gb->mmu->rom_bank0[THALIA_HEADER_CARTRIDGE];
-    gb->mmu->rom_size = 1 << (15 + gb->mmu->rom_bank0[THALIA_HEADER_ROMSIZE]);
+    guint8* header = gb->mmu.rom_banks[0];
+    gb->cartridge = header[THALIA_HEADER_CARTRIDGE];
+    gb->mmu.rom_size = 1 << (15 + header[THALIA_HEADER_ROMSIZE]);
 }
 
 // Check whether the checksum included in the ROM header matches the data.
@@ -125,23 +169,19 @@ static gboolean thalia_gb_check_header(ThaliaGB* gb)
 // Loads the ROM from file 'path'.
 void thalia_gb_load_rom(ThaliaGB* gb, const gchar* path, GError** error)
 {
-    GIOChannel* channel;
-    channel = g_io_channel_new_file(path, "r", error);
-    if(*error)
-        return;
-
-    // Switch to raw encoding, allowing us to read non-ASCII characters.
-    g_io_channel_set_encoding(channel, NULL, error);
-    if(*error)
-        return;
+    // Let go of a ROM loaded before, unmapping its pages first.
+    thalia_save_close(gb);
+    if(gb->rom) {
+        gb->mmu.rom_banks = NULL;
+        thalia_mmu_map_rom(gb);
+        thalia_rom_unref(gb->rom);
+        gb->rom = NULL;
+    }
 
-    // Bank 0 is always allocated
-    gb->mmu->rom_banks = g_new0(guint8*, THALIA_MMU_MAX_BANK_COUNT);
-    gb->mmu->rom_banks[0] = g_new0(guint8, THALIA_MMU_BANK_SIZE);
-    gb->mmu->rom_bank0 = gb->mmu->rom_banks[0];
-    thalia_mmu_read_bank(channel, gb->mmu->rom_banks[0], error);
+    gb->rom = thalia_rom_open(path, error);
     if(*error)
         return;
+    gb->mmu.rom_banks = gb->rom->banks;
 
     if(!thalia_gb_check_header(gb)) {
         // Do not continue if we have an invalid checksum.
@@ -156,26 +196,19 @@ void thalia_gb_load_rom(ThaliaGB* gb, const gchar* path, GError** error)
 
     thalia_gb_decode_header(gb);
 
-    // Now that we know the rom size, we should load as many banks from the
-    // source ROM file into subsequent banks.
-    guint8 i;
-    for(i = 1; i < gb->mmu->rom_size / THALIA_MMU_BANK_SIZE; i++) {
-        // TODO: It would appear that multitudes of 32 are mapped to bank zero.
-        // Will need a ROM that uses >32 banks to investigate.
-        gb->mmu->rom_banks[i] = g_new0(guint8, THALIA_MMU_BANK_SIZE);
-        thalia_mmu_read_bank(channel, gb->mmu->rom_banks[i], error);
-        if(*error)
-            return;
+    // Now that we know the rom size, make sure the file holds all its banks.
+    if(gb->mmu.rom_size / THALIA_MMU_BANK_SIZE > gb->rom->bank_count) {
+        g_set_error(
+            error,
+            THALIA_ERROR,
+            THALIA_ERROR_BANK_SIZE,
+            "Could not read entire bank, is the file a ROM?"
+        );
+        return;
     }
 
     // Employ different behavior dependent on cartridge type.
-    switch(gb->cartridge) {
-    case THALIA_CARTRIDGE_ROMONLY:
-    case THALIA_CARTRIDGE_MBC1:
-    case THALIA_CARTRIDGE_MBC2:
-        gb->mmu->rom_bankn = gb->mmu->rom_banks[1];
-        break;
-    default:
+    if(!thalia_mbc_setup(gb)) {
         g_set_error(
             error,
             THALIA_ERROR,
@@ -185,11 +218,10 @@ void thalia_gb_load_rom(ThaliaGB* gb, const gchar* path, GError** error)
         );
         return;
     }
+    thalia_save_open(gb, path);
 
-    g_io_channel_shutdown(channel, TRUE, error);
-    if(*error)
-        return;
-    g_io_channel_unref(channel);
+    // Use native code for this ROM if it has been translated before.
+    thalia_aot_load(gb);
     return;
 }
 
@@ -201,9 +233,29 @@ static void thalia_gb_start_interrupt(ThaliaGB* gb, guint16 int_addr)
     gb->pc = int_addr;
 }
 
-// Handles interrupts for the ThaliaGB instance.
+// Flags an interrupt from 'source', to be serviced before the next opcode if
+// it is enabled.
+void thalia_gb_interrupt(ThaliaGB* gb, thalia_int_t source)
+{
+    gb->mmu.ram_io.unpacked.int_flag |= source;
+    thalia_sched_check(gb);
+}
+
+// Returns the interrupts that are both flagged and enabled.
+static guint8 thalia_gb_interrupts_enabled(ThaliaGB* gb)
+{
+    return gb->mmu.ram_io.unpacked.int_flag &
+           gb->mmu.ram_page0.unpacked.int_enable & THALIA_INT_ALL;
+}
+
+// Handles interrupts for the ThaliaGB instance. This only runs when the
+// interrupt master switch, flags or enable bits may have changed, or while
+// halted.
 static void thalia_gb_handle_interrupts(ThaliaGB* gb)
 {
+    guint8 pending;
+    gint source;
+
     // Check if we are due to enable or disable interrupts at this point.
     if(gb->disable_interrupts_in > 0) {
         gb->disable_interrupts_in--;
@@ -217,59 +269,188 @@ static void thalia_gb_handle_interrupts(ThaliaGB* gb)
             gb->interrupts = TRUE;
     }
 
-    // Stop if the master switch for interrupts is off.
-    if(!gb->interrupts && !gb->halted)
+    // Any pending interrupt ends a halt, even if the master switch is off.
+    pending = thalia_gb_interrupts_enabled(gb);
+    if(!pending)
         return;
-
-    // Check for pending interrupts that are enabled.
-    if(gb->mmu->ram_io.unpacked.int_flag_vblank && \
-       gb->mmu->ram_page0.unpacked.int_enable_vblank) {
-      if(gb->interrupts) {
-            gb->mmu->ram_io.unpacked.int_flag_vblank = FALSE;
-            thalia_gb_start_interrupt(gb, 0x0040);
-        } else
-            gb->halted = FALSE;
+    gb->halted = FALSE;
+    if(!gb->interrupts)
         return;
+
+    // The lowest source wins, and has its flag cleared on service.
+    source = g_bit_nth_lsf(pending, -1);
+    gb->mmu.ram_io.unpacked.int_flag &= ~(1 << source);
+    thalia_gb_start_interrupt(gb, 0x0040 + 8 * source);
+}
+
+// Tells whether the next step has interrupt state to update.
+static gboolean thalia_gb_interrupts_pending(ThaliaGB* gb)
+{
+    if(gb->enable_interrupts_in > 0 || gb->disable_interrupts_in > 0)
+        return TRUE;
+    if(!gb->interrupts && !gb->halted)
+        return FALSE;
+    return thalia_gb_interrupts_enabled(gb) != 0;
+}
+
+// Sets the deadlines of all hardware events from the current machine state.
+static void thalia_gb_schedule(ThaliaGB* gb)
+{
+    thalia_sched_set(gb, THALIA_SCHED_GPU, thalia_gpu_deadline(gb));
+    thalia_sched_set(gb, THALIA_SCHED_TIMER, thalia_timer_deadline(gb));
+    thalia_sched_set(gb, THALIA_SCHED_DMA, thalia_gpu_dma_deadline(gb));
+    thalia_sched_set(gb, THALIA_SCHED_SERIAL, thalia_serial_deadline(gb));
+    thalia_sched_set(
+        gb,
+        THALIA_SCHED_CHECK,
+        thalia_gb_interrupts_pending(gb) ? gb->cycles : THALIA_SCHED_NEVER
+    );
+}
+
+// Passes the time a bounded run would spend waiting for the keys at once: up
+// to its deadline, or a frame's worth for a frame run, which then ends. Only
+// unbounded runs really wait, so for them this returns FALSE.
+static gboolean thalia_gb_skip_wait(ThaliaGB* gb)
+{
+    guint64 deadline = gb->sched.deadlines[THALIA_SCHED_RUN];
+
+    if(deadline != THALIA_SCHED_NEVER) {
+        gb->cycles = MAX(gb->cycles, deadline);
+        thalia_gb_stop(gb, THALIA_GB_STATUS_DEADLINE);
+    } else if(gb->run.frame) {
+        gb->cycles += THALIA_GPU_DURATION_FRAME;
+        thalia_gb_stop(gb, THALIA_GB_STATUS_FRAME);
+    } else {
+        return FALSE;
     }
-    if(gb->mmu->ram_io.unpacked.int_flag_lcd && \
-       gb->mmu->ram_page0.unpacked.int_enable_lcd) {
-      if(gb->interrupts) {
-            gb->mmu->ram_io.unpacked.int_flag_lcd = FALSE;
-            thalia_gb_start_interrupt(gb, 0x0048);
-        } else
-            gb->halted = FALSE;
-        return;
-    }
-    if(gb->mmu->ram_io.unpacked.int_flag_timer && \
-       gb->mmu->ram_page0.unpacked.int_enable_timer) {
-      if(gb->interrupts) {
-          gb->mmu->ram_io.unpacked.int_flag_timer = FALSE;
-          thalia_gb_start_interrupt(gb, 0x0050);
-        } else
-            gb->halted = FALSE;
-      return;
-    }
+    return TRUE;
 }
 
-// Runs the gameboy program in the instance indefinitely.
-void thalia_gb_run(ThaliaGB* gb)
+// Allows hardware emulation to adjust to the new machine state after an
+// opcode. Nothing happens until the next event is due, in between opcodes run
+// back-to-back. While halted, we skip ahead to the events that may wake us
+// up. While stopped, we sleep until the keys change, unless the run is
+// bounded.
+void thalia_gb_step(ThaliaGB* gb)
 {
     while(TRUE) {
-        // Fetch an opcode and execute it if we're not halted.
-        if(!gb->halted) {
-            guint8 opcode = thalia_mmu_read_byte(gb, gb->pc);
-            if(!thalia_proc_decode(gb, opcode))
-                return;
-        } else
-            gb->cycles++; // If we are, just spin idly waiting for interrupts.
+        if(THALIA_SCHED_DUE(gb)) {
+            gb->sched.last = gb->cycles;
+            thalia_gpu_step(gb);
+            thalia_gpu_dma_step(gb);
+            thalia_timer_step(gb);
+            thalia_serial_step(gb);
+            thalia_keypad_step(gb);
+            thalia_gb_handle_interrupts(gb);
+            thalia_gb_schedule(gb);
+            if(gb->cycles >= gb->sched.deadlines[THALIA_SCHED_RUN])
+                thalia_gb_stop(gb, THALIA_GB_STATUS_DEADLINE);
+        }
 
-        // Allow hardware emulation to adjust to the new machine state.
-        thalia_gpu_step(gb);
-        thalia_timer_step(gb);
-        thalia_gb_handle_interrupts(gb);
+        // Whatever is left, halts included, is picked up by the next run.
+        if(G_UNLIKELY(gb->run.ended))
+            return;
 
-        // TODO: Slow down execution to real-time speed taking the amount of
-        // cycles used for each instruction into account, with optional
-        // throttle.
+        if(gb->stopped) {
+            if(!thalia_keypad_woken(gb)) {
+                if(thalia_gb_skip_wait(gb))
+                    return;
+                thalia_keypad_wait(gb, gb->keypad.stop);
+            }
+            gb->stopped = FALSE;
+        }
+
+        if(!gb->halted)
+            return;
+        // Nothing happens before the next event, so go there directly. With
+        // no events left only the keypad can wake us up, so wait for it.
+        if(gb->sched.next != THALIA_SCHED_NEVER) {
+            gb->cycles = MAX(gb->cycles + 1, gb->sched.next);
+        } else {
+            // Keys pressed since the last step may wake us up already.
+            thalia_keypad_step(gb);
+            if(gb->sched.next != THALIA_SCHED_NEVER)
+                continue;
+            if(thalia_gb_skip_wait(gb))
+                return;
+            thalia_keypad_wait(gb, gb->keypad.seen);
+            thalia_sched_check(gb);
+        }
     }
 }
+
+// Ends the running call to one of the thalia_gb_run functions with 'status'
+// once the current opcode is done. Only the first reason given counts.
+void thalia_gb_stop(ThaliaGB* gb, thalia_gb_status_t status)
+{
+    if(gb->run.ended)
+        return;
+    gb->run.ended = TRUE;
+    gb->run.status = status;
+
+    // Native code leaves its block when it sees the cache go stale.
+    thalia_proc_cache_mark_stale(gb);
+}
+
+// Ends the running call with THALIA_GB_STATUS_BREAK. Meant for handlers of
+// the signals the instance emits, which run on the emulation thread.
+void thalia_gb_break(ThaliaGB* gb)
+{
+    thalia_gb_stop(gb, THALIA_GB_STATUS_BREAK);
+}
+
+// Runs the program until cycle count 'deadline', or the end of the frame if
+// 'frame' is set. Everything the run stops in the middle of, like a halt, is
+// kept for the next one.
+static thalia_gb_status_t thalia_gb_run_bounded(ThaliaGB* gb,
+                                                guint64 deadline,
+                                                gboolean frame)
+{
+    gb->run.frame = frame;
+    gb->run.ended = FALSE;
+    thalia_sched_set(gb, THALIA_SCHED_RUN, deadline);
+
+    // A halt left by the last run goes on first, then opcodes run.
+    thalia_gb_step(gb);
+    if(!gb->run.ended && !thalia_proc_run(gb))
+        thalia_gb_stop(gb, THALIA_GB_STATUS_ERROR);
+
+    gb->run.frame = FALSE;
+    thalia_sched_set(gb, THALIA_SCHED_RUN, THALIA_SCHED_NEVER);
+
+    // Whatever the game saved goes to disk before the caller gets control,
+    // even if no frame ended during the run.
+    thalia_save_commit(gb);
+    return gb->run.status;
+}
+
+// Runs the program until the cycle count reaches 'deadline'. Opcodes are not
+// split, so the run may go a few cycles past it. Deadlines are absolute, so
+// this does not add up over many runs.
+thalia_gb_status_t thalia_gb_run_until(ThaliaGB* gb, guint64 deadline)
+{
+    return thalia_gb_run_bounded(gb, deadline, FALSE);
+}
+
+// Runs the program for 'cycles' more cycles.
+thalia_gb_status_t thalia_gb_run_for(ThaliaGB* gb, guint64 cycles)
+{
+    return thalia_gb_run_bounded(gb, gb->cycles + cycles, FALSE);
+}
+
+// Runs the program until the next frame has been rendered and signalled.
+thalia_gb_status_t thalia_gb_run_frame(ThaliaGB* gb)
+{
+    return thalia_gb_run_bounded(gb, THALIA_SCHED_NEVER, TRUE);
+}
+
+// Runs the gameboy program in the instance until it breaks or encounters an
+// unhandled opcode.
+void thalia_gb_run(ThaliaGB* gb)
+{
+    thalia_gb_run_bounded(gb, THALIA_SCHED_NEVER, FALSE);
+
+    // TODO: Slow down execution to real-time speed taking the amount of
+    // cycles used for each instruction into account, with optional
+    // throttle.
+}
@@ -5,10 +5,20 @@
 #include <glib-object.h>
 
 #include "thalia_reg.h"
+#include "thalia_alu.h"
+#include "thalia_line.h"
 #include "thalia_gpu.h"
+#include "thalia_mbc.h"
 #include "thalia_mmu.h"
+#include "thalia_rom.h"
+#include "thalia_save.h"
 #include "thalia_keypad.h"
 #include "thalia_timer.h"
+#include "thalia_serial.h"
+#include "thalia_sched.h"
+#include "thalia_proc.h"
+#include "thalia_jit.h"
+#include "thalia_aot.h"
 
 // Macros for use by the GObject type system
 #define THALIA_TYPE_GB            (thalia_gb_get_type())
@@ -34,41 +44,100 @@ typedef enum {
 
 // Cartridge types, correspond with values in ROM header.
 typedef enum {
-    THALIA_CARTRIDGE_ROMONLY = 0x00,
-    THALIA_CARTRIDGE_MBC1    = 0x01,
-    THALIA_CARTRIDGE_MBC2    = 0x02,
+    THALIA_CARTRIDGE_ROMONLY                 = 0x00,
+    THALIA_CARTRIDGE_MBC1                    = 0x01,
+    THALIA_CARTRIDGE_MBC1_RAM                = 0x02,
+    THALIA_CARTRIDGE_MBC1_RAM_BATTERY        = 0x03,
+    THALIA_CARTRIDGE_MBC2                    = 0x05,
+    THALIA_CARTRIDGE_MBC2_BATTERY            = 0x06,
+    THALIA_CARTRIDGE_ROM_RAM                 = 0x08,
+    THALIA_CARTRIDGE_ROM_RAM_BATTERY         = 0x09,
+    THALIA_CARTRIDGE_MBC3_TIMER_BATTERY      = 0x0F,
+    THALIA_CARTRIDGE_MBC3_TIMER_RAM_BATTERY  = 0x10,
+    THALIA_CARTRIDGE_MBC3                    = 0x11,
+    THALIA_CARTRIDGE_MBC3_RAM                = 0x12,
+    THALIA_CARTRIDGE_MBC3_RAM_BATTERY        = 0x13,
+    THALIA_CARTRIDGE_MBC5                    = 0x19,
+    THALIA_CARTRIDGE_MBC5_RAM                = 0x1A,
+    THALIA_CARTRIDGE_MBC5_RAM_BATTERY        = 0x1B,
+    THALIA_CARTRIDGE_MBC5_RUMBLE             = 0x1C,
+    THALIA_CARTRIDGE_MBC5_RUMBLE_RAM         = 0x1D,
+    THALIA_CARTRIDGE_MBC5_RUMBLE_RAM_BATTERY = 0x1E,
 } thalia_cartridge_t;
 
+// Interrupt sources, as bits of the IF and IE registers. Lower bits take
+// priority. Source n jumps to 0x40 + 8n when serviced.
+typedef enum {
+    THALIA_INT_VBLANK = 1 << 0,
+    THALIA_INT_LCD    = 1 << 1,
+    THALIA_INT_TIMER  = 1 << 2,
+    THALIA_INT_SERIAL = 1 << 3,
+    THALIA_INT_JOYPAD = 1 << 4,
+    THALIA_INT_ALL    = 0x1F
+} thalia_int_t;
+
+// Reasons for a bounded run to return.
+typedef enum {
+    THALIA_GB_STATUS_DEADLINE, // The cycle count to run up to was reached
+    THALIA_GB_STATUS_FRAME,    // A frame was completed
+    THALIA_GB_STATUS_BREAK,    // thalia_gb_break() was called
+    THALIA_GB_STATUS_ERROR     // An unhandled opcode, or the JIT disagreed
+} thalia_gb_status_t;
+
+// State of the running call to one of the thalia_gb_run functions. The cycle
+// count it runs up to is the deadline of THALIA_SCHED_RUN.
+typedef struct {
+    gboolean frame;            // Whether to stop at the end of a frame
+    gboolean ended;            // Whether to return after the current opcode
+    thalia_gb_status_t status; // Why, if so
+} thalia_gb_run_t;
+
 // ROM header offsets of relevant data.
 typedef enum {
     THALIA_HEADER_CARTRIDGE = 0x0147,
     THALIA_HEADER_ROMSIZE   = 0x0148,
+    THALIA_HEADER_RAMSIZE   = 0x0149,
     THALIA_HEADER_START     = 0x0134,
     THALIA_HEADER_END       = 0x014C,
     THALIA_HEADER_CHECKSUM  = 0x014D
 } thalia_header_loc_t;
 
-// Main gameboy type. Represents a complete state of execution.
+// Main gameboy type. Represents a complete state of execution. Fields used by
+// every opcode come first, so they share the first few cache lines with the
+// GObject header. Memory follows, with the page tables and interrupt registers
+// at its start. Bulk memory and state needed only now and then come last.
 typedef struct {
     GObject parent_instance;
 
-    thalia_cartridge_t cartridge; // Cartridge type
-
+    // CPU state
+    guint16 pc;                   // Program counter
+    guint16 sp;                   // Stack pointer
+    thalia_reg_t reg;             // Registry
+    thalia_alu_flags_t flags;     // Flags not yet computed into F
+    gboolean alu_tables;          // Whether flags come from lookup tables
     gboolean halted;
     gboolean stopped;
     gboolean interrupts;          // Whether interrupts are enabled
-    guint16 pc;                   // Program counter
-    guint16 sp;                   // Stack pointer
+    guint8 enable_interrupts_in;  // Opcodes to go before enabling interrupts
+    guint8 disable_interrupts_in; // Ditto, before disabling interrupts.
+    thalia_proc_mode_t mode;      // How opcodes are executed
+    guint64 cycles;               // Current clock count
+    thalia_sched_t sched;         // Deadlines of hardware events
+    thalia_proc_cache_t cache;    // Decoded instruction blocks
 
-    thalia_reg_t reg;             // Registry
-    thalia_mmu_t* mmu;            // Memory
+    thalia_mmu_t mmu;             // Memory
+
+    // Hardware stepped on events only, and cold state
     thalia_gpu_t gpu;             // Graphics
-    thalia_keypad_t keypad;       // Keypad I/O
     thalia_timer_t timer;         // Timer
-    guint32 cycles;               // Current clock count
-
-    guint8 enable_interrupts_in;  // Opcodes to go before enabling interrupts
-    guint8 disable_interrupts_in; // Ditto, before disabling interrupts.
+    thalia_serial_t serial;       // Serial port
+    thalia_keypad_t keypad;       // Keypad I/O
+    thalia_cartridge_t cartridge; // Cartridge type
+    thalia_rom_t* rom;            // Cartridge ROM, shared between instances
+    thalia_save_t save;           // Battery-backed cartridge RAM
+    thalia_jit_t jit;             // Native code for the JIT mode
+    thalia_aot_t aot;             // Native code for the AOT mode
+    thalia_gb_run_t run;          // Bounds of the running call
 } ThaliaGB;
 #define __THALIA_GB_T__
 
@@ -87,4 +156,11 @@ ThaliaGB* thalia_gb_new();
 void thalia_gb_destroy();
 void thalia_gb_load_rom(ThaliaGB* gb, const gchar* path, GError** error);
 void thalia_gb_run(ThaliaGB* gb);
+thalia_gb_status_t thalia_gb_run_until(ThaliaGB* gb, guint64 deadline);
+thalia_gb_status_t thalia_gb_run_for(ThaliaGB* gb, guint64 cycles);
+thalia_gb_status_t thalia_gb_run_frame(ThaliaGB* gb);
+void thalia_gb_break(ThaliaGB* gb);
+void thalia_gb_stop(ThaliaGB* gb, thalia_gb_status_t status);
+void thalia_gb_step(ThaliaGB* gb);
+void thalia_gb_interrupt(ThaliaGB* gb, thalia_int_t source);
 #endif
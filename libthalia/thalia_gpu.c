@@ -3,7 +3,30 @@
 #include <string.h>
 #include "thalia_gb.h"
 #include "thalia_gpu.h"
+#include "thalia_line.h"
 #include "thalia_mmu.h"
+#include "thalia_save.h"
+#include "thalia_sched.h"
+
+// Frees the tile map layers drawn so far.
+void thalia_gpu_free(ThaliaGB* gb)
+{
+    guint map, numbering;
+    for(map = 0; map < 2; map++)
+        for(numbering = 0; numbering < 2; numbering++)
+            g_free(gb->gpu.layers[map][numbering]);
+}
+
+// Selects the kernels lines are drawn with by instruction set 'isa'.
+void thalia_gpu_set_isa(ThaliaGB* gb, thalia_line_isa_t isa)
+{
+    gb->gpu.kernels = thalia_line_kernels(isa);
+    if(!gb->gpu.kernels) {
+        g_warning("CPU lacks %s, drawing with scalar code",
+                  thalia_line_isa_name(isa));
+        gb->gpu.kernels = thalia_line_kernels(THALIA_LINE_ISA_SCALAR);
+    }
+}
 
 // Locks the GPU.
 void thalia_gpu_lock(ThaliaGB* gb)
@@ -21,226 +44,388 @@ void thalia_gpu_unlock(ThaliaGB* gb)
 void thalia_gpu_handle_dma(ThaliaGB* gb, guint8 addr_msb)
 {
     guint16 addr = addr_msb << 8;
+    guint8* oam = gb->mmu.ram_oam.packed;
+    guint8 data[0xA0];
+    guint8* source;
     guint8 i;
 
-    // Copy data into OAM from the written address.
-    for(i = 0; i < 0xA0; i++)
-        thalia_mmu_write_byte(
-            gb,
-            0xFE00 + i,
-            thalia_mmu_read_byte(gb, addr + i)
-        );
-    gb->cycles += 0xA0; // TODO: Figure out clock penalty
+    // DMA sees internal RAM throughout 0xE000-0xFFFF.
+    if(addr >= 0xE000)
+        addr -= 0x2000;
+
+    // Copy data into OAM from the written address, in one go if reading it
+    // has no side effects.
+    source = gb->mmu.read_pages[addr >> 8];
+    if(!source) {
+        source = data;
+        for(i = 0; i < 0xA0; i++)
+            data[i] = thalia_mmu_read_byte(gb, addr + i);
+    }
+
+    // Most frames copy the same sprites again, which should not count as
+    // a change.
+    for(i = 0; i < THALIA_GPU_N_SPRITES; i++)
+        if(memcmp(&oam[i * 4], &source[i * 4], 4)) {
+            gb->gpu.dirty.oam |= G_GUINT64_CONSTANT(1) << i;
+            gb->gpu.dirty.frame = TRUE;
+        }
+    memcpy(oam, source, 0xA0);
+
+    // The transfer takes a while, in which the CPU can only reach HRAM.
+    gb->mmu.dma_end = gb->cycles + THALIA_GPU_DURATION_DMA;
+    thalia_mmu_dma_start(gb);
+}
+
+// Returns the cycle count at which the running DMA transfer ends.
+guint64 thalia_gpu_dma_deadline(ThaliaGB* gb)
+{
+    return gb->mmu.dma ? gb->mmu.dma_end : THALIA_SCHED_NEVER;
+}
+
+// Gives the CPU its memory back once the DMA transfer is over.
+void thalia_gpu_dma_step(ThaliaGB* gb)
+{
+    if(gb->mmu.dma && gb->cycles >= gb->mmu.dma_end)
+        thalia_mmu_dma_end(gb);
 }
 
 // Check for a scanline coincidence interrupt using the current line and
 // compare line I/O registers and schedule the interrupt if one has occured.
 static void thalia_gpu_check_scanline_interrupt(ThaliaGB* gb)
 {
-    if(gb->mmu->ram_io.unpacked.int_scanline_coincidence &&
-       gb->mmu->ram_io.unpacked.line_cur ==
-       gb->mmu->ram_io.unpacked.line_cmp) {
-      gb->mmu->ram_io.unpacked.scanline_coincidence = TRUE;
-      gb->mmu->ram_io.unpacked.int_flag_lcd = TRUE;
+    if(gb->mmu.ram_io.unpacked.int_scanline_coincidence &&
+       gb->mmu.ram_io.unpacked.line_cur ==
+       gb->mmu.ram_io.unpacked.line_cmp) {
+      gb->mmu.ram_io.unpacked.scanline_coincidence = TRUE;
+      thalia_gb_interrupt(gb, THALIA_INT_LCD);
     } else
-        gb->mmu->ram_io.unpacked.scanline_coincidence = FALSE;
+        gb->mmu.ram_io.unpacked.scanline_coincidence = FALSE;
 }
 
 // Check for an interrupt on the GPU status and schedule one if necessary.
 static void thalia_gpu_check_status_interrupt(ThaliaGB* gb)
 {
-    switch(gb->mmu->ram_io.unpacked.gpu_mode) {
+    switch(gb->mmu.ram_io.unpacked.gpu_mode) {
     case THALIA_GPU_MODE_HBLANK:
-        if(!gb->mmu->ram_io.unpacked.int_scan_hblank)
+        if(!gb->mmu.ram_io.unpacked.int_scan_hblank)
             return;
     case THALIA_GPU_MODE_VBLANK:
-        if(!gb->mmu->ram_io.unpacked.int_scan_vblank)
+        if(!gb->mmu.ram_io.unpacked.int_scan_vblank)
             return;
     case THALIA_GPU_MODE_SCAN_OAM:
-        if(!gb->mmu->ram_io.unpacked.int_scan_oam)
+        if(!gb->mmu.ram_io.unpacked.int_scan_oam)
             return;
     default:
         return;
     }
 
     // An LCD interrupt can be scheduled at this point.
-    gb->mmu->ram_io.unpacked.scanline_coincidence = FALSE;
-    gb->mmu->ram_io.unpacked.int_flag_lcd = TRUE;
+    gb->mmu.ram_io.unpacked.scanline_coincidence = FALSE;
+    thalia_gb_interrupt(gb, THALIA_INT_LCD);
     return;
 }
 
-void thalia_gpu_mark_change(ThaliaGB* gb)
+// Writes 'val' to video RAM at 'addr', noting the tile or map row it changes.
+void thalia_gpu_write_vram(ThaliaGB* gb, guint16 addr, guint8 val)
+{
+    thalia_gpu_dirty_t* dirty = &gb->gpu.dirty;
+    guint16 offset = addr - 0x8000;
+    guint index;
+
+    if(gb->mmu.ram_gpu.packed[offset] == val)
+        return;
+    gb->mmu.ram_gpu.packed[offset] = val;
+    dirty->frame = TRUE;
+
+    // Tiles take 16 bytes, map rows 32.
+    if(offset < 0x1800) {
+        index = offset / 16;
+        dirty->tiles[index / 32] |= 1u << (index % 32);
+    } else {
+        index = (offset - 0x1800) / 32;
+        dirty->rows[index / 32] |= 1u << (index % 32);
+    }
+}
+
+// Writes 'val' to OAM at 'addr', noting the sprite it changes.
+void thalia_gpu_write_oam(ThaliaGB* gb, guint16 addr, guint8 val)
+{
+    guint16 offset = addr - 0xFE00;
+    if(gb->mmu.ram_oam.packed[offset] == val)
+        return;
+
+    gb->mmu.ram_oam.packed[offset] = val;
+    gb->gpu.dirty.oam |= G_GUINT64_CONSTANT(1) << (offset / 4);
+    gb->gpu.dirty.frame = TRUE;
+}
+
+// Writes 'val' to the LCD register at 'addr', logging the change.
+void thalia_gpu_write_reg(ThaliaGB* gb, guint16 addr, guint8 val)
+{
+    thalia_gpu_dirty_t* dirty = &gb->gpu.dirty;
+    thalia_gpu_reg_change_t* change;
+
+    if(gb->mmu.ram_io.packed[addr - 0xFF00] == val)
+        return;
+    gb->mmu.ram_io.packed[addr - 0xFF00] = val;
+
+    // Writes past the end of the log are only counted.
+    if(dirty->n_log < THALIA_GPU_LOG_SIZE) {
+        change = &dirty->log[dirty->n_log];
+        change->line = gb->mmu.ram_io.unpacked.line_cur;
+        change->reg = addr - 0xFF00;
+        change->val = val;
+    }
+    dirty->n_log++;
+}
+
+// Decodes the tiles that changed since they were last decoded.
+static void thalia_gpu_decode_tiles(ThaliaGB* gb)
+{
+    thalia_gpu_tiles_t* tiles = &gb->gpu.tiles;
+    guint32 changed;
+    guint i, index;
+
+    for(i = 0; i < G_N_ELEMENTS(gb->gpu.dirty.tiles); i++) {
+        changed = gb->gpu.dirty.tiles[i];
+        gb->gpu.dirty.tiles[i] = 0;
+        if(changed)
+            tiles->generation++;
+        for(; changed; changed &= changed - 1) {
+            index = i * 32 + g_bit_nth_lsf(changed, -1);
+            tiles->versions[index]++;
+            gb->gpu.kernels->decode(&gb->mmu.ram_gpu.packed[index * 16],
+                                    tiles->rows[index],
+                                    tiles->flipped[index]);
+        }
+    }
+}
+
+// Fills 'shades' with the shade of every color code through 'palette'.
+static void thalia_gpu_shades(guint8 palette, guint8 shades[4])
+{
+    guint8 code;
+    for(code = 0; code < 4; code++)
+        shades[code] = 0xFF - 85 * (palette >> (code * 2) & 3);
+}
+
+// Marks the cells on map rows written since the last call as not up to date,
+// in both layers drawn from tile map 'index'.
+static void thalia_gpu_layer_rows(ThaliaGB* gb, guint index)
+{
+    guint32 changed = gb->gpu.dirty.rows[index];
+    thalia_gpu_layer_t* layer;
+    guint numbering, row;
+
+    gb->gpu.dirty.rows[index] = 0;
+    for(; changed; changed &= changed - 1) {
+        row = g_bit_nth_lsf(changed, -1);
+        for(numbering = 0; numbering < 2; numbering++) {
+            layer = gb->gpu.layers[index][numbering];
+            if(layer)
+                memset(&layer->fresh[row * 8], 0, 8 * sizeof(guint32));
+        }
+    }
+}
+
+// Returns line 'y' of the layer showing tile map 'map' as it is numbered now.
+// The 'width' pixels from 'x' onwards, wrapping around, are brought up to
+// date first.
+static const guint8* thalia_gpu_layer_line(ThaliaGB* gb, guint8 (*map)[32][32],
+                                           guint8 x, guint8 y, guint8 width)
 {
-    gb->gpu.last_change = gb->gpu.periods;
+    guint numbering = gb->mmu.ram_io.unpacked.lcd_tile_data ? 1 : 0;
+    guint map_index = map == &gb->mmu.ram_gpu.unpacked.tilemap_1;
+    thalia_gpu_layer_t** layer = &gb->gpu.layers[map_index][numbering];
+    thalia_gpu_tiles_t* tiles = &gb->gpu.tiles;
+    guint8 column = x >> 3;
+    guint8 n_columns = ((x & 0x07) + width + 7) >> 3;
+    guint32 fresh;
+    guint index;
+
+    // Nothing is drawn on a new layer, and no cell matches tile 0xFFFF.
+    if(G_UNLIKELY(!*layer)) {
+        *layer = g_new0(thalia_gpu_layer_t, 1);
+        memset((*layer)->tiles, 0xFF, sizeof((*layer)->tiles));
+    }
+    thalia_gpu_layer_rows(gb, map_index);
+
+    // Any decoded tile may be on this line.
+    if((*layer)->generations[y] != tiles->generation) {
+        (*layer)->generations[y] = tiles->generation;
+        (*layer)->fresh[y] = 0;
+    }
+
+    fresh = (*layer)->fresh[y];
+    for(; n_columns; n_columns--, column = (column + 1) & 31) {
+        if(fresh >> column & 1)
+            continue;
+        fresh |= 1u << column;
+
+        // Tile numbers for 0x8800-0x97FF are signed, around 0x9000.
+        index = (*map)[y >> 3][column];
+        if(!numbering)
+            index = 256 + (gint8) index;
+        if((*layer)->tiles[y][column] == index &&
+           (*layer)->versions[y][column] == tiles->versions[index])
+            continue;
+
+        (*layer)->tiles[y][column] = index;
+        (*layer)->versions[y][column] = tiles->versions[index];
+        memcpy(&(*layer)->codes[y][column * 8], tiles->rows[index][y & 0x07],
+               8);
+    }
+    (*layer)->fresh[y] = fresh;
+    return (*layer)->codes[y];
 }
 
+// Draws the background and window on line 'screen_ypos' as shades in
+// 'shades'.
 static void thalia_gpu_render_line_background(ThaliaGB* gb, gint screen_ypos,
-                                              guchar* pixel, gint n_channels)
+                                              guint8* shades)
 {
-    gint i;
+    thalia_io_t* io = &gb->mmu.ram_io.unpacked;
     guint8 (*wd_tmap)[32][32];
     guint8 (*bg_tmap)[32][32];
-    guint8 screen_xpos;
+    const guint8* line;
+    guint8 codes[THALIA_GPU_SCREEN_WIDTH];
+    guint8 palette[4];
+    guint8 window_x = THALIA_GPU_SCREEN_WIDTH;
+    guint8 length;
+
+    // If window and background are both disabled, render a white line.
+    if(!io->lcd_bg_display && !io->lcd_wd_display) {
+        memset(shades, 0xFF, THALIA_GPU_SCREEN_WIDTH);
+        return;
+    }
 
     // Determine which maps are the base window and background tile map.
-    if(gb->mmu->ram_io.unpacked.lcd_wd_tile)
-        wd_tmap = &gb->mmu->ram_gpu.unpacked.tilemap_1;
+    if(io->lcd_wd_tile)
+        wd_tmap = &gb->mmu.ram_gpu.unpacked.tilemap_1;
     else
-        wd_tmap = &gb->mmu->ram_gpu.unpacked.tilemap_0;
-    if(gb->mmu->ram_io.unpacked.lcd_bg_tile)
-        bg_tmap = &gb->mmu->ram_gpu.unpacked.tilemap_1;
+        wd_tmap = &gb->mmu.ram_gpu.unpacked.tilemap_0;
+    if(io->lcd_bg_tile)
+        bg_tmap = &gb->mmu.ram_gpu.unpacked.tilemap_1;
     else
-        bg_tmap = &gb->mmu->ram_gpu.unpacked.tilemap_0;
-
-    if(gb->mmu->ram_io.unpacked.lcd_bg_display ||
-       gb->mmu->ram_io.unpacked.lcd_wd_display) {
-        // First render the background and the window.
-        for(screen_xpos = 0;
-            screen_xpos < THALIA_GPU_SCREEN_WIDTH;
-            screen_xpos++) {
-
-            guint8 in_buffer_x;
-            guint8 in_buffer_y;
-            guint8 (*tmap)[32][32];
-            guint8 (*tile)[8][2];
-            guint8 palette = gb->mmu->ram_io.unpacked.pal_bg;
-
-            // Inside the window, we need to render from a different tilemap.
-            if(screen_ypos >= gb->mmu->ram_io.unpacked.window_y &&
-               screen_xpos >= gb->mmu->ram_io.unpacked.window_x &&
-               gb->mmu->ram_io.unpacked.lcd_wd_display) {
-              // Buffer coordinates are offset by the window position.
-                in_buffer_x = screen_xpos - gb->mmu->ram_io.unpacked.window_x;
-                in_buffer_y = screen_ypos - gb->mmu->ram_io.unpacked.window_y;
-                tmap = wd_tmap;
-            } else {
-                // If we're not, select the default tile map.
-                in_buffer_x = screen_xpos + gb->mmu->ram_io.unpacked.scroll_x;
-                in_buffer_y = screen_ypos + gb->mmu->ram_io.unpacked.scroll_y;
-                tmap = bg_tmap;
-            }
-
-            // Grab the tile number from the map.
-            guint8 tile_no = (*tmap)[in_buffer_y >> 3][in_buffer_x >> 3];
-            guint8 tile_x = in_buffer_x & 0x07;
-            guint8 tile_y = in_buffer_y & 0x07;
-
-            // Get the tile from the tileset as indicated in the lcd control
-            // register.
-            if(gb->mmu->ram_io.unpacked.lcd_tile_data) {
-                if(tile_no < 0x80)
-                    tile = &gb->mmu->ram_gpu.unpacked.tileset_1[tile_no];
-                else
-                    tile = &gb->mmu->ram_gpu.unpacked.tileset_s[
-                        tile_no - 0x80
-                    ];
-            } else {
-                // The tile number is signed when this set is used.
-                gint8 tile_no_signed = (gint8)tile_no;
-                if(tile_no_signed < 0)
-                    tile = &gb->mmu->ram_gpu.unpacked.tileset_s[
-                        0x80+tile_no_signed
-                    ];
-                else
-                    tile = &gb->mmu->ram_gpu.unpacked.tileset_0[tile_no];
-            }
-
-            // Now that we have the right tile, get the color code at this
-            // position.
-            guint8 code = 0;
-            code |= ((*tile)[tile_y][0] & (0x80 >> tile_x)) ? 1 : 0;
-            code |= ((*tile)[tile_y][1] & (0x80 >> tile_x)) ? 2 : 0;
-
-            // Pull the color code through the palette to get the actual color.
-            guint8 color = (palette & (3 << (code*2))) >> (code*2);
-
-            // Paint said color in the buffer.
-            for(i = 0; i < n_channels; i++)
-                pixel[i] = 0xFF-85*color;
-            pixel += n_channels;
-        }
-    } else {
-        // If window and background are both disabled, render a white line.
-        for(screen_xpos = 0;
-            screen_xpos < THALIA_GPU_SCREEN_WIDTH;
-            screen_xpos++) {
-
-            for(i = 0; i < n_channels; i++)
-                pixel[i] = 0xFF;
-            pixel += n_channels;
-        }
+        bg_tmap = &gb->mmu.ram_gpu.unpacked.tilemap_0;
+
+    // The window covers the line from its position onwards, if at all.
+    if(io->lcd_wd_display && screen_ypos >= io->window_y)
+        window_x = MIN(io->window_x, THALIA_GPU_SCREEN_WIDTH);
+
+    // First copy the color codes of the background, scrolled and wrapping
+    // around at the end of the map.
+    line = thalia_gpu_layer_line(gb, bg_tmap, io->scroll_x,
+                                 screen_ypos + io->scroll_y, window_x);
+    length = MIN(window_x, 256 - io->scroll_x);
+    memcpy(codes, line + io->scroll_x, length);
+    memcpy(codes + length, line, window_x - length);
+
+    // Then those of the window over it. Buffer coordinates in the window are
+    // offset by its position.
+    if(window_x < THALIA_GPU_SCREEN_WIDTH) {
+        line = thalia_gpu_layer_line(gb, wd_tmap, 0,
+                                     screen_ypos - io->window_y,
+                                     THALIA_GPU_SCREEN_WIDTH - window_x);
+        memcpy(codes + window_x, line, THALIA_GPU_SCREEN_WIDTH - window_x);
+    }
+
+    // Pull the color codes through the palette to get the actual shades.
+    thalia_gpu_shades(io->pal_bg, palette);
+    gb->gpu.kernels->shade(shades, codes, palette, THALIA_GPU_SCREEN_WIDTH);
+}
+
+// Puts the sprites that changed in OAM since the last call on the lines they
+// now cover.
+static void thalia_gpu_place_sprites(ThaliaGB* gb)
+{
+    guint64 changed = gb->gpu.dirty.oam;
+    guint64* lines = gb->gpu.sprites;
+    gint top, y;
+    guint i;
+
+    if(!changed)
+        return;
+    gb->gpu.dirty.oam = 0;
+
+    for(y = 0; y < THALIA_GPU_SCREEN_HEIGHT; y++)
+        lines[y] &= ~changed;
+    for(i = 0; i < THALIA_GPU_N_SPRITES; i++) {
+        if(!(changed >> i & 1))
+            continue;
+        top = gb->mmu.ram_oam.unpacked[i].ypos - 16;
+        for(y = MAX(top, 0); y < MIN(top + 8, THALIA_GPU_SCREEN_HEIGHT); y++)
+            lines[y] |= G_GUINT64_CONSTANT(1) << i;
     }
 }
 
+// Draws the sprites on line 'screen_ypos' over the shades in 'shades', which
+// has room for THALIA_GPU_LINE_MARGIN pixels on either side.
 static void thalia_gpu_render_line_sprites(ThaliaGB* gb, gint screen_ypos,
- guchar* pixel_base, gint n_channels)
+                                           guint8* shades)
 {
-    gint i;
+    guint64 on_line;
     gint sprite_index;
     guint8 sprites_drawn = 0;
+    guint8 obj_palettes[2][4];
+
+    thalia_gpu_place_sprites(gb);
+    on_line = gb->gpu.sprites[screen_ypos];
+    if(!on_line)
+        return;
+
+    thalia_gpu_shades(gb->mmu.ram_io.unpacked.pal_obj0, obj_palettes[0]);
+    thalia_gpu_shades(gb->mmu.ram_io.unpacked.pal_obj1, obj_palettes[1]);
 
-    // Enumerate all sprites to check for those to be drawn on this line.
+    // Enumerate the sprites on this line, last in OAM first.
     for(sprite_index = THALIA_GPU_N_SPRITES-1; sprite_index >= 0 &&
         sprites_drawn < THALIA_GPU_MAX_SPRITES_ON_LINE; sprite_index--) {
-      // First grab the sprite object at this location from OAM.
-        thalia_sprite_t sprite = gb->mmu->ram_oam.unpacked[sprite_index];
+        // First grab the sprite object at this location from OAM.
+        thalia_sprite_t sprite = gb->mmu.ram_oam.unpacked[sprite_index];
+        const guint8* row;
+        const guint8* palette;
         guint8 tile_y;
-        guint8 tile_xoff;
-        guint8 tile_yoff;
-        guint8 (*tile)[8][2];
-        guint8 palette;
         gint16 real_ypos = sprite.ypos - 16;
         gint16 real_xpos = sprite.xpos - 8;
-        guchar* pixel_cur;
 
-        // Skip this sprite if it does not intersect with the scanline.
-        if(real_ypos > screen_ypos || real_ypos+8 <= screen_ypos)
+        if(!(on_line >> sprite_index & 1))
             continue;
 
-        // Determine the pallette we're using for this sprite.
-        if(sprite.palette)
-            palette = gb->mmu->ram_io.unpacked.pal_obj1;
+        // Determine the palette and the row of the tile we're using for this
+        // sprite, possibly flipped.
+        palette = obj_palettes[sprite.palette ? 1 : 0];
+        tile_y = screen_ypos - real_ypos;
+        if(sprite.yflip)
+            tile_y = 7 - tile_y;
+        if(sprite.xflip)
+            row = gb->gpu.tiles.flipped[sprite.tileno][tile_y];
         else
-            palette = gb->mmu->ram_io.unpacked.pal_obj0;
+            row = gb->gpu.tiles.rows[sprite.tileno][tile_y];
 
-        // Grab the tile to be rendered from.
-        if(sprite.tileno < 0x80)
-            tile = &gb->mmu->ram_gpu.unpacked.tileset_1[sprite.tileno];
-        else
-            tile = &gb->mmu->ram_gpu.unpacked.tileset_s[sprite.tileno-0x80];
-
-        // Determine offset within the tile and possibly flip Y coordinates.
-        tile_yoff = screen_ypos - real_ypos;
-        tile_y = sprite.yflip ? 7-tile_yoff : tile_yoff;
-
-        // Start rendering the line intersecting with the line to be rendered.
-        pixel_cur = pixel_base + real_xpos*n_channels;
-        for(tile_xoff = 0; tile_xoff < 8; tile_xoff++) {
-            guint8 code = 0;
-            // Flip X coordinates if the sprite attributes demand so.
-            guint8 tile_x = sprite.xflip ? 7-tile_xoff : tile_xoff;
-
-            // Get the color from the palette like we do for the background.
-            code |= ((*tile)[tile_y][0] & 0x80 >> tile_x) ? 1 : 0;
-            code |= ((*tile)[tile_y][1] & 0x80 >> tile_x) ? 2 : 0;
-
-            // Code zero means transparent, so we don't render that particular
-            // pixel. Also, pixels of non-priority sprites are only rendered if
-            // the current color at that position is white.
-            if(code && (!sprite.priority || (pixel_cur[0] == 0xFF &&
-                 pixel_cur[1] == 0xFF && pixel_cur[2] == 0xFF))) {
-                guint8 color = (palette & (3 << (code*2))) >> (code*2);
-                for(i = 0; i < n_channels; i++)
-                    pixel_cur[i] = 0xFF-85*color;
-            }
-            pixel_cur += n_channels;
-        }
+        // Code zero means transparent, so we don't render that particular
+        // pixel. Also, pixels of non-priority sprites are only rendered if
+        // the current color at that position is white. Pixels off the screen
+        // land in the margins.
+        if(real_xpos > -8 && real_xpos < THALIA_GPU_SCREEN_WIDTH)
+            gb->gpu.kernels->merge(shades + real_xpos, row, palette,
+                                   sprite.priority);
 
         // Keep track of the number of sprites on the line, there's a maximum.
         sprites_drawn++;
     }
 }
 
+// Tells whether line 'y' may come out different from the one already there.
+// Changes to memory during this frame or the last may show on any line.
+// Register writes show from the line they were made on, so those of the last
+// frame only matter up to the last of them.
+static gboolean thalia_gpu_line_changed(ThaliaGB* gb, guint8 y)
+{
+    thalia_gpu_dirty_t* dirty = &gb->gpu.dirty;
+    return dirty->frame || dirty->last || dirty->n_log ||
+           y <= dirty->last_line;
+}
+
 // Renders a line on the main pixel buffer.
 static void thalia_gpu_render_line(ThaliaGB* gb)
 {
@@ -248,23 +433,28 @@ static void thalia_gpu_render_line(ThaliaGB* gb)
     gint n_channels;
     guint8 screen_ypos;
     guchar* pixel_base;
+    guint8 margins[THALIA_GPU_LINE_MARGIN * 2 + THALIA_GPU_SCREEN_WIDTH] = {0};
+    guint8* shades = margins + THALIA_GPU_LINE_MARGIN;
 
-    if(gb->gpu.last_change - gb->gpu.periods > 2)
-        return; // TODO: overflow?
+    if(!thalia_gpu_line_changed(gb, gb->mmu.ram_io.unpacked.line_cur))
+        return;
 
     n_channels = gdk_pixbuf_get_n_channels(gb->gpu.screen);
     rowstride = gdk_pixbuf_get_rowstride(gb->gpu.screen);
-    screen_ypos = gb->mmu->ram_io.unpacked.line_cur;
+    screen_ypos = gb->mmu.ram_io.unpacked.line_cur;
     pixel_base = gdk_pixbuf_get_pixels(gb->gpu.screen) + rowstride*screen_ypos;
 
     g_assert(screen_ypos <= THALIA_GPU_SCREEN_HEIGHT);
     g_assert(n_channels == 3);
 
-    // First render the background of this line.
-    thalia_gpu_render_line_background(gb, screen_ypos, pixel_base, n_channels);
+    // First render the background of this line, from up to date tiles.
+    thalia_gpu_decode_tiles(gb);
+    thalia_gpu_render_line_background(gb, screen_ypos, shades);
 
     // Then look for sprites we might need to draw on top.
-    thalia_gpu_render_line_sprites(gb, screen_ypos, pixel_base, n_channels);
+    thalia_gpu_render_line_sprites(gb, screen_ypos, shades);
+
+    gb->gpu.kernels->expand(pixel_base, shades, THALIA_GPU_SCREEN_WIDTH);
 }
 
 // Emulates the end of a horizontal blanking period.
@@ -272,46 +462,75 @@ static void thalia_gpu_hblank(ThaliaGB* gb)
 {
     gb->gpu.done += THALIA_GPU_DURATION_HBLANK;
 
-    if(gb->mmu->ram_io.unpacked.line_cur < THALIA_GPU_SCREEN_HEIGHT &&
-       gb->mmu->ram_io.unpacked.lcd_operation) {
+    if(gb->mmu.ram_io.unpacked.line_cur < THALIA_GPU_SCREEN_HEIGHT &&
+       gb->mmu.ram_io.unpacked.lcd_operation) {
         // If we're not at the end of the screen, go back to do another line.
-        gb->mmu->ram_io.unpacked.gpu_mode = THALIA_GPU_MODE_SCAN_OAM;
+        gb->mmu.ram_io.unpacked.gpu_mode = THALIA_GPU_MODE_SCAN_OAM;
         thalia_gpu_render_line(gb);
     } else {
-        // If we are, go into vertical blanking mode.
-        gb->mmu->ram_io.unpacked.int_flag_vblank = TRUE;
-        gb->mmu->ram_io.unpacked.gpu_mode = THALIA_GPU_MODE_VBLANK;
+        // If we are, go into vertical blanking mode. With the LCD off, there is
+        // no frame that ends here.
+        if(gb->mmu.ram_io.unpacked.lcd_operation)
+            thalia_gb_interrupt(gb, THALIA_INT_VBLANK);
+        gb->mmu.ram_io.unpacked.gpu_mode = THALIA_GPU_MODE_VBLANK;
     }
 
     // Skip one line ahead and check for possible interrupts.
-    gb->mmu->ram_io.unpacked.line_cur++;
+    gb->mmu.ram_io.unpacked.line_cur++;
     thalia_gpu_check_scanline_interrupt(gb);
     thalia_gpu_check_status_interrupt(gb);
 }
 
+// Sums up the changes of the frame that ends for the next one, and starts
+// over.
+static void thalia_gpu_next_frame(ThaliaGB* gb)
+{
+    thalia_gpu_dirty_t* dirty = &gb->gpu.dirty;
+
+    // Where writes went past the end of the log is not known, so then they
+    // may show on any line.
+    if(!dirty->n_log)
+        dirty->last_line = -1;
+    else if(dirty->n_log > THALIA_GPU_LOG_SIZE)
+        dirty->last_line = THALIA_GPU_SCREEN_HEIGHT_EXTRA;
+    else
+        dirty->last_line = dirty->log[dirty->n_log - 1].line;
+
+    dirty->last = dirty->frame;
+    dirty->frame = FALSE;
+    dirty->n_log = 0;
+}
+
 // Emulates the end of a vertical blanking period.
 static void thalia_gpu_vblank(ThaliaGB* gb)
 {
     gb->gpu.done += THALIA_GPU_DURATION_VBLANK;
-    gb->mmu->ram_io.unpacked.line_cur++;
+    gb->mmu.ram_io.unpacked.line_cur++;
     thalia_gpu_check_scanline_interrupt(gb);
 
-    if(gb->mmu->ram_io.unpacked.line_cur >= THALIA_GPU_SCREEN_HEIGHT_EXTRA) {
+    if(gb->mmu.ram_io.unpacked.line_cur >= THALIA_GPU_SCREEN_HEIGHT_EXTRA) {
         // If at the end of the extra lines, go back to the top of the screen.
-        gb->mmu->ram_io.unpacked.line_cur = 0;
-        gb->mmu->ram_io.unpacked.gpu_mode = THALIA_GPU_MODE_SCAN_OAM;
+        gb->mmu.ram_io.unpacked.line_cur = 0;
+        gb->mmu.ram_io.unpacked.gpu_mode = THALIA_GPU_MODE_SCAN_OAM;
         thalia_gpu_check_status_interrupt(gb);
 
-        if(gb->gpu.periods - gb->gpu.last_change < 2) {
-            // Signal the consuming code that the screen may now be rendered.
-            // Note that we can only continue once the consuming code
-            // relinquishes its lock. This is done to prevent the emulation
-            // thread from continuing to render, causing screen tearing.
-            thalia_gpu_unlock(gb);
-            g_signal_emit_by_name(G_OBJECT(gb), "thalia-render-screen");
-            thalia_gpu_lock(gb);
-        } else
-            gb->gpu.periods++;
+        // Saves are written to disk a frame at a time.
+        thalia_save_commit(gb);
+
+        // Start keeping track of changes for the next frame.
+        thalia_gpu_next_frame(gb);
+
+        // Signal the consuming code that the screen may now be rendered.
+        // Note that we can only continue once the consuming code
+        // relinquishes its lock. This is done to prevent the emulation
+        // thread from continuing to render, causing screen tearing.
+        thalia_gpu_unlock(gb);
+        g_signal_emit_by_name(G_OBJECT(gb), "thalia-render-screen");
+        thalia_gpu_lock(gb);
+
+        // Runs bounded by frames end here.
+        if(gb->run.frame)
+            thalia_gb_stop(gb, THALIA_GB_STATUS_FRAME);
     }
 }
 
@@ -319,7 +538,7 @@ static void thalia_gpu_vblank(ThaliaGB* gb)
 static void thalia_gpu_scan_oam(ThaliaGB* gb)
 {
     gb->gpu.done += THALIA_GPU_DURATION_SCAN_OAM;
-    gb->mmu->ram_io.unpacked.gpu_mode = THALIA_GPU_MODE_SCAN_VRAM;
+    gb->mmu.ram_io.unpacked.gpu_mode = THALIA_GPU_MODE_SCAN_VRAM;
     thalia_gpu_check_status_interrupt(gb);
 }
 
@@ -327,21 +546,20 @@ static void thalia_gpu_scan_oam(ThaliaGB* gb)
 static void thalia_gpu_scan_vram(ThaliaGB* gb)
 {
     gb->gpu.done += THALIA_GPU_DURATION_SCAN_VRAM;
-    gb->mmu->ram_io.unpacked.gpu_mode = THALIA_GPU_MODE_HBLANK;
+    gb->mmu.ram_io.unpacked.gpu_mode = THALIA_GPU_MODE_HBLANK;
     thalia_gpu_check_status_interrupt(gb);
 }
 
 // Adjusts the GPU state to the machine state after opcode execution.
 void thalia_gpu_step(ThaliaGB* gb)
 {
-    guint32 left;
-    gb->mmu->ram_io.unpacked.int_flag_vblank = FALSE;
+    guint64 left;
 
     // 'left' holds the cycles that the GPU has yet to emulate. If there's
     // enough time accumulated to reach the end of a mode, kick off a relevant
     // function.
     while((left = gb->cycles - gb->gpu.done) > 0) {
-        switch(gb->mmu->ram_io.unpacked.gpu_mode) {
+        switch(gb->mmu.ram_io.unpacked.gpu_mode) {
         case THALIA_GPU_MODE_HBLANK:
             if(left >= THALIA_GPU_DURATION_HBLANK)
                 thalia_gpu_hblank(gb);
@@ -369,3 +587,15 @@ void thalia_gpu_step(ThaliaGB* gb)
         }
     }
 }
+
+// Returns the cycle count at which the current GPU mode ends.
+guint64 thalia_gpu_deadline(ThaliaGB* gb)
+{
+    static const guint8 durations[] = {
+        [THALIA_GPU_MODE_HBLANK] = THALIA_GPU_DURATION_HBLANK,
+        [THALIA_GPU_MODE_VBLANK] = THALIA_GPU_DURATION_VBLANK,
+        [THALIA_GPU_MODE_SCAN_OAM] = THALIA_GPU_DURATION_SCAN_OAM,
+        [THALIA_GPU_MODE_SCAN_VRAM] = THALIA_GPU_DURATION_SCAN_VRAM
+    };
+    return gb->gpu.done + durations[gb->mmu.ram_io.unpacked.gpu_mode];
+}
@@ -4,17 +4,24 @@
 #include <glib.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
 #include "thalia_gb.h"
+#include "thalia_line.h"
 
 #define THALIA_GPU_DURATION_HBLANK 51
 #define THALIA_GPU_DURATION_VBLANK 114
 #define THALIA_GPU_DURATION_SCAN_OAM 20
 #define THALIA_GPU_DURATION_SCAN_VRAM 43
+#define THALIA_GPU_DURATION_DMA 160
 
 #define THALIA_GPU_SCREEN_HEIGHT 144
 #define THALIA_GPU_SCREEN_WIDTH 160
 #define THALIA_GPU_SCREEN_HEIGHT_EXTRA 154
+#define THALIA_GPU_DURATION_FRAME \
+    (THALIA_GPU_SCREEN_HEIGHT_EXTRA * THALIA_GPU_DURATION_VBLANK)
 #define THALIA_GPU_N_SPRITES 40
 #define THALIA_GPU_MAX_SPRITES_ON_LINE 10
+#define THALIA_GPU_N_TILES 384
+#define THALIA_GPU_LOG_SIZE 64
+#define THALIA_GPU_LINE_MARGIN 8
 
 // Sprite, corresponds with the memory layout in object attribute memory (OAM).
 typedef struct {
@@ -36,19 +43,72 @@ typedef enum {
     THALIA_GPU_MODE_SCAN_VRAM = 3
 } thalia_gpu_mode_t;
 
+// Write to an LCD register that affects what is drawn.
 typedef struct {
-    guint32 done;      // Cycles the GPU has processed.
+    guint8 line;       // Line the GPU was at
+    guint8 reg;        // Register, as offset from 0xFF00
+    guint8 val;        // Value written
+} thalia_gpu_reg_change_t;
+
+// What changed in video memory and registers. Writes of the value already
+// there do not count. The bit sets accumulate until whoever caches what they
+// cover clears them; the rest starts over every frame.
+typedef struct {
+    guint32 tiles[THALIA_GPU_N_TILES / 32]; // Tiles at 0x8000-0x97FF
+    guint32 rows[2];                        // Rows of both tile maps
+    guint64 oam;                            // Sprites in OAM
+    thalia_gpu_reg_change_t log[THALIA_GPU_LOG_SIZE]; // Registers, in order
+    guint n_log;                            // Writes to them, may exceed log
+    gint last_line;                         // Line of the last one during the
+                                            // last frame, -1 without any
+    gboolean frame;                         // Whether VRAM or OAM changed
+    gboolean last;                          // Ditto, during the last frame
+} thalia_gpu_dirty_t;
+
+// Tiles in video memory, decoded to a color code per pixel. Tiles are decoded
+// again before a line is drawn if they changed since.
+typedef struct {
+    guint8 rows[THALIA_GPU_N_TILES][8][8];    // Codes, left to right
+    guint8 flipped[THALIA_GPU_N_TILES][8][8]; // Ditto, right to left
+    guint32 versions[THALIA_GPU_N_TILES];     // Times each was decoded
+    guint32 generation;                       // Times any tile was decoded
+} thalia_gpu_tiles_t;
+
+// A whole tile map drawn as color codes, for one way of numbering tiles. The
+// part of a line that is shown is drawn again, a tile at a time, if it now
+// shows another tile or a newer version of it. Cells are only looked at again
+// once their map row is written or some tile is decoded.
+typedef struct {
+    guint8 codes[256][256];     // Color codes of every pixel
+    guint16 tiles[256][32];     // Tile drawn on each line of each cell
+    guint32 versions[256][32];  // Version of that tile
+    guint32 fresh[256];         // Cells of each line known to be up to date
+    guint32 generations[256];   // Tile generation they were checked at
+} thalia_gpu_layer_t;
+
+typedef struct {
+    guint64 done;      // Cycles the GPU has processed.
     GdkPixbuf* screen; // Pixel buffer to draw the screen on.
-    gint64 last_change;
-    gint64 periods;
+    thalia_gpu_dirty_t dirty;
+    thalia_gpu_tiles_t tiles;
+    thalia_gpu_layer_t* layers[2][2]; // By map and lcd_tile_data, or NULL
+    guint64 sprites[THALIA_GPU_SCREEN_HEIGHT]; // Sprites on each line, by bit
+    const thalia_line_kernels_t* kernels; // Used to draw lines
     GMutex mutex;
 } thalia_gpu_t;
 #endif
 
 #ifdef __THALIA_GB_T__
+void thalia_gpu_free(ThaliaGB* gb);
+void thalia_gpu_set_isa(ThaliaGB* gb, thalia_line_isa_t isa);
 void thalia_gpu_lock(ThaliaGB* gb);
 void thalia_gpu_unlock(ThaliaGB* gb);
-void thalia_gpu_mark_change(ThaliaGB* gb);
+void thalia_gpu_write_vram(ThaliaGB* gb, guint16 addr, guint8 val);
+void thalia_gpu_write_oam(ThaliaGB* gb, guint16 addr, guint8 val);
+void thalia_gpu_write_reg(ThaliaGB* gb, guint16 addr, guint8 val);
 void thalia_gpu_step(ThaliaGB* gb);
+guint64 thalia_gpu_deadline(ThaliaGB* gb);
 void thalia_gpu_handle_dma(ThaliaGB* gb, guint8 addr_msb);
+guint64 thalia_gpu_dma_deadline(ThaliaGB* gb);
+void thalia_gpu_dma_step(ThaliaGB* gb);
 #endif
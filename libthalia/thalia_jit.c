@@ -0,0 +1,796 @@
+#include <glib.h>
+#include <stddef.h>
+#include <string.h>
+#include "thalia_gb.h"
+#include "thalia_alu.h"
+#include "thalia_jit.h"
+#include "thalia_proc.h"
+
+#if defined(__x86_64__) && defined(G_OS_UNIX)
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Signature of a translated block.
+typedef void (*thalia_jit_code_t)(ThaliaGB* gb);
+
+// Offsets of the machine state used by translated code, relative to 'gb'.
+#define THALIA_JIT_OFFSET_REG    offsetof(ThaliaGB, reg)
+#define THALIA_JIT_OFFSET_FLAGS  offsetof(ThaliaGB, flags)
+#define THALIA_JIT_OFFSET_PC     offsetof(ThaliaGB, pc)
+#define THALIA_JIT_OFFSET_CYCLES offsetof(ThaliaGB, cycles)
+#define THALIA_JIT_OFFSET_STALE  offsetof(ThaliaGB, cache.stale)
+#define THALIA_JIT_OFFSET_START  offsetof(ThaliaGB, sched.start)
+#define THALIA_JIT_OFFSET_NEXT   offsetof(ThaliaGB, sched.next)
+
+// Translated code writes the pending flags as one word, plus 'keep'.
+G_STATIC_ASSERT(offsetof(thalia_alu_flags_t, a) == 1);
+G_STATIC_ASSERT(offsetof(thalia_alu_flags_t, b) == 2);
+G_STATIC_ASSERT(offsetof(thalia_alu_flags_t, carry) == 3);
+G_STATIC_ASSERT(offsetof(thalia_alu_flags_t, keep) == 4);
+
+// Largest amount of code emitted for a single instruction, and for the
+// prologue and epilogue of a block.
+#define THALIA_JIT_MAX_INSN_SIZE  0x180
+#define THALIA_JIT_MAX_FRAME_SIZE 0x80
+
+// x86-64 registers used by translated code. RBX holds 'gb' throughout; EAX,
+// ECX and EDX are scratch.
+#define THALIA_JIT_EAX 0
+#define THALIA_JIT_ECX 1
+#define THALIA_JIT_EDX 2
+
+// Callee-saved host registers that guest registers are kept in, so they
+// survive the calls made into C.
+static const guint8 thalia_jit_hosts[] = {
+    5,                                // RBP
+    12, 13, 14, 15                    // R12 - R15
+};
+#define THALIA_JIT_N_HOSTS G_N_ELEMENTS(thalia_jit_hosts)
+
+// Instructions translated to native code instead of calling their handler.
+typedef enum {
+    THALIA_JIT_OP_CALL = 0,           // Anything else
+    THALIA_JIT_OP_NOP,                // NOP
+    THALIA_JIT_OP_LD_R,               // LD d, s between two registers
+    THALIA_JIT_OP_LD_N,               // LD d, n into a register
+    THALIA_JIT_OP_INC,                // INC d
+    THALIA_JIT_OP_DEC,                // DEC d
+    THALIA_JIT_OP_INC_16,             // INC rr, but not SP
+    THALIA_JIT_OP_DEC_16,             // DEC rr, but not SP
+    THALIA_JIT_OP_ALU_R,              // ADD, SUB, AND, XOR, OR, CP with s
+    THALIA_JIT_OP_ALU_N               // ADD, SUB, AND, XOR, OR, CP with n
+} thalia_jit_op_t;
+
+// ALU operations, as encoded in bits 3 to 5 of their opcodes.
+#define THALIA_JIT_ALU_ADD 0
+#define THALIA_JIT_ALU_ADC 1
+#define THALIA_JIT_ALU_SUB 2
+#define THALIA_JIT_ALU_SBC 3
+#define THALIA_JIT_ALU_AND 4
+#define THALIA_JIT_ALU_XOR 5
+#define THALIA_JIT_ALU_OR  6
+#define THALIA_JIT_ALU_CP  7
+
+// Code being emitted, along with the jumps to the block exit to patch and the
+// host register each guest byte register lives in, or -1 if it stays in
+// memory.
+typedef struct {
+    guint8* pos;
+    guint8* exits[4 * THALIA_PROC_BLOCK_SIZE];
+    guint n_exits;
+    gint8 hosts[8];
+    guint8 dirty;                     // Host registers newer than memory
+    guint16 pc;                       // Program counter after the last insn
+    gboolean pc_stored;               // Whether it is in memory already
+} thalia_jit_emitter_t;
+
+// Classifies 'opcode', storing the guest registers it uses in 'regs' (which
+// must hold three) and their number in 'n_regs'.
+static thalia_jit_op_t thalia_jit_classify(guint16 opcode, guint8* regs,
+                                           guint* n_regs)
+{
+    guint8 dst = (opcode >> 3) & 0x07, src = opcode & 0x07;
+    guint8 alu = dst;
+
+    *n_regs = 0;
+    if(opcode & THALIA_PROC_EXTENDED)
+        return THALIA_JIT_OP_CALL;
+    if(opcode == 0x00)
+        return THALIA_JIT_OP_NOP;
+
+    if((opcode & 0xC0) == 0x40 && opcode != 0x76 &&
+       src != THALIA_REG_IHL && dst != THALIA_REG_IHL) {
+        regs[(*n_regs)++] = src;
+        regs[(*n_regs)++] = dst;
+        return THALIA_JIT_OP_LD_R;
+    }
+    if(opcode < 0x40 && dst != THALIA_REG_IHL) {
+        switch(src) {
+        case 0x04:
+            regs[(*n_regs)++] = dst;
+            return THALIA_JIT_OP_INC;
+        case 0x05:
+            regs[(*n_regs)++] = dst;
+            return THALIA_JIT_OP_DEC;
+        case 0x06:
+            regs[(*n_regs)++] = dst;
+            return THALIA_JIT_OP_LD_N;
+        }
+    }
+    if((opcode & 0xC7) == 0x03 && opcode != 0x33 && opcode != 0x3B) {
+        regs[(*n_regs)++] = 2 * ((opcode >> 4) & 0x03);
+        regs[(*n_regs)++] = 2 * ((opcode >> 4) & 0x03) + 1;
+        return opcode & 0x08 ? THALIA_JIT_OP_DEC_16 : THALIA_JIT_OP_INC_16;
+    }
+
+    // ADC and SBC read the carry flag, so they are left to their handlers.
+    if(alu == THALIA_JIT_ALU_ADC || alu == THALIA_JIT_ALU_SBC)
+        return THALIA_JIT_OP_CALL;
+    if((opcode & 0xC0) == 0x80 && src != THALIA_REG_IHL) {
+        regs[(*n_regs)++] = THALIA_REG_A;
+        regs[(*n_regs)++] = src;
+        return THALIA_JIT_OP_ALU_R;
+    }
+    if((opcode & 0xC7) == 0xC6) {
+        regs[(*n_regs)++] = THALIA_REG_A;
+        return THALIA_JIT_OP_ALU_N;
+    }
+    return THALIA_JIT_OP_CALL;
+}
+
+// Emits 'n' raw bytes.
+static void thalia_jit_emit(thalia_jit_emitter_t* e, const guint8* bytes,
+                            gsize n)
+{
+    memcpy(e->pos, bytes, n);
+    e->pos += n;
+}
+
+// Emits a 16-, 32- or 64-bit little-endian immediate.
+static void thalia_jit_emit_imm(thalia_jit_emitter_t* e, guint64 imm, gsize n)
+{
+    gsize i;
+    for(i = 0; i < n; i++)
+        *e->pos++ = imm >> (8 * i);
+}
+
+// Points the 32-bit jump displacement at 'at' to 'target'.
+static void thalia_jit_patch(guint8* at, const guint8* target)
+{
+    gint32 rel = target - (at + 4);
+    memcpy(at, &rel, sizeof(rel));
+}
+
+// Emits 'op' with register 'r' in its reg field and the memory at
+// [rbx + offset] as its r/m operand.
+static void thalia_jit_emit_mem(thalia_jit_emitter_t* e, const guint8* op,
+                                gsize n, guint8 r, guint32 offset)
+{
+    thalia_jit_emit(e, op, n);
+    *e->pos++ = 0x80 | (r & 0x07) << 3 | 0x03;
+    thalia_jit_emit_imm(e, offset, 4);
+}
+
+// Emits 'op' with scratch register 'r' in its reg field and guest byte
+// register 'reg' as its r/m operand, be it in a host register or in memory.
+static void thalia_jit_emit_reg(thalia_jit_emitter_t* e, const guint8* op,
+                                gsize n, guint8 r, guint8 reg)
+{
+    gint8 host = e->hosts[reg];
+
+    if(host < 0) {
+        thalia_jit_emit_mem(e, op, n, r, THALIA_JIT_OFFSET_REG +
+                                         THALIA_REG_INDEX(reg));
+        return;
+    }
+
+    // Always give a REX prefix, so that RBP stands for BPL and not CH.
+    *e->pos++ = 0x40 | (host >= 8 ? 0x01 : 0x00);
+    thalia_jit_emit(e, op, n);
+    *e->pos++ = 0xC0 | r << 3 | (host & 0x07);
+}
+
+// Emits code reading guest register 'reg' into scratch register 'r'.
+static void thalia_jit_emit_read(thalia_jit_emitter_t* e, guint8 r,
+                                 guint8 reg)
+{
+    static const guint8 movzx[] = { 0x0F, 0xB6 };
+    thalia_jit_emit_reg(e, movzx, sizeof(movzx), r, reg);
+}
+
+// Emits code writing the low byte of scratch register 'r' into guest
+// register 'reg'.
+static void thalia_jit_emit_write(thalia_jit_emitter_t* e, guint8 r,
+                                  guint8 reg)
+{
+    static const guint8 mov[] = { 0x88 };
+    thalia_jit_emit_reg(e, mov, sizeof(mov), r, reg);
+    e->dirty |= 1 << reg;
+}
+
+// Emits code moving the guest registers in 'regs', a bit set, from host
+// registers to memory, or back again if 'load' is set. Registers kept in
+// memory anyway are skipped.
+static void thalia_jit_emit_spill(thalia_jit_emitter_t* e, guint8 regs,
+                                  gboolean load)
+{
+    static const guint8 movzx[] = { 0x0F, 0xB6 };
+    static const guint8 mov[] = { 0x88 };
+    guint8 reg, host;
+
+    for(reg = 0; reg < G_N_ELEMENTS(e->hosts); reg++) {
+        if(e->hosts[reg] < 0 || !(regs & 1 << reg))
+            continue;
+
+        // Stores need a REX prefix for BPL, loads only for R8 and up.
+        host = e->hosts[reg];
+        if(!load || host >= 8)
+            *e->pos++ = 0x40 | (host >= 8 ? 0x04 : 0x00);
+        if(load)
+            thalia_jit_emit_mem(e, movzx, sizeof(movzx), host,
+                                THALIA_JIT_OFFSET_REG + THALIA_REG_INDEX(reg));
+        else
+            thalia_jit_emit_mem(e, mov, sizeof(mov), host,
+                                THALIA_JIT_OFFSET_REG + THALIA_REG_INDEX(reg));
+    }
+}
+
+// Emits code storing the program counter after the last instruction, unless
+// it is in memory already.
+static void thalia_jit_emit_store_pc(thalia_jit_emitter_t* e)
+{
+    static const guint8 mov_pc[] = { 0x66, 0xC7 };
+    if(e->pc_stored)
+        return;
+    thalia_jit_emit_mem(e, mov_pc, sizeof(mov_pc), 0, THALIA_JIT_OFFSET_PC);
+    thalia_jit_emit_imm(e, e->pc, 2);
+}
+
+// Emits "call <fn>(gb, ...)", with 'gb' living in RBX and the arguments after
+// it already in place.
+static void thalia_jit_emit_call(thalia_jit_emitter_t* e, gpointer fn)
+{
+    static const guint8 mov_rdi_rbx[] = { 0x48, 0x89, 0xDF };
+    static const guint8 mov_rax[] = { 0x48, 0xB8 };
+    static const guint8 call_rax[] = { 0xFF, 0xD0 };
+
+    thalia_jit_emit(e, mov_rdi_rbx, sizeof(mov_rdi_rbx));
+    thalia_jit_emit(e, mov_rax, sizeof(mov_rax));
+    thalia_jit_emit_imm(e, (guint64) fn, 8);
+    thalia_jit_emit(e, call_rax, sizeof(call_rax));
+}
+
+// Emits a conditional jump 'jcc' (the second byte of its near form) to the
+// block exit.
+static void thalia_jit_emit_exit_if(thalia_jit_emitter_t* e, guint8 jcc)
+{
+    *e->pos++ = 0x0F;
+    *e->pos++ = jcc;
+    e->exits[e->n_exits++] = e->pos;
+    thalia_jit_emit_imm(e, 0, 4);
+}
+
+// Emits code leaving the block if the program counter is not at 'pc' anymore,
+// or if the code may have been changed.
+static void thalia_jit_emit_exit_checks(thalia_jit_emitter_t* e, guint16 pc)
+{
+    static const guint8 cmp_pc[] = { 0x66, 0x81 };
+    static const guint8 cmp_stale[] = { 0x83 };
+
+    thalia_jit_emit_mem(e, cmp_pc, sizeof(cmp_pc), 7, THALIA_JIT_OFFSET_PC);
+    thalia_jit_emit_imm(e, pc, 2);
+    thalia_jit_emit_exit_if(e, 0x85); // jne
+    thalia_jit_emit_mem(e, cmp_stale, sizeof(cmp_stale), 7,
+                        THALIA_JIT_OFFSET_STALE);
+    *e->pos++ = 0x00;
+    thalia_jit_emit_exit_if(e, 0x85); // jne
+}
+
+// Emits code computing F from the pending operation, if there is one.
+static void thalia_jit_emit_sync_flags(thalia_jit_emitter_t* e)
+{
+    static const guint8 cmp_op[] = { 0x80 };
+    guint8* skip;
+
+    thalia_jit_emit_mem(e, cmp_op, sizeof(cmp_op), 7,
+                        THALIA_JIT_OFFSET_FLAGS + offsetof(thalia_alu_flags_t,
+                                                           op));
+    *e->pos++ = THALIA_ALU_OP_NONE;
+    *e->pos++ = 0x74; // je
+    skip = e->pos++;
+    thalia_jit_emit_call(e, thalia_alu_sync_flags);
+    *skip = e->pos - (skip + 1);
+}
+
+// Emits code recording operation 'op' for its flags to be computed later,
+// like thalia_alu_defer() does. The first operand is in EAX and the second in
+// ECX, or 'b' if 'b_in_ecx' is not set.
+static void thalia_jit_emit_defer(thalia_jit_emitter_t* e, thalia_alu_op_t op,
+                                  gboolean b_in_ecx, guint8 b, guint8 keep)
+{
+    static const guint8 mov_edx_ecx[] = { 0x89, 0xCA };
+    static const guint8 shl_edx_8[] = { 0xC1, 0xE2, 0x08 };
+    static const guint8 or_edx_eax[] = { 0x09, 0xC2 };
+    static const guint8 or_edx[] = { 0x83, 0xCA };
+    static const guint8 mov_edx[] = { 0x89 };
+    static const guint8 mov_keep[] = { 0xC6 };
+
+    // Builds op | a << 8 | b << 16 with a zero carry in EDX.
+    if(b_in_ecx) {
+        thalia_jit_emit(e, mov_edx_ecx, sizeof(mov_edx_ecx));
+    } else {
+        *e->pos++ = 0xBA; // mov edx, imm32
+        thalia_jit_emit_imm(e, b, 4);
+    }
+    thalia_jit_emit(e, shl_edx_8, sizeof(shl_edx_8));
+    thalia_jit_emit(e, or_edx_eax, sizeof(or_edx_eax));
+    thalia_jit_emit(e, shl_edx_8, sizeof(shl_edx_8));
+    thalia_jit_emit(e, or_edx, sizeof(or_edx));
+    *e->pos++ = op;
+
+    thalia_jit_emit_mem(e, mov_edx, sizeof(mov_edx), THALIA_JIT_EDX,
+                        THALIA_JIT_OFFSET_FLAGS);
+    thalia_jit_emit_mem(e, mov_keep, sizeof(mov_keep), 0,
+                        THALIA_JIT_OFFSET_FLAGS +
+                        offsetof(thalia_alu_flags_t, keep));
+    *e->pos++ = keep;
+}
+
+// Emits code computing the flags just recorded at once, if the interpreter
+// does so too. The call clobbers the scratch registers.
+static void thalia_jit_emit_eager_flags(thalia_jit_emitter_t* e)
+{
+#ifdef THALIA_ALU_EAGER_FLAGS
+    thalia_jit_emit_call(e, thalia_alu_sync_flags);
+#endif
+}
+
+// Emits one of the ALU operations translated, on A and ECX.
+static void thalia_jit_emit_alu(thalia_jit_emitter_t* e, guint8 alu)
+{
+    static const guint8 add_ecx[] = { 0x01, 0xC8 };    // add eax, ecx
+    static const guint8 sub_ecx[] = { 0x29, 0xC8 };    // sub eax, ecx
+    static const guint8 and_ecx[] = { 0x21, 0xC8 };    // and eax, ecx
+    static const guint8 xor_ecx[] = { 0x31, 0xC8 };    // xor eax, ecx
+    static const guint8 or_ecx[] = { 0x09, 0xC8 };     // or eax, ecx
+
+    thalia_jit_emit_read(e, THALIA_JIT_EAX, THALIA_REG_A);
+    switch(alu) {
+    case THALIA_JIT_ALU_ADD:
+        thalia_jit_emit_defer(e, THALIA_ALU_OP_ADD, TRUE, 0, 0);
+        thalia_jit_emit(e, add_ecx, sizeof(add_ecx));
+        break;
+    case THALIA_JIT_ALU_SUB:
+        thalia_jit_emit_defer(e, THALIA_ALU_OP_SUB, TRUE, 0, 0);
+        thalia_jit_emit(e, sub_ecx, sizeof(sub_ecx));
+        break;
+    case THALIA_JIT_ALU_CP:
+        thalia_jit_emit_defer(e, THALIA_ALU_OP_SUB, TRUE, 0, 0);
+        thalia_jit_emit_eager_flags(e);
+        return;
+    case THALIA_JIT_ALU_AND:
+        thalia_jit_emit(e, and_ecx, sizeof(and_ecx));
+        thalia_jit_emit_defer(e, THALIA_ALU_OP_ZERO, FALSE,
+                              THALIA_ALU_FLAG_HALFCARRY, 0);
+        break;
+    case THALIA_JIT_ALU_XOR:
+        thalia_jit_emit(e, xor_ecx, sizeof(xor_ecx));
+        thalia_jit_emit_defer(e, THALIA_ALU_OP_ZERO, FALSE, 0, 0);
+        break;
+    case THALIA_JIT_ALU_OR:
+        thalia_jit_emit(e, or_ecx, sizeof(or_ecx));
+        thalia_jit_emit_defer(e, THALIA_ALU_OP_ZERO, FALSE, 0, 0);
+        break;
+    }
+    thalia_jit_emit_write(e, THALIA_JIT_EAX, THALIA_REG_A);
+    thalia_jit_emit_eager_flags(e);
+}
+
+// Emits the operation of 'insn', of kind 'op', in native code.
+static void thalia_jit_emit_native(thalia_jit_emitter_t* e,
+                                   const thalia_proc_insn_t* insn,
+                                   thalia_jit_op_t op, const guint8* regs)
+{
+    static const guint8 mov_imm[] = { 0xC6 };
+    static const guint8 add_eax_1[] = { 0x83, 0xC0, 0x01 };
+    static const guint8 sub_eax_1[] = { 0x83, 0xE8, 0x01 };
+    static const guint8 shl_ecx_8[] = { 0xC1, 0xE1, 0x08 };
+    static const guint8 or_eax_ecx[] = { 0x09, 0xC8 };
+    static const guint8 shr_eax_8[] = { 0xC1, 0xE8, 0x08 };
+
+    switch(op) {
+    case THALIA_JIT_OP_NOP:
+    case THALIA_JIT_OP_CALL:
+        break;
+    case THALIA_JIT_OP_LD_R:
+        thalia_jit_emit_read(e, THALIA_JIT_EAX, regs[0]);
+        thalia_jit_emit_write(e, THALIA_JIT_EAX, regs[1]);
+        break;
+    case THALIA_JIT_OP_LD_N:
+        thalia_jit_emit_reg(e, mov_imm, sizeof(mov_imm), 0, regs[0]);
+        *e->pos++ = insn->operand;
+        e->dirty |= 1 << regs[0];
+        break;
+    case THALIA_JIT_OP_INC:
+    case THALIA_JIT_OP_DEC:
+        // The carry flag is kept from the operation before.
+        thalia_jit_emit_sync_flags(e);
+        thalia_jit_emit_read(e, THALIA_JIT_EAX, regs[0]);
+        thalia_jit_emit_defer(e, op == THALIA_JIT_OP_INC ? THALIA_ALU_OP_ADD :
+                                                           THALIA_ALU_OP_SUB,
+                              FALSE, 1, THALIA_ALU_FLAG_CARRY);
+        if(op == THALIA_JIT_OP_INC)
+            thalia_jit_emit(e, add_eax_1, sizeof(add_eax_1));
+        else
+            thalia_jit_emit(e, sub_eax_1, sizeof(sub_eax_1));
+        thalia_jit_emit_write(e, THALIA_JIT_EAX, regs[0]);
+        thalia_jit_emit_eager_flags(e);
+        break;
+    case THALIA_JIT_OP_INC_16:
+    case THALIA_JIT_OP_DEC_16:
+        thalia_jit_emit_read(e, THALIA_JIT_EAX, regs[1]);
+        thalia_jit_emit_read(e, THALIA_JIT_ECX, regs[0]);
+        thalia_jit_emit(e, shl_ecx_8, sizeof(shl_ecx_8));
+        thalia_jit_emit(e, or_eax_ecx, sizeof(or_eax_ecx));
+        if(op == THALIA_JIT_OP_INC_16)
+            thalia_jit_emit(e, add_eax_1, sizeof(add_eax_1));
+        else
+            thalia_jit_emit(e, sub_eax_1, sizeof(sub_eax_1));
+        thalia_jit_emit_write(e, THALIA_JIT_EAX, regs[1]);
+        thalia_jit_emit(e, shr_eax_8, sizeof(shr_eax_8));
+        thalia_jit_emit_write(e, THALIA_JIT_EAX, regs[0]);
+        break;
+    case THALIA_JIT_OP_ALU_R:
+        thalia_jit_emit_read(e, THALIA_JIT_ECX, regs[1]);
+        thalia_jit_emit_alu(e, (insn->opcode >> 3) & 0x07);
+        break;
+    case THALIA_JIT_OP_ALU_N:
+        *e->pos++ = 0xB9; // mov ecx, imm32
+        thalia_jit_emit_imm(e, insn->operand & 0xFF, 4);
+        thalia_jit_emit_alu(e, (insn->opcode >> 3) & 0x07);
+        break;
+    }
+}
+
+// Tells whether the handler of 'opcode' may write any of the byte registers
+// but F. Jumps, stores, stack operations and the like leave them alone.
+static gboolean thalia_jit_writes_regs(guint16 opcode)
+{
+    if(opcode & THALIA_PROC_EXTENDED)
+        return (opcode & 0x07) != THALIA_REG_IHL &&
+               ((opcode & 0xC0) != 0x40);
+
+    switch(opcode) {
+    case 0x02: case 0x12: case 0x08: case 0x10: case 0x18: case 0x20:
+    case 0x28: case 0x30: case 0x38: case 0x31: case 0x33: case 0x3B:
+    case 0x34: case 0x35: case 0x36: case 0x37: case 0x3F: case 0x70:
+    case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76:
+    case 0x77: case 0xBE: case 0xC0: case 0xC2: case 0xC3: case 0xC4:
+    case 0xC5: case 0xC7: case 0xC8: case 0xC9: case 0xCA: case 0xCC:
+    case 0xCD: case 0xCF: case 0xD0: case 0xD2: case 0xD4: case 0xD5:
+    case 0xD7: case 0xD8: case 0xD9: case 0xDA: case 0xDC: case 0xDF:
+    case 0xE0: case 0xE2: case 0xE5: case 0xE7: case 0xE8: case 0xE9:
+    case 0xEA: case 0xEF: case 0xF3: case 0xF7: case 0xF9: case 0xFB:
+    case 0xFF:
+        return FALSE;
+    default:
+        return TRUE;
+    }
+}
+
+// Emits 'insn': adds its base cycles and performs it, either in native code or
+// by calling the interpreter's handler. In the latter case, the program
+// counter and the start of the instruction are stored first, and guest
+// registers are synced with memory around the call. Returns FALSE for
+// unhandled opcodes.
+static gboolean thalia_jit_emit_insn(thalia_jit_emitter_t* e,
+                                     const thalia_proc_insn_t* insn,
+                                     gboolean last, gboolean step)
+{
+    static const guint8 add_cycles[] = { 0x48, 0x83 };
+    static const guint8 load_rax[] = { 0x48, 0x8B };
+    static const guint8 store_rax[] = { 0x48, 0x89 };
+    guint8 length, cycles, regs[3];
+    thalia_jit_op_t op;
+    gpointer handler;
+    guint n_regs;
+
+    handler = thalia_proc_describe(insn->opcode, &length, &cycles);
+    if(!handler)
+        return FALSE;
+    op = thalia_jit_classify(insn->opcode, regs, &n_regs);
+
+    e->pc = insn->pc + length;
+    e->pc_stored = FALSE;
+    if(op == THALIA_JIT_OP_CALL) {
+        thalia_jit_emit_spill(e, e->dirty, FALSE);
+        e->dirty = 0;
+        thalia_jit_emit_store_pc(e);
+        thalia_jit_emit_mem(e, load_rax, sizeof(load_rax), THALIA_JIT_EAX,
+                            THALIA_JIT_OFFSET_CYCLES);
+        thalia_jit_emit_mem(e, store_rax, sizeof(store_rax), THALIA_JIT_EAX,
+                            THALIA_JIT_OFFSET_START);
+    }
+    if(cycles) {
+        thalia_jit_emit_mem(e, add_cycles, sizeof(add_cycles), 0,
+                            THALIA_JIT_OFFSET_CYCLES);
+        *e->pos++ = cycles;
+    }
+
+    if(op != THALIA_JIT_OP_CALL) {
+        thalia_jit_emit_native(e, insn, op, regs);
+        return TRUE;
+    }
+
+    *e->pos++ = 0xBE; // mov esi, imm32
+    thalia_jit_emit_imm(e, insn->opcode & 0xFF, 4);
+    *e->pos++ = 0xBA; // mov edx, imm32
+    thalia_jit_emit_imm(e, insn->opcode & THALIA_PROC_EXTENDED ? 0 :
+                                                             insn->operand, 4);
+    thalia_jit_emit_call(e, handler);
+    if(thalia_jit_writes_regs(insn->opcode))
+        thalia_jit_emit_spill(e, 0xFF, TRUE);
+
+    // The handler may have jumped, or changed code or banks.
+    e->pc_stored = TRUE;
+    if(step && !last)
+        thalia_jit_emit_exit_checks(e, e->pc);
+    return TRUE;
+}
+
+// Emits code stepping the hardware if an event is due. The hardware never
+// touches the byte registers, so they are only stored for anyone looking. If
+// the block goes on afterwards, it is left should an interrupt have moved the
+// program counter, or the code have been changed.
+static void thalia_jit_emit_step(thalia_jit_emitter_t* e, gboolean last)
+{
+    static const guint8 load_rax[] = { 0x48, 0x8B };
+    static const guint8 cmp_rax[] = { 0x48, 0x3B };
+    guint8* skip;
+
+    thalia_jit_emit_mem(e, load_rax, sizeof(load_rax), THALIA_JIT_EAX,
+                        THALIA_JIT_OFFSET_CYCLES);
+    thalia_jit_emit_mem(e, cmp_rax, sizeof(cmp_rax), THALIA_JIT_EAX,
+                        THALIA_JIT_OFFSET_NEXT);
+    *e->pos++ = 0x0F;
+    *e->pos++ = 0x82; // jb
+    skip = e->pos;
+    thalia_jit_emit_imm(e, 0, 4);
+
+    thalia_jit_emit_spill(e, e->dirty, FALSE);
+    thalia_jit_emit_store_pc(e);
+    thalia_jit_emit_call(e, thalia_gb_step);
+    if(!last) {
+        thalia_jit_emit_exit_checks(e, e->pc);
+    } else {
+        // Leave without storing the program counter, which may have moved.
+        *e->pos++ = 0xE9; // jmp
+        e->exits[e->n_exits++] = e->pos;
+        thalia_jit_emit_imm(e, 0, 4);
+    }
+    thalia_jit_patch(skip, e->pos);
+}
+
+// Assigns host registers to the guest registers used most by the native code
+// of the 'n_insns' instructions in 'insns'. A register is loaded on entry and
+// again after every handler that may write registers, so it stays in memory
+// unless it is used more often than that.
+static void thalia_jit_allocate(thalia_jit_emitter_t* e,
+                                const thalia_proc_insn_t* insns,
+                                guint8 n_insns)
+{
+    guint uses[8] = { 0 };
+    guint8 regs[3], i, n, best;
+    guint n_regs, j, loads = 1;
+
+    for(i = 0; i < n_insns; i++) {
+        if(thalia_jit_classify(insns[i].opcode, regs, &n_regs) ==
+               THALIA_JIT_OP_CALL &&
+           thalia_jit_writes_regs(insns[i].opcode))
+            loads++;
+        for(j = 0; j < n_regs; j++)
+            uses[regs[j]]++;
+    }
+
+    memset(e->hosts, -1, sizeof(e->hosts));
+    for(n = 0; n < THALIA_JIT_N_HOSTS; n++) {
+        best = 0;
+        for(i = 1; i < G_N_ELEMENTS(uses); i++)
+            if(uses[i] > uses[best])
+                best = i;
+        if(uses[best] <= loads)
+            break;
+        e->hosts[best] = thalia_jit_hosts[n];
+        uses[best] = 0;
+    }
+}
+
+// Translates 'n_insns' instructions from 'insns' into 'code'. If 'step' is
+// set, the hardware is stepped after every instruction that leaves an event
+// due, and the block is left as soon as control moves elsewhere or the code
+// may have been changed, just like the interpreter does. Returns the end of
+// the code emitted.
+static guint8* thalia_jit_translate(guint8* code,
+                                    const thalia_proc_insn_t* insns,
+                                    guint8 n_insns, gboolean step)
+{
+    static const guint8 prologue[] = {
+        0x53,                         // push rbx
+        0x55,                         // push rbp
+        0x41, 0x54,                   // push r12
+        0x41, 0x55,                   // push r13
+        0x41, 0x56,                   // push r14
+        0x41, 0x57,                   // push r15
+        0x48, 0x83, 0xEC, 0x08,       // sub rsp, 8
+        0x48, 0x89, 0xFB              // mov rbx, rdi
+    };
+    static const guint8 epilogue[] = {
+        0x48, 0x83, 0xC4, 0x08,       // add rsp, 8
+        0x41, 0x5F,                   // pop r15
+        0x41, 0x5E,                   // pop r14
+        0x41, 0x5D,                   // pop r13
+        0x41, 0x5C,                   // pop r12
+        0x5D,                         // pop rbp
+        0x5B,                         // pop rbx
+        0xC3                          // ret
+    };
+    thalia_jit_emitter_t e = { code };
+    guint8 i;
+
+    thalia_jit_allocate(&e, insns, n_insns);
+    thalia_jit_emit(&e, prologue, sizeof(prologue));
+    thalia_jit_emit_spill(&e, 0xFF, TRUE);
+
+    // Unhandled opcodes are left for the interpreter to report.
+    e.pc = insns[0].pc;
+    e.pc_stored = TRUE;
+    for(i = 0; i < n_insns; i++) {
+        if(!thalia_jit_emit_insn(&e, &insns[i], i == n_insns - 1, step))
+            break;
+        if(step)
+            thalia_jit_emit_step(&e, i == n_insns - 1);
+    }
+
+    // Early exits find the program counter in memory, but not necessarily
+    // the registers, so those are all stored.
+    thalia_jit_emit_store_pc(&e);
+    for(i = 0; i < e.n_exits; i++)
+        thalia_jit_patch(e.exits[i], e.pos);
+    thalia_jit_emit_spill(&e, 0xFF, FALSE);
+    thalia_jit_emit(&e, epilogue, sizeof(epilogue));
+    return e.pos;
+}
+
+// Makes the pages holding 'size' bytes at 'code' writable, or executable once
+// 'exec' is set, but never both at once.
+static void thalia_jit_protect(guint8* code, gsize size, gboolean exec)
+{
+    gsize page = sysconf(_SC_PAGESIZE);
+    guint8* start = (guint8*) ((gsize) code & ~(page - 1));
+
+    size = (code + size - start + page - 1) & ~(page - 1);
+    if(mprotect(start, size, exec ? PROT_READ | PROT_EXEC :
+                                    PROT_READ | PROT_WRITE))
+        g_error("Could not change protection of JIT code");
+}
+
+// Sets up the code buffer for 'gb' on first use.
+gboolean thalia_jit_available(ThaliaGB* gb)
+{
+    if(gb->jit.code || gb->jit.failed)
+        return !gb->jit.failed;
+
+    gb->jit.code = mmap(
+        NULL,
+        THALIA_JIT_CODE_SIZE,
+        PROT_READ | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0
+    );
+    if(gb->jit.code == MAP_FAILED) {
+        g_warning("Could not allocate memory for JIT code");
+        gb->jit.code = NULL;
+        gb->jit.failed = TRUE;
+    }
+    return !gb->jit.failed;
+}
+
+// Translates 'n_insns' instructions from 'insns' into the 'size' bytes at
+// 'code', which are writable only while that happens. Returns the end of the
+// code emitted.
+static guint8* thalia_jit_translate_into(guint8* code, gsize size,
+                                      const thalia_proc_insn_t* insns,
+                                      guint8 n_insns, gboolean step)
+{
+    guint8* end;
+
+    thalia_jit_protect(code, size, FALSE);
+    end = thalia_jit_translate(code, insns, n_insns, step);
+    g_assert(end <= code + size);
+    thalia_jit_protect(code, size, TRUE);
+    return end;
+}
+
+// Translates 'block' to native code, returning NULL if it is of no use.
+gpointer thalia_jit_compile(ThaliaGB* gb, const thalia_proc_block_t* block)
+{
+    gsize size = THALIA_JIT_MAX_FRAME_SIZE +
+                 block->n_insns * THALIA_JIT_MAX_INSN_SIZE;
+    guint8* code;
+    guint i;
+
+    if(!block->n_insns || !thalia_jit_available(gb))
+        return NULL;
+
+    // Start over once the buffer is full, dropping all translations that
+    // live in it. Code translated ahead of time is kept.
+    if(gb->jit.used + size > THALIA_JIT_CODE_SIZE - THALIA_JIT_SCRATCH_SIZE) {
+        for(i = 0; i < THALIA_PROC_CACHE_SIZE; i++) {
+            code = gb->cache.blocks[i].code;
+            if(code >= gb->jit.code &&
+               code < gb->jit.code + THALIA_JIT_CODE_SIZE) {
+                gb->cache.blocks[i].code = NULL;
+                gb->cache.blocks[i].hits = 0;
+            }
+        }
+        gb->jit.used = 0;
+    }
+
+    code = gb->jit.code + gb->jit.used;
+    gb->jit.used = thalia_jit_translate_into(code, size, block->insns,
+                                             block->n_insns, TRUE) -
+                   gb->jit.code;
+    return code;
+}
+
+// Translates the single instruction 'insn', without stepping the hardware
+// afterwards. The code is only valid up to the next call.
+gpointer thalia_jit_compile_insn(ThaliaGB* gb, const thalia_proc_insn_t* insn)
+{
+    guint8* code;
+    if(!thalia_jit_available(gb))
+        return NULL;
+
+    code = gb->jit.code + THALIA_JIT_CODE_SIZE - THALIA_JIT_SCRATCH_SIZE;
+    thalia_jit_translate_into(code, THALIA_JIT_SCRATCH_SIZE, insn, 1, FALSE);
+    return code;
+}
+
+// Runs the native code at 'code'.
+void thalia_jit_run(ThaliaGB* gb, gpointer code)
+{
+    ((thalia_jit_code_t) code)(gb);
+}
+
+// Releases the code buffer of 'gb'.
+void thalia_jit_free(ThaliaGB* gb)
+{
+    if(gb->jit.code)
+        munmap(gb->jit.code, THALIA_JIT_CODE_SIZE);
+}
+#else
+// Native code is only generated for x86-64.
+gboolean thalia_jit_available(ThaliaGB* gb)
+{
+    return FALSE;
+}
+
+gpointer thalia_jit_compile(ThaliaGB* gb, const thalia_proc_block_t* block)
+{
+    return NULL;
+}
+
+gpointer thalia_jit_compile_insn(ThaliaGB* gb, const thalia_proc_insn_t* insn)
+{
+    return NULL;
+}
+
+void thalia_jit_run(ThaliaGB* gb, gpointer code)
+{
+}
+
+void thalia_jit_free(ThaliaGB* gb)
+{
+}
+#endif
@@ -0,0 +1,25 @@
+#ifndef __THALIA_JIT_H__
+#define __THALIA_JIT_H__
+
+#include <glib.h>
+#include "thalia_gb.h"
+
+#define THALIA_JIT_CODE_SIZE (2 << 20) // Bytes of native code per instance
+#define THALIA_JIT_SCRATCH_SIZE 0x200  // Bytes reserved for lockstep code
+#define THALIA_JIT_THRESHOLD 16        // Runs before a block is compiled
+
+// Native code buffer for translated blocks.
+typedef struct {
+    guint8* code;                      // Code buffer, NULL if missing
+    gsize used;                        // Bytes of the buffer in use
+    gboolean failed;                   // Set if the buffer could not be made
+} thalia_jit_t;
+#endif
+
+#ifdef __THALIA_GB_T__
+gboolean thalia_jit_available(ThaliaGB* gb);
+gpointer thalia_jit_compile(ThaliaGB* gb, const thalia_proc_block_t* block);
+gpointer thalia_jit_compile_insn(ThaliaGB* gb, const thalia_proc_insn_t* insn);
+void thalia_jit_run(ThaliaGB* gb, gpointer code);
+void thalia_jit_free(ThaliaGB* gb);
+#endif
@@ -14,10 +14,10 @@ void thalia_keypad_unlock(ThaliaGB* gb)
     g_mutex_unlock(&gb->keypad.mutex);
 }
 
-// Synthesises the keypad register contents from the keypad state.
-guint8 thalia_keypad_read(ThaliaGB* gb)
+// Synthesises the keypad register contents from the keypad state. The keypad
+// has to be locked when calling this.
+static guint8 thalia_keypad_lines(ThaliaGB* gb)
 {
-    thalia_keypad_lock(gb);
     guint8 ret = 0x0F | (gb->keypad.region << 4);
 
     // Reset the bits for the keys that are down in the selected region(s).
@@ -42,6 +42,24 @@ guint8 thalia_keypad_read(ThaliaGB* gb)
             ret &= ~THALIA_KEY_DOWN;
     }
 
+    return ret;
+}
+
+// Raises the joypad interrupt when an input line goes low. The keypad has to
+// be locked when calling this.
+static void thalia_keypad_check(ThaliaGB* gb)
+{
+    guint8 lines = thalia_keypad_lines(gb) & 0x0F;
+    if(gb->keypad.lines & ~lines)
+        thalia_gb_interrupt(gb, THALIA_INT_JOYPAD);
+    gb->keypad.lines = lines;
+}
+
+// Reads the keypad register.
+guint8 thalia_keypad_read(ThaliaGB* gb)
+{
+    thalia_keypad_lock(gb);
+    guint8 ret = thalia_keypad_lines(gb);
     thalia_keypad_unlock(gb);
     return ret;
 }
@@ -51,5 +69,44 @@ void thalia_keypad_write(ThaliaGB* gb, guint8 value)
 {
     thalia_keypad_lock(gb);
     gb->keypad.region = (value >> 4) & 0x03;
+    thalia_keypad_check(gb);
+    thalia_keypad_unlock(gb);
+}
+
+// Records that the keys have changed, waking up a processor waiting for that.
+// The keypad has to be locked when calling this.
+void thalia_keypad_changed(ThaliaGB* gb)
+{
+    g_atomic_int_inc(&gb->keypad.changes);
+    g_cond_broadcast(&gb->keypad.changed);
+}
+
+// Catches up with key changes made since the last step. The count of changes
+// is peeked at without the lock, so this is cheap while no keys change.
+void thalia_keypad_step(ThaliaGB* gb)
+{
+    guint changes = g_atomic_int_get(&gb->keypad.changes);
+    if(changes == gb->keypad.seen)
+        return;
+
+    thalia_keypad_lock(gb);
+    gb->keypad.seen = changes;
+    thalia_keypad_check(gb);
+    thalia_keypad_unlock(gb);
+}
+
+// Tells whether the keys have changed since STOP last ran.
+gboolean thalia_keypad_woken(ThaliaGB* gb)
+{
+    return (guint) g_atomic_int_get(&gb->keypad.changes) != gb->keypad.stop;
+}
+
+// Blocks until the count of key changes differs from 'since', the count the
+// caller last saw. Changes made before the call are not missed that way.
+void thalia_keypad_wait(ThaliaGB* gb, guint since)
+{
+    thalia_keypad_lock(gb);
+    while(gb->keypad.changes == since)
+        g_cond_wait(&gb->keypad.changed, &gb->keypad.mutex);
     thalia_keypad_unlock(gb);
 }
@@ -33,7 +33,12 @@ typedef struct {
     gboolean key_up;
     gboolean key_down;
     thalia_key_region_t region;
+    guint changes;             // Number of times the keys have changed
+    guint seen;                // Ditto, as last seen by the processor
+    guint stop;                // Ditto, when STOP last ran
+    guint8 lines;              // Input lines as last seen by the processor
     GMutex mutex;
+    GCond changed;             // Signalled when the keys change
 } thalia_keypad_t;
 #endif
 
@@ -43,4 +48,8 @@ void thalia_keypad_unlock(ThaliaGB* gb);
 guint8 thalia_keypad_read(ThaliaGB* gb);
 void thalia_keypad_write(ThaliaGB* gb, guint8 value);
 void thalia_keypad_event(ThaliaGB* gb, gboolean pressed);
+void thalia_keypad_changed(ThaliaGB* gb);
+void thalia_keypad_step(ThaliaGB* gb);
+void thalia_keypad_wait(ThaliaGB* gb, guint since);
+gboolean thalia_keypad_woken(ThaliaGB* gb);
 #endif
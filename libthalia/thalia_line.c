@@ -0,0 +1,332 @@
+#include <glib.h>
+#include "thalia_gb.h"
+#include "thalia_line.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define THALIA_LINE_X86
+
+// Functions using vector instructions are compiled for them one by one, so
+// the rest runs on any CPU.
+#define THALIA_LINE_SSE2 __attribute__((target("sse2")))
+#define THALIA_LINE_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Scalar kernels, which the others are checked against.
+
+static void thalia_line_decode_scalar(const guint8* tile, guint8 rows[8][8],
+                                      guint8 flipped[8][8])
+{
+    guint y, x;
+    guint8 code;
+
+    // The first byte of a row holds the low bits of its codes, the second the
+    // high bits. The leftmost pixel is in bit 7.
+    for(y = 0; y < 8; y++)
+        for(x = 0; x < 8; x++) {
+            code = (tile[y * 2] >> (7 - x) & 1) |
+                   (tile[y * 2 + 1] >> (7 - x) & 1) << 1;
+            rows[y][x] = code;
+            flipped[y][7 - x] = code;
+        }
+}
+
+static void thalia_line_shade_scalar(guint8* shades, const guint8* codes,
+                                     const guint8 palette[4], guint n)
+{
+    guint x;
+    for(x = 0; x < n; x++)
+        shades[x] = palette[codes[x]];
+}
+
+static void thalia_line_merge_scalar(guint8* shades, const guint8* codes,
+                                     const guint8 palette[4], gboolean behind)
+{
+    guint x;
+    for(x = 0; x < 8; x++)
+        if(codes[x] && (!behind || shades[x] == 0xFF))
+            shades[x] = palette[codes[x]];
+}
+
+static void thalia_line_expand_scalar(guchar* pixels, const guint8* shades,
+                                      guint n)
+{
+    guint x;
+
+    // Shades are gray, so every channel gets the same value.
+    for(x = 0; x < n; x++) {
+        pixels[0] = pixels[1] = pixels[2] = shades[x];
+        pixels += 3;
+    }
+}
+
+#ifdef THALIA_LINE_X86
+// SSE2 kernels. Without a byte shuffle, codes are looked up by comparing them
+// with each of the four, and pixels are expanded by the scalar kernel.
+
+// Spreads the eight bytes of 'plane' over two rows of eight bytes each, in
+// 'spread'.
+static inline THALIA_LINE_SSE2 void thalia_line_spread_sse2(__m128i plane,
+                                                            __m128i spread[4])
+{
+    __m128i bytes = _mm_unpacklo_epi8(plane, plane);
+    __m128i low = _mm_unpacklo_epi16(bytes, bytes);
+    __m128i high = _mm_unpackhi_epi16(bytes, bytes);
+
+    spread[0] = _mm_unpacklo_epi32(low, low);
+    spread[1] = _mm_unpackhi_epi32(low, low);
+    spread[2] = _mm_unpacklo_epi32(high, high);
+    spread[3] = _mm_unpackhi_epi32(high, high);
+}
+
+// Returns the codes in row pairs 'low' and 'high' of the bit planes, picking
+// pixels by the bits in 'bits'.
+static inline THALIA_LINE_SSE2 __m128i thalia_line_codes_sse2(__m128i low,
+                                                             __m128i high,
+                                                             __m128i bits)
+{
+    low = _mm_cmpeq_epi8(_mm_and_si128(low, bits), bits);
+    high = _mm_cmpeq_epi8(_mm_and_si128(high, bits), bits);
+    return _mm_or_si128(_mm_and_si128(low, _mm_set1_epi8(1)),
+                        _mm_and_si128(high, _mm_set1_epi8(2)));
+}
+
+// Returns the shades of 'codes' in 'palette'.
+static inline THALIA_LINE_SSE2 __m128i thalia_line_lookup_sse2(
+    __m128i codes, const guint8 palette[4])
+{
+    __m128i shades = _mm_setzero_si128();
+    guint code;
+    for(code = 0; code < 4; code++)
+        shades = _mm_or_si128(shades, _mm_and_si128(
+            _mm_cmpeq_epi8(codes, _mm_set1_epi8(code)),
+            _mm_set1_epi8(palette[code])));
+    return shades;
+}
+
+static THALIA_LINE_SSE2 void thalia_line_decode_sse2(const guint8* tile,
+                                                     guint8 rows[8][8],
+                                                     guint8 flipped[8][8])
+{
+    const __m128i bits = _mm_set_epi8(
+        0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
+        0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80);
+    const __m128i bits_flipped = _mm_set_epi8(
+        0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+        0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    __m128i both = _mm_loadu_si128((const __m128i*) tile);
+    __m128i low[4], high[4];
+    guint i;
+
+    // Separate the bit planes, then give every pixel a copy of its row.
+    thalia_line_spread_sse2(_mm_packus_epi16(
+        _mm_and_si128(both, _mm_set1_epi16(0xFF)), both), low);
+    thalia_line_spread_sse2(_mm_packus_epi16(
+        _mm_srli_epi16(both, 8), both), high);
+    for(i = 0; i < 4; i++) {
+        _mm_storeu_si128((__m128i*) rows[i * 2],
+                         thalia_line_codes_sse2(low[i], high[i], bits));
+        _mm_storeu_si128((__m128i*) flipped[i * 2],
+                         thalia_line_codes_sse2(low[i], high[i],
+                                                bits_flipped));
+    }
+}
+
+static THALIA_LINE_SSE2 void thalia_line_shade_sse2(guint8* shades,
+                                                    const guint8* codes,
+                                                    const guint8 palette[4],
+                                                    guint n)
+{
+    guint x;
+    for(x = 0; x + 16 <= n; x += 16)
+        _mm_storeu_si128((__m128i*) &shades[x], thalia_line_lookup_sse2(
+            _mm_loadu_si128((const __m128i*) &codes[x]), palette));
+    thalia_line_shade_scalar(shades + x, codes + x, palette, n - x);
+}
+
+static THALIA_LINE_SSE2 void thalia_line_merge_sse2(guint8* shades,
+                                                    const guint8* codes,
+                                                    const guint8 palette[4],
+                                                    gboolean behind)
+{
+    __m128i c = _mm_loadl_epi64((const __m128i*) codes);
+    __m128i s = _mm_loadl_epi64((const __m128i*) shades);
+    __m128i draw = _mm_cmpeq_epi8(c, _mm_setzero_si128());
+
+    // Pixels are drawn where the code is not 0, and behind the background
+    // only where it is white.
+    if(behind)
+        draw = _mm_andnot_si128(draw, _mm_cmpeq_epi8(s, _mm_set1_epi8(-1)));
+    else
+        draw = _mm_andnot_si128(draw, _mm_set1_epi8(-1));
+    s = _mm_or_si128(_mm_and_si128(draw, thalia_line_lookup_sse2(c, palette)),
+                     _mm_andnot_si128(draw, s));
+    _mm_storel_epi64((__m128i*) shades, s);
+}
+
+static const thalia_line_kernels_t thalia_line_sse2 = {
+    thalia_line_decode_sse2,
+    thalia_line_shade_sse2,
+    thalia_line_merge_sse2,
+    thalia_line_expand_scalar
+};
+
+// AVX2 kernels, which look codes up with byte shuffles, a lane of sixteen
+// entries at a time.
+
+// Returns a byte shuffle table of the four shades in 'palette'.
+static inline THALIA_LINE_AVX2 __m128i thalia_line_table_avx2(
+    const guint8 palette[4])
+{
+    return _mm_setr_epi8(palette[0], palette[1], palette[2], palette[3],
+                         0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+}
+
+static THALIA_LINE_AVX2 void thalia_line_decode_avx2(const guint8* tile,
+                                                     guint8 rows[8][8],
+                                                     guint8 flipped[8][8])
+{
+    const __m256i bits = _mm256_set1_epi64x(0x0102040810204080LL);
+    const __m256i bits_flipped = _mm256_set1_epi64x(0x8040201008040201LL);
+    const __m256i spread = _mm256_setr_epi8(
+        0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 2, 2, 2, 2,
+        4, 4, 4, 4, 4, 4, 4, 4, 6, 6, 6, 6, 6, 6, 6, 6);
+    __m256i both = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i*) tile));
+    __m256i low, high, low_set, high_set, codes;
+    guint half;
+
+    // Give every pixel a copy of its row in both bit planes, four rows at a
+    // time. The high plane is one byte further.
+    for(half = 0; half < 2; half++) {
+        __m256i index = _mm256_add_epi8(spread, _mm256_set1_epi8(half * 8));
+        low = _mm256_shuffle_epi8(both, index);
+        high = _mm256_shuffle_epi8(both,
+                                   _mm256_add_epi8(index, _mm256_set1_epi8(1)));
+
+        low_set = _mm256_cmpeq_epi8(_mm256_and_si256(low, bits), bits);
+        high_set = _mm256_cmpeq_epi8(_mm256_and_si256(high, bits), bits);
+        codes = _mm256_or_si256(
+            _mm256_and_si256(low_set, _mm256_set1_epi8(1)),
+            _mm256_and_si256(high_set, _mm256_set1_epi8(2)));
+        _mm256_storeu_si256((__m256i*) rows[half * 4], codes);
+
+        low_set = _mm256_cmpeq_epi8(_mm256_and_si256(low, bits_flipped),
+                                    bits_flipped);
+        high_set = _mm256_cmpeq_epi8(_mm256_and_si256(high, bits_flipped),
+                                     bits_flipped);
+        codes = _mm256_or_si256(
+            _mm256_and_si256(low_set, _mm256_set1_epi8(1)),
+            _mm256_and_si256(high_set, _mm256_set1_epi8(2)));
+        _mm256_storeu_si256((__m256i*) flipped[half * 4], codes);
+    }
+}
+
+static THALIA_LINE_AVX2 void thalia_line_shade_avx2(guint8* shades,
+                                                    const guint8* codes,
+                                                    const guint8 palette[4],
+                                                    guint n)
+{
+    __m256i table = _mm256_broadcastsi128_si256(
+        thalia_line_table_avx2(palette));
+    guint x;
+
+    for(x = 0; x + 32 <= n; x += 32)
+        _mm256_storeu_si256((__m256i*) &shades[x], _mm256_shuffle_epi8(
+            table, _mm256_loadu_si256((const __m256i*) &codes[x])));
+    thalia_line_shade_scalar(shades + x, codes + x, palette, n - x);
+}
+
+static THALIA_LINE_AVX2 void thalia_line_merge_avx2(guint8* shades,
+                                                    const guint8* codes,
+                                                    const guint8 palette[4],
+                                                    gboolean behind)
+{
+    __m128i c = _mm_loadl_epi64((const __m128i*) codes);
+    __m128i s = _mm_loadl_epi64((const __m128i*) shades);
+    __m128i keep = _mm_cmpeq_epi8(c, _mm_setzero_si128());
+
+    // Pixels are drawn where the code is not 0, and behind the background
+    // only where it is white.
+    if(behind)
+        keep = _mm_or_si128(keep, _mm_xor_si128(
+            _mm_cmpeq_epi8(s, _mm_set1_epi8(-1)), _mm_set1_epi8(-1)));
+    s = _mm_blendv_epi8(_mm_shuffle_epi8(thalia_line_table_avx2(palette), c),
+                        s, keep);
+    _mm_storel_epi64((__m128i*) shades, s);
+}
+
+static THALIA_LINE_AVX2 void thalia_line_expand_avx2(guchar* pixels,
+                                                     const guint8* shades,
+                                                     guint n)
+{
+    // Byte shuffles taking sixteen shades to the 48 bytes of their pixels,
+    // the first 32 of them in one go.
+    const __m256i first = _mm256_setr_epi8(
+        0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5,
+        5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+    const __m128i last = _mm_setr_epi8(
+        10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+    __m128i s;
+    guint x;
+
+    for(x = 0; x + 16 <= n; x += 16) {
+        s = _mm_loadu_si128((const __m128i*) &shades[x]);
+        _mm256_storeu_si256((__m256i*) &pixels[x * 3], _mm256_shuffle_epi8(
+            _mm256_broadcastsi128_si256(s), first));
+        _mm_storeu_si128((__m128i*) &pixels[x * 3 + 32],
+                         _mm_shuffle_epi8(s, last));
+    }
+    thalia_line_expand_scalar(pixels + x * 3, shades + x, n - x);
+}
+
+static const thalia_line_kernels_t thalia_line_avx2 = {
+    thalia_line_decode_avx2,
+    thalia_line_shade_avx2,
+    thalia_line_merge_avx2,
+    thalia_line_expand_avx2
+};
+#endif
+
+static const thalia_line_kernels_t thalia_line_scalar = {
+    thalia_line_decode_scalar,
+    thalia_line_shade_scalar,
+    thalia_line_merge_scalar,
+    thalia_line_expand_scalar
+};
+
+// Returns the name of instruction set 'isa'.
+const gchar* thalia_line_isa_name(thalia_line_isa_t isa)
+{
+    static const gchar* names[THALIA_LINE_ISA_COUNT] = {
+        "scalar", "sse2", "avx2"
+    };
+    return names[isa];
+}
+
+// Returns the kernels for instruction set 'isa', or NULL if this CPU does not
+// have it.
+const thalia_line_kernels_t* thalia_line_kernels(thalia_line_isa_t isa)
+{
+    switch(isa) {
+#ifdef THALIA_LINE_X86
+    case THALIA_LINE_ISA_SSE2:
+        return __builtin_cpu_supports("sse2") ? &thalia_line_sse2 : NULL;
+    case THALIA_LINE_ISA_AVX2:
+        return __builtin_cpu_supports("avx2") ? &thalia_line_avx2 : NULL;
+#endif
+    case THALIA_LINE_ISA_SCALAR:
+        return &thalia_line_scalar;
+    default:
+        return NULL;
+    }
+}
+
+// Returns the widest instruction set this CPU has kernels for.
+thalia_line_isa_t thalia_line_best_isa()
+{
+    thalia_line_isa_t isa = THALIA_LINE_ISA_COUNT - 1;
+    while(!thalia_line_kernels(isa))
+        isa--;
+    return isa;
+}
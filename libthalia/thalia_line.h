@@ -0,0 +1,40 @@
+#ifndef __THALIA_LINE_H__
+#define __THALIA_LINE_H__
+
+#include <glib.h>
+#include "thalia_gb.h"
+
+// Instruction sets the scanline kernels are written for, from plain C to the
+// widest vectors.
+typedef enum {
+    THALIA_LINE_ISA_SCALAR = 0,
+    THALIA_LINE_ISA_SSE2,
+    THALIA_LINE_ISA_AVX2,
+    THALIA_LINE_ISA_COUNT
+} thalia_line_isa_t;
+
+// Kernels for the steps of drawing a line. Color codes are 0 to 3, shades
+// are gray levels. Every instruction set has the same results, the scalar
+// kernels are the reference.
+typedef struct {
+    // Interleaves the bit planes of the 16 bytes of 'tile' into codes per
+    // row, left to right in 'rows' and right to left in 'flipped'.
+    void (*decode)(const guint8* tile, guint8 rows[8][8],
+                   guint8 flipped[8][8]);
+    // Looks up the shades of 'n' codes in 'palette'.
+    void (*shade)(guint8* shades, const guint8* codes,
+                  const guint8 palette[4], guint n);
+    // Draws a row of eight sprite pixels over 'shades'. Code 0 is
+    // transparent, and if 'behind', only white is drawn over.
+    void (*merge)(guint8* shades, const guint8* codes,
+                  const guint8 palette[4], gboolean behind);
+    // Writes 'n' shades as RGB pixels.
+    void (*expand)(guchar* pixels, const guint8* shades, guint n);
+} thalia_line_kernels_t;
+#endif
+
+#ifdef __THALIA_GB_T__
+const gchar* thalia_line_isa_name(thalia_line_isa_t isa);
+const thalia_line_kernels_t* thalia_line_kernels(thalia_line_isa_t isa);
+thalia_line_isa_t thalia_line_best_isa();
+#endif
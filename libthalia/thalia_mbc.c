@@ -0,0 +1,295 @@
+#include <glib.h>
+#include <string.h>
+#include "thalia_gb.h"
+#include "thalia_mbc.h"
+#include "thalia_mmu.h"
+#include "thalia_proc.h"
+
+// Maps ROM banks 'rom_bank0' and 'rom_bank' to 0x0000-0x3FFF and 0x4000-0x7FFF.
+// Banks past the end of the ROM wrap around, as the upper address lines are
+// not connected.
+static void thalia_mbc_map_rom(ThaliaGB* gb, guint16 rom_bank0,
+                               guint16 rom_bank)
+{
+    thalia_mbc_t* mbc = &gb->mmu.mbc;
+    rom_bank0 &= mbc->rom_mask;
+    rom_bank &= mbc->rom_mask;
+    if(rom_bank0 == mbc->rom_bank0 && rom_bank == mbc->rom_bank)
+        return;
+
+    mbc->rom_bank0 = rom_bank0;
+    mbc->rom_bank = rom_bank;
+    thalia_mmu_map_rom(gb);
+    thalia_proc_cache_mark_stale(gb);
+}
+
+// Selects RAM bank or clock register 'ram_bank' for 0xA000-0xBFFF.
+static void thalia_mbc_map_ram(ThaliaGB* gb, guint8 ram_bank)
+{
+    if(ram_bank == gb->mmu.mbc.ram_bank)
+        return;
+
+    gb->mmu.mbc.ram_bank = ram_bank;
+    thalia_mmu_map_ext(gb);
+}
+
+// Enables or disables cartridge RAM, depending on 'val' written to the enable
+// register.
+static void thalia_mbc_enable_ram(ThaliaGB* gb, guint8 val)
+{
+    gboolean enable = (val & 0x0F) == 0x0A;
+    if(enable == gb->mmu.mbc.enable_ext_ram)
+        return;
+
+    gb->mmu.mbc.enable_ext_ram = enable;
+    thalia_mmu_map_ext(gb);
+}
+
+// Brings the live clock registers up to the current cycle count.
+static void thalia_mbc_rtc_sync(ThaliaGB* gb)
+{
+    thalia_mbc_rtc_t* rtc = &gb->mmu.mbc.rtc;
+    guint64 seconds, days;
+
+    // A halted clock keeps the time it was halted at.
+    if(rtc->regs[THALIA_MBC_RTC_DH] & THALIA_MBC_RTC_HALT) {
+        rtc->synced = gb->cycles;
+        return;
+    }
+
+    seconds = (gb->cycles - rtc->synced) / THALIA_MBC_RTC_SECOND;
+    if(!seconds)
+        return;
+    rtc->synced += seconds * THALIA_MBC_RTC_SECOND;
+
+    seconds += rtc->regs[THALIA_MBC_RTC_S] +
+               rtc->regs[THALIA_MBC_RTC_M] * 60 +
+               rtc->regs[THALIA_MBC_RTC_H] * 3600;
+    days = rtc->regs[THALIA_MBC_RTC_DL] +
+           (rtc->regs[THALIA_MBC_RTC_DH] & THALIA_MBC_RTC_DAY_HIGH) * 0x100 +
+           seconds / 86400;
+    seconds %= 86400;
+
+    rtc->regs[THALIA_MBC_RTC_S] = seconds % 60;
+    rtc->regs[THALIA_MBC_RTC_M] = seconds / 60 % 60;
+    rtc->regs[THALIA_MBC_RTC_H] = seconds / 3600;
+    rtc->regs[THALIA_MBC_RTC_DL] = days & 0xFF;
+    rtc->regs[THALIA_MBC_RTC_DH] &= ~THALIA_MBC_RTC_DAY_HIGH;
+    rtc->regs[THALIA_MBC_RTC_DH] |= (days >> 8) & THALIA_MBC_RTC_DAY_HIGH;
+
+    // The day counter has nine bits, and remembers when it overflowed.
+    if(days >= 0x200)
+        rtc->regs[THALIA_MBC_RTC_DH] |= THALIA_MBC_RTC_DAY_CARRY;
+}
+
+// Reads the latched clock register selected as RAM bank.
+guint8 thalia_mbc_rtc_read(ThaliaGB* gb)
+{
+    thalia_mbc_t* mbc = &gb->mmu.mbc;
+    return mbc->rtc.latched[mbc->ram_bank - THALIA_MBC_RTC_FIRST];
+}
+
+// Writes 'val' to the live clock register selected as RAM bank.
+void thalia_mbc_rtc_write(ThaliaGB* gb, guint8 val)
+{
+    static const guint8 masks[THALIA_MBC_RTC_COUNT] = {
+        0x3F, 0x3F, 0x1F, 0xFF, 0xC1
+    };
+    thalia_mbc_t* mbc = &gb->mmu.mbc;
+    guint reg = mbc->ram_bank - THALIA_MBC_RTC_FIRST;
+
+    thalia_mbc_rtc_sync(gb);
+    mbc->rtc.regs[reg] = val & masks[reg];
+
+    // Setting the seconds also restarts the second in progress.
+    if(reg == THALIA_MBC_RTC_S)
+        mbc->rtc.synced = gb->cycles;
+}
+
+// Writes of 0x00 and then 0x01 copy the live clock to the latched registers.
+static void thalia_mbc_rtc_latch(ThaliaGB* gb, guint8 val)
+{
+    thalia_mbc_rtc_t* rtc = &gb->mmu.mbc.rtc;
+    if(rtc->latch == 0x00 && val == 0x01) {
+        thalia_mbc_rtc_sync(gb);
+        memcpy(rtc->latched, rtc->regs, sizeof(rtc->latched));
+    }
+    rtc->latch = val;
+}
+
+// Register writes on cartridges without MBC, which are ignored.
+static void thalia_mbc_none_write(gpointer data, guint16 addr, guint8 val)
+{
+}
+
+// Register writes on MBC1 cartridges.
+static void thalia_mbc1_write(gpointer data, guint16 addr, guint8 val)
+{
+    ThaliaGB* gb = data;
+    thalia_mbc_t* mbc = &gb->mmu.mbc;
+
+    switch(addr & 0x6000) {
+    case 0x0000:
+        thalia_mbc_enable_ram(gb, val);
+        return;
+    case 0x2000:
+        // Bank 0 can not be selected through the lower five bits, so 0x20,
+        // 0x40 and 0x60 end up selecting the bank after them.
+        mbc->rom_low = val & 0x1F ? val & 0x1F : 1;
+        break;
+    case 0x4000:
+        mbc->rom_high = val & 0x03;
+        break;
+    case 0x6000:
+        mbc->mode = val & 0x01;
+        break;
+    }
+
+    // The upper two bits always select the upper bank. In mode 1 they also
+    // select the bank at 0x0000-0x3FFF and the RAM bank.
+    thalia_mbc_map_rom(gb, mbc->mode ? mbc->rom_high << 5 : 0,
+                       mbc->rom_high << 5 | mbc->rom_low);
+    thalia_mbc_map_ram(gb, mbc->mode ? mbc->rom_high : 0);
+}
+
+// Register writes on MBC2 cartridges, which look at address bit 8 only.
+static void thalia_mbc2_write(gpointer data, guint16 addr, guint8 val)
+{
+    ThaliaGB* gb = data;
+    thalia_mbc_t* mbc = &gb->mmu.mbc;
+
+    if(addr >= 0x4000)
+        return;
+    if(!(addr & 0x0100)) {
+        thalia_mbc_enable_ram(gb, val);
+        return;
+    }
+    mbc->rom_low = val & 0x0F ? val & 0x0F : 1;
+    thalia_mbc_map_rom(gb, 0, mbc->rom_low);
+}
+
+// Register writes on MBC3 cartridges.
+static void thalia_mbc3_write(gpointer data, guint16 addr, guint8 val)
+{
+    ThaliaGB* gb = data;
+    thalia_mbc_t* mbc = &gb->mmu.mbc;
+
+    switch(addr & 0x6000) {
+    case 0x0000:
+        thalia_mbc_enable_ram(gb, val);
+        return;
+    case 0x2000:
+        mbc->rom_low = val & 0x7F ? val & 0x7F : 1;
+        thalia_mbc_map_rom(gb, 0, mbc->rom_low);
+        return;
+    case 0x4000:
+        // Banks 0x08-0x0C select the clock registers instead of RAM.
+        thalia_mbc_map_ram(gb, val & 0x0F);
+        return;
+    case 0x6000:
+        thalia_mbc_rtc_latch(gb, val);
+        return;
+    }
+}
+
+// Register writes on MBC5 cartridges, which have a ninth ROM bank bit.
+static void thalia_mbc5_write(gpointer data, guint16 addr, guint8 val)
+{
+    ThaliaGB* gb = data;
+    thalia_mbc_t* mbc = &gb->mmu.mbc;
+
+    switch(addr & 0x7000) {
+    case 0x0000: case 0x1000:
+        thalia_mbc_enable_ram(gb, val);
+        return;
+    case 0x2000:
+        mbc->rom_low = val;
+        break;
+    case 0x3000:
+        mbc->rom_high = val & 0x01;
+        break;
+    case 0x4000: case 0x5000:
+        thalia_mbc_map_ram(gb, val & 0x0F);
+        return;
+    default:
+        return;
+    }
+
+    // Unlike the others, the MBC5 can map bank 0 to 0x4000-0x7FFF.
+    thalia_mbc_map_rom(gb, 0, mbc->rom_high << 8 | mbc->rom_low);
+}
+
+// Puts the controller in its power-on state.
+void thalia_mbc_init(ThaliaGB* gb)
+{
+    thalia_mbc_t* mbc = &gb->mmu.mbc;
+    mbc->write = thalia_mbc_none_write;
+    mbc->rom_bank = 1;
+    mbc->rom_low = 1;
+    mbc->rom_mask = THALIA_MMU_MAX_BANK_COUNT - 1;
+}
+
+// Picks the register handler for the loaded cartridge type. Returns FALSE if
+// its controller is not supported.
+gboolean thalia_mbc_setup(ThaliaGB* gb)
+{
+    thalia_mbc_t* mbc = &gb->mmu.mbc;
+    mbc->rom_mask = gb->mmu.rom_size / THALIA_MMU_BANK_SIZE - 1;
+    mbc->nibbles = FALSE;
+
+    switch(gb->cartridge) {
+    case THALIA_CARTRIDGE_MBC1_RAM_BATTERY:
+    case THALIA_CARTRIDGE_MBC2_BATTERY:
+    case THALIA_CARTRIDGE_ROM_RAM_BATTERY:
+    case THALIA_CARTRIDGE_MBC3_TIMER_BATTERY:
+    case THALIA_CARTRIDGE_MBC3_TIMER_RAM_BATTERY:
+    case THALIA_CARTRIDGE_MBC3_RAM_BATTERY:
+    case THALIA_CARTRIDGE_MBC5_RAM_BATTERY:
+    case THALIA_CARTRIDGE_MBC5_RUMBLE_RAM_BATTERY:
+        mbc->battery = TRUE;
+        break;
+    default:
+        mbc->battery = FALSE;
+        break;
+    }
+
+    switch(gb->cartridge) {
+    case THALIA_CARTRIDGE_ROMONLY:
+    case THALIA_CARTRIDGE_ROM_RAM:
+    case THALIA_CARTRIDGE_ROM_RAM_BATTERY:
+        // Without a controller, RAM can not be disabled.
+        mbc->write = thalia_mbc_none_write;
+        mbc->enable_ext_ram = TRUE;
+        break;
+    case THALIA_CARTRIDGE_MBC1:
+    case THALIA_CARTRIDGE_MBC1_RAM:
+    case THALIA_CARTRIDGE_MBC1_RAM_BATTERY:
+        mbc->write = thalia_mbc1_write;
+        break;
+    case THALIA_CARTRIDGE_MBC2:
+    case THALIA_CARTRIDGE_MBC2_BATTERY:
+        mbc->write = thalia_mbc2_write;
+        mbc->nibbles = TRUE;
+        break;
+    case THALIA_CARTRIDGE_MBC3_TIMER_BATTERY:
+    case THALIA_CARTRIDGE_MBC3_TIMER_RAM_BATTERY:
+    case THALIA_CARTRIDGE_MBC3:
+    case THALIA_CARTRIDGE_MBC3_RAM:
+    case THALIA_CARTRIDGE_MBC3_RAM_BATTERY:
+        mbc->write = thalia_mbc3_write;
+        break;
+    case THALIA_CARTRIDGE_MBC5:
+    case THALIA_CARTRIDGE_MBC5_RAM:
+    case THALIA_CARTRIDGE_MBC5_RAM_BATTERY:
+    case THALIA_CARTRIDGE_MBC5_RUMBLE:
+    case THALIA_CARTRIDGE_MBC5_RUMBLE_RAM:
+    case THALIA_CARTRIDGE_MBC5_RUMBLE_RAM_BATTERY:
+        mbc->write = thalia_mbc5_write;
+        break;
+    default:
+        return FALSE;
+    }
+
+    thalia_mmu_map_rom(gb);
+    return TRUE;
+}
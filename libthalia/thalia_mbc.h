@@ -0,0 +1,66 @@
+#ifndef __THALIA_MBC_H__
+#define __THALIA_MBC_H__
+
+#include <glib.h>
+#include "thalia_gb.h"
+
+// M-cycles in a second of emulated time, which is what the MBC3 clock counts.
+#define THALIA_MBC_RTC_SECOND (1 << 20)
+
+// RAM bank numbers that select an MBC3 clock register instead.
+#define THALIA_MBC_RTC_FIRST 0x08
+#define THALIA_MBC_RTC_LAST  0x0C
+
+// Clock registers of the MBC3, in the order they are selected.
+typedef enum {
+    THALIA_MBC_RTC_S = 0,
+    THALIA_MBC_RTC_M,
+    THALIA_MBC_RTC_H,
+    THALIA_MBC_RTC_DL,
+    THALIA_MBC_RTC_DH,
+    THALIA_MBC_RTC_COUNT
+} thalia_mbc_rtc_reg_t;
+
+// Flags in the upper day register.
+#define THALIA_MBC_RTC_DAY_HIGH  0x01
+#define THALIA_MBC_RTC_HALT      0x40
+#define THALIA_MBC_RTC_DAY_CARRY 0x80
+
+// Real time clock of the MBC3. It runs on emulated cycles, and is only brought
+// up to date when the game latches or changes it.
+typedef struct {
+    guint8 regs[THALIA_MBC_RTC_COUNT];    // Live registers
+    guint8 latched[THALIA_MBC_RTC_COUNT]; // Registers as last latched
+    guint8 latch;                         // Last value written to the latch
+    guint64 synced;                       // Cycle count regs were updated at
+} thalia_mbc_rtc_t;
+
+// Memory bank controller state. Writes to its registers go to a handler
+// specific to the cartridge type, which keeps the bank numbers up to date.
+typedef struct {
+    void (*write)(gpointer gb, guint16 addr, guint8 val);
+    gboolean battery;              // Whether RAM is kept in a save file
+    gboolean nibbles;              // Whether RAM is MBC2 RAM, four bits wide
+    gboolean enable_ext_ram;
+    gboolean mode;                 // MBC1 banking mode
+    guint16 rom_bank;              // Bank mapped to 0x4000-0x7FFF
+    guint16 rom_bank0;             // Bank mapped to 0x0000-0x3FFF
+    guint16 rom_mask;              // Bank count of the ROM, minus one
+    guint16 rom_low;               // Low bank bits, as written by the game
+    guint8 rom_high;               // High bank bits, as written by the game
+    guint8 ram_bank;               // RAM bank, or clock register for MBC3
+    thalia_mbc_rtc_t rtc;
+} thalia_mbc_t;
+
+// Tells whether an MBC3 clock register is mapped to 0xA000-0xBFFF.
+#define THALIA_MBC_RTC_MAPPED(gb) \
+    ((gb)->mmu.mbc.ram_bank >= THALIA_MBC_RTC_FIRST && \
+     (gb)->mmu.mbc.ram_bank <= THALIA_MBC_RTC_LAST)
+#endif
+
+#ifdef __THALIA_GB_T__
+void thalia_mbc_init(ThaliaGB* gb);
+gboolean thalia_mbc_setup(ThaliaGB* gb);
+guint8 thalia_mbc_rtc_read(ThaliaGB* gb);
+void thalia_mbc_rtc_write(ThaliaGB* gb, guint8 val);
+#endif
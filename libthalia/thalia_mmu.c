@@ -1,87 +1,193 @@
 #include <glib.h>
+#include <string.h>
 #include "thalia_gb.h"
 #include "thalia_mmu.h"
+#include "thalia_mbc.h"
+#include "thalia_save.h"
+#include "thalia_serial.h"
 #include "thalia_keypad.h"
 #include "thalia_gpu.h"
+#include "thalia_proc.h"
+#include "thalia_timer.h"
+#include "thalia_sched.h"
 
-// Auxiliary function to read a bank from 'channel' into 'dest'.
-void thalia_mmu_read_bank(GIOChannel* channel, guint8* dest, GError** error)
+// Page tables that mappings go to. While OAM DMA runs, those are the ones
+// restored afterwards.
+#define THALIA_MMU_READ_PAGES(mmu) \
+    ((mmu)->dma ? (mmu)->dma_read_pages : (mmu)->read_pages)
+#define THALIA_MMU_WRITE_PAGES(mmu) \
+    ((mmu)->dma ? (mmu)->dma_write_pages : (mmu)->write_pages)
+
+// Points 'count' pages from page 'first' on at 'read' and 'write', which may
+// be NULL. Consecutive pages map to consecutive memory.
+static void thalia_mmu_map_pages(ThaliaGB* gb, guint first, guint count,
+                                 guint8* read, guint8* write)
 {
-    gsize read;
-    g_io_channel_read_chars(
-        channel,
-        (gchar*) dest,
-        THALIA_MMU_BANK_SIZE,
-        &read,
-        error
-    );
+    guint8** read_pages = THALIA_MMU_READ_PAGES(&gb->mmu);
+    guint8** write_pages = THALIA_MMU_WRITE_PAGES(&gb->mmu);
+    guint i;
 
-    // We want to read the exact amount of data requested to fill a bank.
-    if(read < THALIA_MMU_BANK_SIZE)
-        g_set_error(
-            error,
-            THALIA_ERROR,
-            THALIA_ERROR_BANK_SIZE,
-            "Could not read entire bank, is the file a ROM?"
-        );
+    // Code may have been fetched from a page that is no longer there.
+    gb->mmu.code_page = NULL;
+    for(i = 0; i < count; i++) {
+        read_pages[first + i] = read ? read + i * THALIA_MMU_PAGE_SIZE : NULL;
+        write_pages[first + i] = write ? write + i * THALIA_MMU_PAGE_SIZE : NULL;
+    }
 }
 
-// Reads a byte from 'addr', performing mapping and I/O triggers.
-guint8 thalia_mmu_read_byte(ThaliaGB* gb, guint16 addr)
+// Sets up the pages of the whole address space. Writes to ROM control the
+// MBC, video RAM is watched for changes, and OAM and I/O have side effects,
+// so those are left to the handlers.
+void thalia_mmu_map(ThaliaGB* gb)
 {
-    guint8 ret = 0;
+    thalia_mmu_map_rom(gb);
+    thalia_mmu_map_pages(gb, 0x80, 0x20, gb->mmu.ram_gpu.packed, NULL);
+    thalia_mmu_map_ext(gb);
+    thalia_mmu_map_ram(gb);
+    thalia_mmu_map_pages(gb, 0xFE, 0x02, NULL, NULL);
+}
 
-    switch(addr & 0xF000) {
-    case 0x0000: case 0x1000:
-    case 0x2000: case 0x3000:
-        ret = gb->mmu->rom_bank0[addr];
-        break;
-    case 0x4000: case 0x5000:
-    case 0x6000: case 0x7000:
-        // The pointer points to the current bank mapped to this range.
-        ret = gb->mmu->rom_bankn[addr - 0x4000];
-        break;
-    case 0x8000: case 0x9000:
-        ret = gb->mmu->ram_gpu.packed[addr - 0x8000];
-        break;
-    case 0xA000: case 0xB000:
-        ret = gb->mmu->ram_ext[addr - 0xA000];
-        break;
-    case 0xC000: case 0xD000:
-        ret = gb->mmu->ram_int[addr - 0xC000];
-        break;
-    case 0xE000:
-        ret = gb->mmu->ram_int[addr - 0xE000];
-    case 0xF000:
-        switch(addr & 0x0F00) {
-        case 0x0000: case 0x0100:
-        case 0x0200: case 0x0300:
-        case 0x0400: case 0x0500:
-        case 0x0600: case 0x0700:
-        case 0x0800: case 0x0900:
-        case 0x0A00: case 0x0B00:
-        case 0x0C00: case 0x0D00:
-            // The first 0x0E00 bytes in this range are a copy of internal RAM
-            ret = gb->mmu->ram_int[addr - 0xE000];
-            break;
-        case 0x0E00:
-            // Only the first 0xA0 bytes in this range are meaningful
-            ret = addr < 0xFEA0 ? gb->mmu->ram_oam.packed[addr - 0xFE00] : 0;
-            break;
-        case 0x0F00:
-            if(addr == 0xFF00) {
-                // The keypad register status is synthesised from gb->keypad
-                ret = thalia_keypad_read(gb);
-            } else {
-                // Lower 0x80 bits are I/O RAM, upper 0x80 are zero-page RAM.
-                ret = addr < 0xFF80 ? gb->mmu->ram_io.packed[addr - 0xFF00] :
-                 gb->mmu->ram_page0.packed[addr - 0xFF80];
-            }
-            break;
-        }
-        break;
+// Maps bank 0 and the selected ROM bank, after loading or switching banks.
+// Banks missing from the ROM are left to the handlers.
+void thalia_mmu_map_rom(ThaliaGB* gb)
+{
+    guint8** banks = gb->mmu.rom_banks;
+    thalia_mmu_map_pages(gb, 0x00, 0x40,
+                         banks ? banks[gb->mmu.mbc.rom_bank0] : NULL, NULL);
+    thalia_mmu_map_pages(gb, 0x40, 0x40,
+                         banks ? banks[gb->mmu.mbc.rom_bank] : NULL, NULL);
+}
+
+// Maps internal RAM and its echo at 0xE000-0xFDFF, which mirrors 0xC000-0xDDFF,
+// for reading and writing.
+void thalia_mmu_map_ram(ThaliaGB* gb)
+{
+    thalia_mmu_map_pages(gb, 0xC0, 0x20, gb->mmu.ram_int, gb->mmu.ram_int);
+    thalia_mmu_map_pages(gb, 0xE0, 0x1E, gb->mmu.ram_int, gb->mmu.ram_int);
+}
+
+// Returns the offset into cartridge RAM that 'addr' maps to. Small RAMs
+// repeat throughout 0xA000-0xBFFF.
+static guint32 thalia_mmu_ext_offset(ThaliaGB* gb, guint16 addr)
+{
+    return (gb->mmu.mbc.ram_bank * 0x2000 + (addr & 0x1FFF)) %
+           gb->mmu.ram_ext_size;
+}
+
+// Maps the selected bank of cartridge RAM to 0xA000-0xBFFF. Disabled RAM,
+// MBC3 clock registers and MBC2 half-bytes go through the handlers, as do
+// pages of battery-backed RAM not yet written this frame.
+void thalia_mmu_map_ext(ThaliaGB* gb)
+{
+    thalia_mmu_t* mmu = &gb->mmu;
+    guint8** read_pages = THALIA_MMU_READ_PAGES(mmu);
+    guint8** write_pages = THALIA_MMU_WRITE_PAGES(mmu);
+    guint32 offset;
+    guint i;
+
+    if(!mmu->ram_ext || !mmu->mbc.enable_ext_ram || mmu->mbc.nibbles ||
+       THALIA_MBC_RTC_MAPPED(gb)) {
+        thalia_mmu_map_pages(gb, 0xA0, 0x20, NULL, NULL);
+        return;
     }
 
+    mmu->code_page = NULL;
+    for(i = 0; i < 0x20; i++) {
+        offset = thalia_mmu_ext_offset(gb, 0xA000 + i * THALIA_MMU_PAGE_SIZE);
+        read_pages[0xA0 + i] = mmu->ram_ext + offset;
+        write_pages[0xA0 + i] =
+            gb->save.fd < 0 || THALIA_SAVE_DIRTY(gb, offset) ?
+            mmu->ram_ext + offset : NULL;
+    }
+}
+
+// Sends writes to the page of internal RAM holding 'addr' through the handler,
+// which keeps the decoded code on it up to date. This lasts until the RAM is
+// mapped again.
+void thalia_mmu_protect(ThaliaGB* gb, guint16 addr)
+{
+    guint8** write_pages = THALIA_MMU_WRITE_PAGES(&gb->mmu);
+    guint page = addr >> 8;
+    if(page < 0xC0 || page >= 0xE0)
+        return;
+
+    write_pages[page] = NULL;
+    if(page < 0xDE)
+        write_pages[page + 0x20] = NULL;
+}
+
+// Starts the window of an OAM DMA transfer, in which the CPU can only read and
+// write HRAM. All pages go through the handlers meanwhile, which refuse the
+// rest.
+void thalia_mmu_dma_start(ThaliaGB* gb)
+{
+    thalia_mmu_t* mmu = &gb->mmu;
+    memcpy(mmu->dma_read_pages, mmu->read_pages, sizeof(mmu->read_pages));
+    memcpy(mmu->dma_write_pages, mmu->write_pages, sizeof(mmu->write_pages));
+    memset(mmu->read_pages, 0, sizeof(mmu->read_pages));
+    memset(mmu->write_pages, 0, sizeof(mmu->write_pages));
+    mmu->code_page = NULL;
+    mmu->dma = TRUE;
+}
+
+// Ends the window of an OAM DMA transfer, mapping all pages again.
+void thalia_mmu_dma_end(ThaliaGB* gb)
+{
+    thalia_mmu_t* mmu = &gb->mmu;
+    memcpy(mmu->read_pages, mmu->dma_read_pages, sizeof(mmu->read_pages));
+    memcpy(mmu->write_pages, mmu->dma_write_pages, sizeof(mmu->write_pages));
+    mmu->code_page = NULL;
+    mmu->dma = FALSE;
+}
+
+// Handles reads from pages with side effects.
+static guint8 thalia_mmu_read_handler(ThaliaGB* gb, guint16 addr)
+{
+    // During OAM DMA, only HRAM can be read.
+    if(G_UNLIKELY(gb->mmu.dma) && addr < 0xFF80)
+        return 0xFF;
+
+    // Cartridge RAM reads as open bus while disabled. MBC2 RAM only has the
+    // lower four bits.
+    if((addr & 0xE000) == 0xA000) {
+        if(THALIA_MBC_RTC_MAPPED(gb))
+            return thalia_mbc_rtc_read(gb);
+        if(!gb->mmu.ram_ext || !gb->mmu.mbc.enable_ext_ram)
+            return 0xFF;
+        return gb->mmu.ram_ext[thalia_mmu_ext_offset(gb, addr)] |
+               (gb->mmu.mbc.nibbles ? 0xF0 : 0x00);
+    }
+
+    switch(addr & 0xFF00) {
+    case 0xFE00:
+        // Only the first 0xA0 bytes in this range are meaningful
+        return addr < 0xFEA0 ? gb->mmu.ram_oam.packed[addr - 0xFE00] : 0;
+    case 0xFF00:
+        // The keypad register status is synthesised from gb->keypad
+        if(addr == 0xFF00)
+            return thalia_keypad_read(gb);
+
+        // The timer only runs when events are due, or when read. It is read
+        // as it was when this opcode started.
+        if(addr >= 0xFF04 && addr <= 0xFF07)
+            thalia_timer_sync(gb, gb->sched.start);
+
+        // Lower 0x80 bits are I/O RAM, upper 0x80 are zero-page RAM.
+        return addr < 0xFF80 ? gb->mmu.ram_io.packed[addr - 0xFF00] :
+         gb->mmu.ram_page0.packed[addr - 0xFF80];
+    default:
+        // ROM banks missing from the cartridge read as open bus.
+        return 0xFF;
+    }
+}
+
+// Reads a byte from 'addr', performing mapping and I/O triggers.
+guint8 thalia_mmu_read_byte(ThaliaGB* gb, guint16 addr)
+{
+    guint8* page = gb->mmu.read_pages[addr >> 8];
+    guint8 ret = G_LIKELY(page) ? page[addr & 0xFF] :
+     thalia_mmu_read_handler(gb, addr);
+
 #ifdef THALIA_DEBUG_MMU
     g_debug("(0x%04X) READ  @ 0x%04X: 0x%02X", gb->pc, addr, ret);
 #endif
@@ -99,104 +205,106 @@ guint16 thalia_mmu_read_word(ThaliaGB* gb, guint16 addr)
     return ret;
 }
 
-// Writes 'val' to 'addr', performing mapping and I/O steps.
-void thalia_mmu_write_byte(ThaliaGB* gb, guint16 addr, guint8 val)
+// Handles writes to pages with side effects.
+static void thalia_mmu_write_handler(ThaliaGB* gb, guint16 addr, guint8 val)
 {
-#ifdef THALIA_DEBUG_MMU
-    g_debug("(0x%04X) WRITE @ 0x%04X: 0x%02X", gb->pc, addr, val);
-#endif
+    guint32 offset;
+
+    // During OAM DMA, only HRAM can be written.
+    if(G_UNLIKELY(gb->mmu.dma) && addr < 0xFF80)
+        return;
+
     switch(addr & 0xF000) {
     case 0x0000: case 0x1000:
-        gb->mmu->mbc.enable_ext_ram = val == 0xA0;
-        return;
     case 0x2000: case 0x3000:
-        val = val & 0x1F;
-        if(val == 0) val = 1;
-        // Writes to this range cause a change in the lower five bits of the
-        // ROM bank number, which is mapped to 0x4000-0x7FFF.
-        gb->mmu->mbc.rom_bank = (gb->mmu->mbc.rom_bank & 0x60) | val;
-        gb->mmu->rom_bankn = gb->mmu->rom_banks[gb->mmu->mbc.rom_bank];
-        return;
     case 0x4000: case 0x5000:
-        if(gb->mmu->mbc.mode) {
-            // Writing to this range while in RAM mode causes a change in the
-            // RAM bank number, which is mapped to 0xA000-0xBFFF
-            g_warning("Switching RAM bank (not implemented!)");
-            gb->mmu->mbc.ram_bank = val & 4;
-        } else {
-            // Writing to this range while in ROM mode causes a change in the
-            // uppertwo bits of the ROM bank number.
-            gb->mmu->mbc.rom_bank =
-                ((val & 3) << 5) | (gb->mmu->mbc.rom_bank & 0x1F);
-            gb->mmu->rom_bankn = gb->mmu->rom_banks[gb->mmu->mbc.rom_bank];
-        }
-        return;
     case 0x6000: case 0x7000:
-        // Writes to this range change the MBC addressing mode to RAM-mode
-        // (least significant bit 1) or ROM-mode (least significant bit 0)
-        gb->mmu->mbc.mode = val & 0x01;
+        // Writes to ROM go to the registers of the memory bank controller.
+        gb->mmu.mbc.write(gb, addr, val);
         return;
     case 0x8000: case 0x9000:
-        gb->mmu->ram_gpu.packed[addr - 0x8000] = val;
-        thalia_gpu_mark_change(gb);
+        thalia_gpu_write_vram(gb, addr, val);
         return;
     case 0xA000: case 0xB000:
-        gb->mmu->ram_ext[addr - 0xA000] = val;
+        if(THALIA_MBC_RTC_MAPPED(gb)) {
+            thalia_mbc_rtc_write(gb, val);
+        } else if(gb->mmu.ram_ext && gb->mmu.mbc.enable_ext_ram) {
+            offset = thalia_mmu_ext_offset(gb, addr);
+            gb->mmu.ram_ext[offset] = gb->mmu.mbc.nibbles ? val & 0x0F : val;
+            thalia_save_mark(gb, offset);
+        }
+        return;
+    }
+
+    // Internal RAM holding decoded code, including its echo at 0xE000-0xFDFF.
+    if(addr < 0xFE00) {
+        if(addr >= 0xE000)
+            addr -= 0x2000;
+        gb->mmu.ram_int[addr - 0xC000] = val;
+        thalia_proc_cache_invalidate(gb, addr);
         return;
-    case 0xC000: case 0xD000:
-        gb->mmu->ram_int[addr - 0xC000] = val;
+    }
+
+    if(addr < 0xFF00) {
+        // Only the first 0xA0 bytes contain information, the rest are
+        // ignored.
+        if(addr < 0xFEA0)
+            thalia_gpu_write_oam(gb, addr, val);
+        return;
+    }
+
+    // I/O writes may change interrupts or when events are due. The timer has
+    // to be up to date before its registers change.
+    if(addr >= 0xFF04 && addr <= 0xFF07)
+        thalia_timer_sync(gb, gb->sched.start);
+    if(addr < 0xFF80 || addr == 0xFFFF)
+        thalia_sched_check(gb);
+
+    switch(addr) {
+    case 0xFF00:
+        // Writes to the keypad trigger selection of key columns.
+        thalia_keypad_write(gb, val);
         return;
-    case 0xE000:
-        gb->mmu->ram_int[addr - 0xE000] = val;
-    case 0xF000:
-        switch(addr & 0x0F00) {
-        case 0x0000: case 0x0100:
-        case 0x0200: case 0x0300:
-        case 0x0400: case 0x0500:
-        case 0x0600: case 0x0700:
-        case 0x0800: case 0x0900:
-        case 0x0A00: case 0x0B00:
-        case 0x0C00: case 0x0D00:
-            // The first 0x0E00 bytes in this range are a copy of internal RAM.
-            gb->mmu->ram_int[addr - 0xE000] = val;
-            return;
-        case 0x0E00:
-            // Only the first 0xA0 bytes contain information, the rest are
-            // ignored.
-            if(addr <= 0xFEA0) {
-                gb->mmu->ram_oam.packed[addr - 0xFE00] = val;
-                thalia_gpu_mark_change(gb);
-            }
-            return;
-        case 0x0F00:
-            switch(addr) {
-            case 0xFF00:
-                // Writes to the keypad trigger selection of key columns.
-                thalia_keypad_write(gb, val);
-                return;
-            case 0xFF46:
-                // Writes to this address trigger DMA
-                thalia_gpu_handle_dma(gb, val);
-                thalia_gpu_mark_change(gb);
-                return;
-            case 0xFF40: case 0xFF41:
-            case 0xFF42: case 0xFF43:
-            case 0xFF44: case 0xFF47:
-            case 0xFF48: case 0xFF49:
-            case 0xFF4A: case 0xFF4B:
-                // Fallthrough
-                thalia_gpu_mark_change(gb);
-            default:
-                if(addr < 0xFF80)
-                    gb->mmu->ram_io.packed[addr - 0xFF00] = val;
-                else
-                    gb->mmu->ram_page0.packed[addr - 0xFF80] = val;
-                return;
-            }
+    case 0xFF02:
+        // Writes to the serial control register may start a transfer.
+        thalia_serial_write(gb, val);
+        return;
+    case 0xFF46:
+        // Writes to this address trigger DMA
+        thalia_gpu_handle_dma(gb, val);
+        return;
+    case 0xFF40: case 0xFF42:
+    case 0xFF43: case 0xFF47:
+    case 0xFF48: case 0xFF49:
+    case 0xFF4A: case 0xFF4B:
+        // Registers that change what is drawn.
+        thalia_gpu_write_reg(gb, addr, val);
+        return;
+    default:
+        if(addr < 0xFF80)
+            gb->mmu.ram_io.packed[addr - 0xFF00] = val;
+        else {
+            gb->mmu.ram_page0.packed[addr - 0xFF80] = val;
+            thalia_proc_cache_invalidate(gb, addr);
         }
+        return;
     }
 }
 
+// Writes 'val' to 'addr', performing mapping and I/O steps.
+void thalia_mmu_write_byte(ThaliaGB* gb, guint16 addr, guint8 val)
+{
+    guint8* page = gb->mmu.write_pages[addr >> 8];
+
+#ifdef THALIA_DEBUG_MMU
+    g_debug("(0x%04X) WRITE @ 0x%04X: 0x%02X", gb->pc, addr, val);
+#endif
+    if(G_LIKELY(page))
+        page[addr & 0xFF] = val;
+    else
+        thalia_mmu_write_handler(gb, addr, val);
+}
+
 // Writes word 'val' to 'addr' in little-endian format.
 void thalia_mmu_write_word(ThaliaGB* gb, guint16 addr, guint16 val)
 {
@@ -228,14 +336,39 @@ guint16 thalia_mmu_pop_word(ThaliaGB* gb)
     return ret;
 }
 
-// Reads the byte next to the program counter.
-guint16 thalia_mmu_immediate_word(ThaliaGB* gb)
+// Reads the code byte at 'addr'. Code is read straight from the page it was
+// fetched from last, which is only looked up again when fetching moves to
+// another page or the pages are mapped anew. Pages with side effects are read
+// through the handlers as usual.
+guint8 thalia_mmu_fetch_byte(ThaliaGB* gb, guint16 addr)
+{
+    thalia_mmu_t* mmu = &gb->mmu;
+    if(G_UNLIKELY(!mmu->code_page || mmu->code_page_index != addr >> 8)) {
+        // OAM DMA only keeps data from the CPU. Code goes on as usual, like
+        // it would for blocks already decoded.
+        mmu->code_page = THALIA_MMU_READ_PAGES(mmu)[addr >> 8];
+        mmu->code_page_index = addr >> 8;
+        if(!mmu->code_page)
+            return thalia_mmu_read_byte(gb, addr);
+    }
+    return mmu->code_page[addr & 0xFF];
+}
+
+// Reads the code word at 'addr' in little-endian format.
+guint16 thalia_mmu_fetch_word(ThaliaGB* gb, guint16 addr)
 {
-    return thalia_mmu_read_word(gb, gb->pc + 1);
+    return thalia_mmu_fetch_byte(gb, addr) |
+     thalia_mmu_fetch_byte(gb, addr + 1) << 8;
 }
 
 // Reads the word next to the program counter.
+guint16 thalia_mmu_immediate_word(ThaliaGB* gb)
+{
+    return thalia_mmu_fetch_word(gb, gb->pc + 1);
+}
+
+// Reads the byte next to the program counter.
 guint8 thalia_mmu_immediate_byte(ThaliaGB* gb)
 {
-    return thalia_mmu_read_byte(gb, gb->pc + 1);
+    return thalia_mmu_fetch_byte(gb, gb->pc + 1);
 }
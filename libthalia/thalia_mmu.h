@@ -4,9 +4,12 @@
 #include <glib.h>
 #include "thalia_gb.h"
 #include "thalia_gpu.h"
+#include "thalia_mbc.h"
 
-#define THALIA_MMU_MAX_BANK_COUNT 0x80
+#define THALIA_MMU_MAX_BANK_COUNT 0x200
 #define THALIA_MMU_BANK_SIZE (0x4000)
+#define THALIA_MMU_PAGE_SIZE 0x100
+#define THALIA_MMU_PAGE_COUNT 0x100
 
 // I/O region mapping, allows for easy access to often used registers.
 // CAUTION: This memory layout will _not_ work on big-endian platforms!
@@ -17,9 +20,9 @@ typedef struct {
     guint8 sio_data;
 
     // Offset 0xFF02
-    gboolean sio_start : 1;
+    gboolean sio_clock : 1;        // Whether this side drives the clock
     guint8             : 6;        // Padding
-    gboolean sioclock  : 1;
+    gboolean sio_start : 1;        // Whether a transfer is running
 
     guint8 : 8;                    // Padding
 
@@ -33,13 +36,7 @@ typedef struct {
     guint8              : 5;       // Padding
     guint8 padding_1[0x07];        // Offset 0xFF07
 
-    // Offset 0xFF0F
-    gboolean int_flag_vblank : 1;
-    gboolean int_flag_lcd    : 1;
-    gboolean int_flag_timer  : 1;
-    gboolean int_flag_serial : 1;
-    gboolean int_flag_joypad : 1;
-    guint8 : 3;                    // Padding
+    guint8 int_flag;               // Offset 0xFF0F, see thalia_int_t
 
     guint8 padding_2[0x30];        // Offset 0xFF10
 
@@ -76,54 +73,64 @@ typedef struct {
 } thalia_io_t;
 
 typedef struct {
-    guint8* rom_bank0;                // Offset 0x0000
-    guint8* rom_bankn;                // Offset 0x4000
+    // The interrupt enable register comes right before the I/O registers, so
+    // it shares a cache line with the interrupt flags.
     union {
-        guint8 packed[0x2000];
+        guint8 packed[0x80];
         struct {
-            guint8 tileset_1[128][8][2];  // offset 0x8000
-            guint8 tileset_s[128][8][2];  // offset 0x8800
-            guint8 tileset_0[128][8][2];  // offset 0x9000
-            guint8 tilemap_0[32][32];
-            guint8 tilemap_1[32][32];
+            guint8 padding[0x7F];
+            guint8 int_enable;        // Offset 0xFFFF, see thalia_int_t
         } unpacked;
-    } ram_gpu;                        // Offset 0x8000
-    guint8 ram_ext[0x2000];           // Offset 0xA000
-    guint8 ram_int[0x2000];           // Offset 0xC000
+    } ram_page0; // Offset 0xFF80
     union {
         guint8 packed[0x80];
         thalia_io_t unpacked;
     } ram_io;                         // Offset 0xFF00
+    // Memory behind every 256-byte page of the address space, for reading and
+    // writing. Pages where access has side effects are NULL, and go through
+    // the handler for their region instead.
+    guint8* read_pages[THALIA_MMU_PAGE_COUNT];
+    guint8* write_pages[THALIA_MMU_PAGE_COUNT];
+    guint8* code_page;                // Page code was fetched from last
+    guint8 code_page_index;           // Its number, if code_page is not NULL
+    gboolean dma;                     // Whether OAM DMA is running
+    guint64 dma_end;                  // Cycle count at which it ends
     union {
         guint8 packed[0xA0];
         thalia_sprite_t unpacked[THALIA_GPU_N_SPRITES];
     } ram_oam;                        // Offset 0xFE00
     union {
-        guint8 packed[0x80];
+        guint8 packed[0x2000];
         struct {
-            guint8 padding[0x7F];
-            // Offset 0xFFFF
-            gboolean int_enable_vblank : 1;
-            gboolean int_enable_lcd    : 1;
-            gboolean int_enable_timer  : 1;
-            gboolean int_enable_serial : 1;
-            gboolean int_enable_pins   : 1;
-            guint8                     : 3;  // Padding
+            guint8 tileset_1[128][8][2];  // offset 0x8000
+            guint8 tileset_s[128][8][2];  // offset 0x8800
+            guint8 tileset_0[128][8][2];  // offset 0x9000
+            guint8 tilemap_0[32][32];
+            guint8 tilemap_1[32][32];
         } unpacked;
-    } ram_page0; // Offset 0xFF80
+    } ram_gpu;                        // Offset 0x8000
+    guint8 ram_int[0x2000];           // Offset 0xC000
+    guint8* ram_ext;                  // Offset 0xA000, all banks
+    guint32 ram_ext_size;             // Size of ram_ext, 0 without RAM
     gint rom_size;
-    struct {
-        gboolean enable_ext_ram;
-        gboolean mode;
-        guint8 rom_bank;
-        guint8 ram_bank;
-    } mbc;
-    guint8** rom_banks;
+    thalia_mbc_t mbc;                 // Memory bank controller
+    guint8** rom_banks;               // Banks of the shared ROM image
+    // While OAM DMA runs, the pages above are all NULL, and these hold the
+    // pages to go back to when it ends.
+    guint8* dma_read_pages[THALIA_MMU_PAGE_COUNT];
+    guint8* dma_write_pages[THALIA_MMU_PAGE_COUNT];
 } thalia_mmu_t;
 #endif
 
 #ifdef __THALIA_GB_T__
-void thalia_mmu_read_bank(GIOChannel* channel, guint8* dest, GError** error);
+// Page mapping
+void thalia_mmu_map(ThaliaGB* gb);
+void thalia_mmu_map_rom(ThaliaGB* gb);
+void thalia_mmu_map_ram(ThaliaGB* gb);
+void thalia_mmu_map_ext(ThaliaGB* gb);
+void thalia_mmu_protect(ThaliaGB* gb, guint16 addr);
+void thalia_mmu_dma_start(ThaliaGB* gb);
+void thalia_mmu_dma_end(ThaliaGB* gb);
 
 // Generic reading/writing
 guint8 thalia_mmu_read_byte(ThaliaGB* gb, guint16 addr);
@@ -135,7 +142,9 @@ void thalia_mmu_write_word(ThaliaGB* gb, guint16 addr, guint16 val);
 void thalia_mmu_push_word(ThaliaGB* gb, guint16 val);
 guint16 thalia_mmu_pop_word(ThaliaGB* gb);
 
-// Immediate fetching
+// Code and immediate fetching
+guint8 thalia_mmu_fetch_byte(ThaliaGB* gb, guint16 addr);
+guint16 thalia_mmu_fetch_word(ThaliaGB* gb, guint16 addr);
 guint16 thalia_mmu_immediate_word(ThaliaGB* gb);
 guint8 thalia_mmu_immediate_byte(ThaliaGB* gb);
 #endif
@@ -1,138 +1,146 @@
 #include <glib.h>
+#include <string.h>
 #include "thalia_gb.h"
 #include "thalia_alu.h"
 #include "thalia_proc.h"
 #include "thalia_mmu.h"
 #include "thalia_reg.h"
+#include "thalia_jit.h"
+#include "thalia_aot.h"
+#include "thalia_sched.h"
+#include "thalia_save.h"
 
 guint16 prev_pc;
 
-// Handles the end of opcode execution, increasing the cycle count by 'cycles'
-// and the program counter by 1 + 'pc_increase'. Note that for jumps, a value
-// of -1 is advised for this parameter.
-static inline void thalia_proc_end_opcode(ThaliaGB* gb, guint8 cycles,
-                                          guint16 pc_increase)
-{
-    gb->cycles += cycles;
-    gb->pc += pc_increase + 1;
-}
+// Opcode fields, as used by the register, condition and bit encodings.
+#define THALIA_PROC_REG_SRC(opcode)  ((opcode) & 0x07)
+#define THALIA_PROC_REG_DST(opcode)  (((opcode) >> 3) & 0x07)
+#define THALIA_PROC_REG_PAIR(opcode) (((opcode) >> 4) & 0x03)
+#define THALIA_PROC_COND(opcode)     (((opcode) >> 3) & 0x03)
+#define THALIA_PROC_DIR(opcode)      (((opcode) >> 3) & 0x01)
+#define THALIA_PROC_OPERATION(opcode) (((opcode) >> 4) & 0x01)
+#define THALIA_PROC_BIT(opcode)      (((opcode) >> 3) & 0x07)
+
+// Every opcode handler receives the opcode itself, from which it decodes its
+// register or condition fields, and the immediate operand (if any). By the
+// time a handler runs, the program counter already points at the next
+// instruction and the base cycle count has been added. Conditional branches
+// add what taking them costs on top of that.
+typedef void (*thalia_proc_handler_t)(ThaliaGB* gb, guint8 opcode,
+                                      guint16 operand);
+
+// Opcode properties relevant to block decoding.
+typedef enum {
+    THALIA_PROC_FLAG_NONE   = 0,
+    THALIA_PROC_FLAG_BRANCH = 1    // May change the flow of control
+} thalia_proc_flag_t;
+
+// Entry in the opcode tables.
+typedef struct {
+    thalia_proc_handler_t handler; // NULL for opcodes that do not exist
+    guint8 length;                 // Instruction length in bytes
+    guint8 cycles;                 // Base cycle count
+    thalia_operand_t operand;      // Kind of immediate operand
+    thalia_proc_flag_t flags;      // Properties for block decoding
+} thalia_proc_op_t;
 
 // Processes the "NOP" instruction (No operation).
-static inline void thalia_proc_nop(ThaliaGB* gb)
+static inline void thalia_proc_nop(ThaliaGB* gb, guint8 opcode,
+                                   guint16 operand)
 {
-    thalia_proc_end_opcode(gb, 1, 0);
 }
 
 // Processes the "LD (n), SP" instruction (Load SP into immediate address n).
-static inline void thalia_proc_ld_n_sp(ThaliaGB* gb, guint16 immediate)
+static inline void thalia_proc_ld_n_sp(ThaliaGB* gb, guint8 opcode,
+                                       guint16 operand)
 {
-    thalia_mmu_write_word(gb, immediate, gb->sp);
-    thalia_proc_end_opcode(gb, 5, 2);
+    thalia_mmu_write_word(gb, operand, gb->sp);
 }
 
 // Processes the "LD r, n" instruction (Load immediate word n into register r).
-static inline void thalia_proc_ld_r_n(ThaliaGB* gb,
-                                      thalia_regname_double_t reg,
-                                      guint16 immediate)
+static inline void thalia_proc_ld_r_n(ThaliaGB* gb, guint8 opcode,
+                                      guint16 operand)
 {
-    thalia_reg_write_double(gb, reg, immediate, FALSE);
-    thalia_proc_end_opcode(gb, 3, 2);
+    thalia_reg_write_double(gb, THALIA_PROC_REG_PAIR(opcode), operand, FALSE);
 }
 
 // Processes the "ADD HL, r" instruction (Add register r to HL).
-static inline void thalia_proc_add_hl_r(ThaliaGB* gb,
-                                        thalia_regname_double_t reg)
+static inline void thalia_proc_add_hl_r(ThaliaGB* gb, guint8 opcode,
+                                        guint16 operand)
 {
-    thalia_reg_write_double(
+    gb->reg.pairs[THALIA_REG_HL] = thalia_alu_add_16bit(
         gb,
-        THALIA_REG_HL,
-        thalia_alu_add_16bit(
-            gb,
-            thalia_reg_read_double(gb, THALIA_REG_HL, TRUE),
-            thalia_reg_read_double(gb, reg, FALSE)
-        ),
-        TRUE
+        gb->reg.pairs[THALIA_REG_HL],
+        thalia_reg_read_double(gb, THALIA_PROC_REG_PAIR(opcode), FALSE)
     );
-    thalia_proc_end_opcode(gb, 2, 0);
 }
 
 // Processes the "LD (r), A" opcode (Load A into address in register r).
-static inline void thalia_proc_ld_r_a(ThaliaGB* gb,
-                                      thalia_regname_double_t reg)
+static inline void thalia_proc_ld_r_a(ThaliaGB* gb, guint8 opcode,
+                                      guint16 operand)
 {
-    guint16 offset = thalia_reg_read_double(gb, reg, FALSE);
+    guint16 offset = gb->reg.pairs[THALIA_PROC_REG_PAIR(opcode)];
     thalia_mmu_write_byte(gb, offset, gb->reg.named.a);
-    thalia_proc_end_opcode(gb, 2, 0);
 }
 
 // Processes the "LD A, (r)" opcode (Load A from address in register r).
-static inline void thalia_proc_ld_a_r(ThaliaGB* gb,
-                                      thalia_regname_double_t reg)
+static inline void thalia_proc_ld_a_r(ThaliaGB* gb, guint8 opcode,
+                                      guint16 operand)
 {
-    guint16 offset = thalia_reg_read_double(gb, reg, FALSE);
+    guint16 offset = gb->reg.pairs[THALIA_PROC_REG_PAIR(opcode)];
     gb->reg.named.a = thalia_mmu_read_byte(gb, offset);
-    thalia_proc_end_opcode(gb, 2, 0);
 }
 
 // Processes the "INC r" opcode (Increment register r).
-static inline void thalia_proc_inc_r(ThaliaGB* gb,
-                                     thalia_regname_double_t reg)
+static inline void thalia_proc_inc_r(ThaliaGB* gb, guint8 opcode,
+                                     guint16 operand)
 {
     // circumvent ALU, no registers change
+    thalia_regname_double_t reg = THALIA_PROC_REG_PAIR(opcode);
     guint16 contents = thalia_reg_read_double(gb, reg, FALSE);
     thalia_reg_write_double(gb, reg, contents+1, FALSE);
-    thalia_proc_end_opcode(gb, 2, 0);
 }
 
 // Processes the "DEC r" opcode (Decrement register r).
-static inline void thalia_proc_dec_r(ThaliaGB* gb,
-                                     thalia_regname_double_t reg)
+static inline void thalia_proc_dec_r(ThaliaGB* gb, guint8 opcode,
+                                     guint16 operand)
 {
     // circumvent ALU, no registers change
+    thalia_regname_double_t reg = THALIA_PROC_REG_PAIR(opcode);
     guint16 contents = thalia_reg_read_double(gb, reg, FALSE);
     thalia_reg_write_double(gb, reg, contents-1, FALSE);
-    thalia_proc_end_opcode(gb, 2, 0);
 }
 
 // Processes the "INC d" opcode (Increment register d).
-static inline void thalia_proc_inc_d(ThaliaGB* gb, thalia_regname_single_t reg)
+static inline void thalia_proc_inc_d(ThaliaGB* gb, guint8 opcode,
+                                     guint16 operand)
 {
-    guint8 result = thalia_alu_add(
-        gb,
-        thalia_reg_read_single(gb, reg),
-        1,
-        FALSE
-    );
+    thalia_regname_single_t reg = THALIA_PROC_REG_DST(opcode);
+    guint8 result = thalia_alu_inc(gb, thalia_reg_read_single(gb, reg));
     thalia_reg_write_single(gb, reg, result);
-    thalia_proc_end_opcode(gb, 1, 0);
 }
 
 // Processes the "DEC d" opcode (Decrement register d).
-static inline void thalia_proc_dec_d(ThaliaGB* gb, thalia_regname_single_t reg)
+static inline void thalia_proc_dec_d(ThaliaGB* gb, guint8 opcode,
+                                     guint16 operand)
 {
-    guint8 result = thalia_alu_sub(
-        gb,
-        thalia_reg_read_single(gb, reg),
-        1,
-        FALSE
-    );
+    thalia_regname_single_t reg = THALIA_PROC_REG_DST(opcode);
+    guint8 result = thalia_alu_dec(gb, thalia_reg_read_single(gb, reg));
     thalia_reg_write_single(gb, reg, result);
-    thalia_proc_end_opcode(gb, 1, 0);
 }
 
 // Processes the "LD d, n" opcode (Load immedate byte into register d).
-static inline void thalia_proc_ld_d_n(ThaliaGB* gb,
-                                      thalia_regname_single_t reg,
-                                      guint8 immediate)
+static inline void thalia_proc_ld_d_n(ThaliaGB* gb, guint8 opcode,
+                                      guint16 operand)
 {
-    thalia_reg_write_single(gb, reg, immediate);
-    thalia_proc_end_opcode(gb, 2, 1);
+    thalia_reg_write_single(gb, THALIA_PROC_REG_DST(opcode), operand);
 }
 
 // Processes the "RdCA" opcode (Rotate left/right with carry register A).
-static inline void thalia_proc_rdca(ThaliaGB* gb, thalia_dir_t direction)
+static inline void thalia_proc_rdca(ThaliaGB* gb, guint8 opcode,
+                                    guint16 operand)
 {
-    switch(direction) {
+    switch(THALIA_PROC_DIR(opcode)) {
     case THALIA_DIR_RIGHT:
         gb->reg.named.a = thalia_alu_rrc(gb, gb->reg.named.a);
         break;
@@ -141,14 +149,14 @@ static inline void thalia_proc_rdca(ThaliaGB* gb, thalia_dir_t direction)
         break;
     }
     // Contrary to RdC A, this operation resets the zero flag.
-    gb->reg.named.flag_zero = FALSE;
-    thalia_proc_end_opcode(gb, 1, 0);
+    thalia_alu_set_flags(gb, thalia_alu_get_flags(gb) & ~THALIA_ALU_FLAG_ZERO);
 }
 
 // Processes the "RdA" opcode (Rotate left/right register A).
-static inline void thalia_proc_rda(ThaliaGB* gb, thalia_dir_t direction)
+static inline void thalia_proc_rda(ThaliaGB* gb, guint8 opcode,
+                                   guint16 operand)
 {
-    switch(direction) {
+    switch(THALIA_PROC_DIR(opcode)) {
     case THALIA_DIR_RIGHT:
         gb->reg.named.a = thalia_alu_rr(gb, gb->reg.named.a);
         break;
@@ -157,414 +165,421 @@ static inline void thalia_proc_rda(ThaliaGB* gb, thalia_dir_t direction)
         break;
     }
     // Contrary to Rd A, this operation resets the zero flag.
-    gb->reg.named.flag_zero = FALSE;
-    thalia_proc_end_opcode(gb, 1, 0);
+    thalia_alu_set_flags(gb, thalia_alu_get_flags(gb) & ~THALIA_ALU_FLAG_ZERO);
 }
 
 // Processes the "STOP" opcode (Stop and wait for keypad input).
-static inline void thalia_proc_stop(ThaliaGB* gb)
+static inline void thalia_proc_stop(ThaliaGB* gb, guint8 opcode,
+                                    guint16 operand)
 {
-    // TODO: Proper implementation
+    // The next step waits for the keys to change from here.
     gb->stopped = TRUE;
-    thalia_proc_end_opcode(gb, 1, 0);
+    gb->keypad.stop = g_atomic_int_get(&gb->keypad.changes);
+    thalia_sched_check(gb);
 }
 
 // Processes the "JR n" opcode (Relative jump).
-static inline void thalia_proc_jr_n(ThaliaGB* gb, guint8 immediate)
+static inline void thalia_proc_jr_n(ThaliaGB* gb, guint8 opcode,
+                                    guint16 operand)
 {
-    gb->pc += (gint8) immediate;
-    thalia_proc_end_opcode(gb, 2, 1);
+    gb->pc += (gint8) operand;
 }
 
 // Processes the "JR f, n" opcode (Conditional relative jump).
-static inline void thalia_proc_jr_f_n(ThaliaGB* gb, thalia_cond_t cond,
-                                      guint8 immediate)
+static inline void thalia_proc_jr_f_n(ThaliaGB* gb, guint8 opcode,
+                                      guint16 operand)
 {
-    if(thalia_alu_condition_satisfied(gb, cond))
-        gb->pc += (gint8) immediate;
-    thalia_proc_end_opcode(gb, 2, 1);
+    if(thalia_alu_condition_satisfied(gb, THALIA_PROC_COND(opcode))) {
+        gb->pc += (gint8) operand;
+        gb->cycles += 1; // Taking the jump costs a cycle more
+    }
 }
 
 // Processes the "LDo (HL), A" opcode.
 // (Load A into address pointed at by HL, then in- or decrease HL).
-static inline void thalia_proc_ldo_hl_a(ThaliaGB* gb, thalia_operation_t op)
+static inline void thalia_proc_ldo_hl_a(ThaliaGB* gb, guint8 opcode,
+                                        guint16 operand)
 {
-    guint16 hl = thalia_reg_read_double(gb, THALIA_REG_HL, TRUE);
+    guint16 hl = gb->reg.pairs[THALIA_REG_HL];
     thalia_mmu_write_byte(gb, hl, gb->reg.named.a);
-    switch(op) {
+    switch(THALIA_PROC_OPERATION(opcode)) {
     case THALIA_OPERATION_INC: hl++; break;
     case THALIA_OPERATION_DEC: hl--; break;
     }
-    thalia_reg_write_double(gb, THALIA_REG_HL, hl, TRUE);
-    thalia_proc_end_opcode(gb, 2, 0);
+    gb->reg.pairs[THALIA_REG_HL] = hl;
 }
 
 // Processes the "LDo A, (HL)" opcode.
 // (Load A from address pointed at by HL, then in- or decrease HL).
-static inline void thalia_proc_ldo_a_hl(ThaliaGB* gb, thalia_operation_t op)
+static inline void thalia_proc_ldo_a_hl(ThaliaGB* gb, guint8 opcode,
+                                        guint16 operand)
 {
-    guint16 hl = thalia_reg_read_double(gb, THALIA_REG_HL, TRUE);
+    guint16 hl = gb->reg.pairs[THALIA_REG_HL];
     gb->reg.named.a = thalia_mmu_read_byte(gb, hl);
-    switch(op) {
+    switch(THALIA_PROC_OPERATION(opcode)) {
     case THALIA_OPERATION_INC: hl++; break;
     case THALIA_OPERATION_DEC: hl--; break;
     }
-    thalia_reg_write_double(gb, THALIA_REG_HL, hl, TRUE);
-    thalia_proc_end_opcode(gb, 2, 0);
+    gb->reg.pairs[THALIA_REG_HL] = hl;
 }
 
 // Processes the "DAA" opcode (Perform BCD adjustment on register A).
-static inline void thalia_proc_daa(ThaliaGB* gb)
+static inline void thalia_proc_daa(ThaliaGB* gb, guint8 opcode,
+                                   guint16 operand)
 {
     gb->reg.named.a = thalia_alu_daa(gb, gb->reg.named.a);
-    thalia_proc_end_opcode(gb, 1, 0);
 }
 
 // Processes the "CPL" opcode (Perform bitwise complement on A).
-static inline void thalia_proc_cpl(ThaliaGB* gb)
+static inline void thalia_proc_cpl(ThaliaGB* gb, guint8 opcode,
+                                   guint16 operand)
 {
     gb->reg.named.a = thalia_alu_cpl(gb, gb->reg.named.a);
-    thalia_proc_end_opcode(gb, 1, 0);
 }
 
 // Processes the "SCF" opcode (Set carry flag).
-static inline void thalia_proc_scf(ThaliaGB* gb)
+static inline void thalia_proc_scf(ThaliaGB* gb, guint8 opcode,
+                                   guint16 operand)
 {
     thalia_alu_scf(gb);
-    thalia_proc_end_opcode(gb, 1, 0);
 }
 
 // Processes the "CCF" opcode (Complement carry flag).
-static inline void thalia_proc_ccf(ThaliaGB* gb)
+static inline void thalia_proc_ccf(ThaliaGB* gb, guint8 opcode,
+                                   guint16 operand)
 {
     thalia_alu_ccf(gb);
-    thalia_proc_end_opcode(gb, 1, 0);
 }
 
 // Processes the "HALT" opcode (Stop execution until interrupt occurs).
-static inline void thalia_proc_halt(ThaliaGB* gb)
+static inline void thalia_proc_halt(ThaliaGB* gb, guint8 opcode,
+                                    guint16 operand)
 {
     gb->halted = TRUE;
-    thalia_proc_end_opcode(gb, 1, 0);
+    thalia_sched_check(gb);
 }
 
 // Processes the "LD d, d" opcode (Load one register from another).
-static inline void thalia_proc_ld_d_d(ThaliaGB* gb,
-                                      thalia_regname_single_t treg,
-                                      thalia_regname_single_t sreg)
+static inline void thalia_proc_ld_d_d(ThaliaGB* gb, guint8 opcode,
+                                      guint16 operand)
 {
-    thalia_reg_write_single(gb, treg, thalia_reg_read_single(gb, sreg));
-    thalia_proc_end_opcode(gb, 1, 0);
+    thalia_reg_write_single(
+        gb,
+        THALIA_PROC_REG_DST(opcode),
+        thalia_reg_read_single(gb, THALIA_PROC_REG_SRC(opcode))
+    );
 }
 
 // Processes the "ADD A, d" opcode (Add register d to register A).
-static inline void thalia_proc_add_a_d(ThaliaGB* gb,
-                                       thalia_regname_single_t reg)
+static inline void thalia_proc_add_a_d(ThaliaGB* gb, guint8 opcode,
+                                       guint16 operand)
 {
-    guint8 other = thalia_reg_read_single(gb, reg);
+    guint8 other = thalia_reg_read_single(gb, THALIA_PROC_REG_SRC(opcode));
     gb->reg.named.a = thalia_alu_add(gb, gb->reg.named.a, other, TRUE);
-    thalia_proc_end_opcode(gb, 1, 0);
 }
 
 // Processes the "ADC A, d" opcode (Add register d to register A with carry).
-static inline void thalia_proc_adc_a_d(ThaliaGB* gb,
-                                       thalia_regname_single_t reg)
+static inline void thalia_proc_adc_a_d(ThaliaGB* gb, guint8 opcode,
+                                       guint16 operand)
 {
-    guint8 other = thalia_reg_read_single(gb, reg);
+    guint8 other = thalia_reg_read_single(gb, THALIA_PROC_REG_SRC(opcode));
     gb->reg.named.a = thalia_alu_add_carry(gb, gb->reg.named.a, other);
-    thalia_proc_end_opcode(gb, 1, 0);
 }
 
 // Processes the "SUB A, d" opcode (Subtract register d from register A).
-static inline void thalia_proc_sub_a_d(ThaliaGB* gb,
-                                       thalia_regname_single_t reg)
+static inline void thalia_proc_sub_a_d(ThaliaGB* gb, guint8 opcode,
+                                       guint16 operand)
 {
-    guint8 other = thalia_reg_read_single(gb, reg);
+    guint8 other = thalia_reg_read_single(gb, THALIA_PROC_REG_SRC(opcode));
     gb->reg.named.a = thalia_alu_sub(gb, gb->reg.named.a, other, TRUE);
-    thalia_proc_end_opcode(gb, 1, 0);
 }
 
 // Processes the "SBC A, d" opcode
 // (Subtract register d and carry from register A).
-static inline void thalia_proc_sbc_a_d(ThaliaGB* gb,
-                                       thalia_regname_single_t reg)
+static inline void thalia_proc_sbc_a_d(ThaliaGB* gb, guint8 opcode,
+                                       guint16 operand)
 {
-    guint8 other = thalia_reg_read_single(gb, reg);
+    guint8 other = thalia_reg_read_single(gb, THALIA_PROC_REG_SRC(opcode));
     gb->reg.named.a = thalia_alu_sub_carry(gb, gb->reg.named.a, other);
-    thalia_proc_end_opcode(gb, 1, 0);
 }
 
 // Processes the "AND A, d" opcode (Bitwise AND of registers A and d).
-static inline void thalia_proc_and_a_d(ThaliaGB* gb,
-                                       thalia_regname_single_t reg)
+static inline void thalia_proc_and_a_d(ThaliaGB* gb, guint8 opcode,
+                                       guint16 operand)
 {
-    guint8 other = thalia_reg_read_single(gb, reg);
+    guint8 other = thalia_reg_read_single(gb, THALIA_PROC_REG_SRC(opcode));
     gb->reg.named.a = thalia_alu_and(gb, gb->reg.named.a, other);
-    thalia_proc_end_opcode(gb, 1, 0);
 }
 
 // Processes the "XOR A, d" opcode (Bitwise XOR of registers A and d).
-static inline void thalia_proc_xor_a_d(ThaliaGB* gb,
-                                       thalia_regname_single_t reg)
+static inline void thalia_proc_xor_a_d(ThaliaGB* gb, guint8 opcode,
+                                       guint16 operand)
 {
-    guint8 other = thalia_reg_read_single(gb, reg);
+    guint8 other = thalia_reg_read_single(gb, THALIA_PROC_REG_SRC(opcode));
     gb->reg.named.a = thalia_alu_xor(gb, gb->reg.named.a, other);
-    thalia_proc_end_opcode(gb, 1, 0);
 }
 
 // Processes the "OR A, d" opcode (Bitwise OR of registers A and d).
-static inline void thalia_proc_or_a_d(ThaliaGB* gb,
-                                      thalia_regname_single_t reg)
+static inline void thalia_proc_or_a_d(ThaliaGB* gb, guint8 opcode,
+                                      guint16 operand)
 {
-    guint8 other = thalia_reg_read_single(gb, reg);
+    guint8 other = thalia_reg_read_single(gb, THALIA_PROC_REG_SRC(opcode));
     gb->reg.named.a = thalia_alu_or(gb, gb->reg.named.a, other);
-    thalia_proc_end_opcode(gb, 1, 0);
 }
 
 // Processes the "CP A, d" opcode (Compare register A against register d).
-static inline void thalia_proc_cp_a_d(ThaliaGB* gb,
-                                      thalia_regname_single_t reg)
+static inline void thalia_proc_cp_a_d(ThaliaGB* gb, guint8 opcode,
+                                      guint16 operand)
 {
-    guint8 other = thalia_reg_read_single(gb, reg);
+    guint8 other = thalia_reg_read_single(gb, THALIA_PROC_REG_SRC(opcode));
     thalia_alu_sub(gb, gb->reg.named.a, other, TRUE);
-    thalia_proc_end_opcode(gb, 1, 0);
 }
 
 // Processes the "ADD A, n" opcode (Add immediate to register A).
-static inline void thalia_proc_add_a_n(ThaliaGB* gb, guint8 other)
+static inline void thalia_proc_add_a_n(ThaliaGB* gb, guint8 opcode,
+                                       guint16 operand)
 {
-    gb->reg.named.a = thalia_alu_add(gb, gb->reg.named.a, other, TRUE);
-    thalia_proc_end_opcode(gb, 2, 1);
+    gb->reg.named.a = thalia_alu_add(gb, gb->reg.named.a, operand, TRUE);
 }
 
 // Processes the "ADC A, N" opcode (Add immediate and carry to register A).
-static inline void thalia_proc_adc_a_n(ThaliaGB* gb, guint8 other)
+static inline void thalia_proc_adc_a_n(ThaliaGB* gb, guint8 opcode,
+                                       guint16 operand)
 {
-    gb->reg.named.a = thalia_alu_add_carry(gb, gb->reg.named.a, other);
-    thalia_proc_end_opcode(gb, 2, 1);
+    gb->reg.named.a = thalia_alu_add_carry(gb, gb->reg.named.a, operand);
 }
 
 // Processes the "SUB A, n" opcode (Subtract immediate from register A).
-static inline void thalia_proc_sub_a_n(ThaliaGB* gb, guint8 other)
+static inline void thalia_proc_sub_a_n(ThaliaGB* gb, guint8 opcode,
+                                       guint16 operand)
 {
-    gb->reg.named.a = thalia_alu_sub(gb, gb->reg.named.a, other, TRUE);
-    thalia_proc_end_opcode(gb, 2, 1);
+    gb->reg.named.a = thalia_alu_sub(gb, gb->reg.named.a, operand, TRUE);
 }
 
 // Processes the "SBC A, n" opcode
 // (Subtract immediate with carry from register A).
-static inline void thalia_proc_sbc_a_n(ThaliaGB* gb, guint8 other)
+static inline void thalia_proc_sbc_a_n(ThaliaGB* gb, guint8 opcode,
+                                       guint16 operand)
 {
-    gb->reg.named.a = thalia_alu_sub_carry(gb, gb->reg.named.a, other);
-    thalia_proc_end_opcode(gb, 2, 1);
+    gb->reg.named.a = thalia_alu_sub_carry(gb, gb->reg.named.a, operand);
 }
 
 // Processes the "AND A, n" opcode (Bitwise AND of register A and immediate).
-static inline void thalia_proc_and_a_n(ThaliaGB* gb, guint8 other)
+static inline void thalia_proc_and_a_n(ThaliaGB* gb, guint8 opcode,
+                                       guint16 operand)
 {
-    gb->reg.named.a = thalia_alu_and(gb, gb->reg.named.a, other);
-    thalia_proc_end_opcode(gb, 2, 1);
+    gb->reg.named.a = thalia_alu_and(gb, gb->reg.named.a, operand);
 }
 
 // Processes the "XOR A, n" opcode (Bitwise XOR of register A and immediate).
-static inline void thalia_proc_xor_a_n(ThaliaGB* gb, guint8 other)
+static inline void thalia_proc_xor_a_n(ThaliaGB* gb, guint8 opcode,
+                                       guint16 operand)
 {
-    gb->reg.named.a = thalia_alu_xor(gb, gb->reg.named.a, other);
-    thalia_proc_end_opcode(gb, 2, 1);
+    gb->reg.named.a = thalia_alu_xor(gb, gb->reg.named.a, operand);
 }
 
 // Processes the "OR A, n" opcode (Bitwise OR of register A and immediate).
-static inline void thalia_proc_or_a_n(ThaliaGB* gb, guint8 other)
+static inline void thalia_proc_or_a_n(ThaliaGB* gb, guint8 opcode,
+                                      guint16 operand)
 {
-    gb->reg.named.a = thalia_alu_or(gb, gb->reg.named.a, other);
-    thalia_proc_end_opcode(gb, 2, 1);
+    gb->reg.named.a = thalia_alu_or(gb, gb->reg.named.a, operand);
 }
 
 // Processes the "CP A, n" opcode (Compare register A against immediate).
-static inline void thalia_proc_cp_a_n(ThaliaGB* gb, guint8 other)
+static inline void thalia_proc_cp_a_n(ThaliaGB* gb, guint8 opcode,
+                                      guint16 operand)
 {
-    thalia_alu_sub(gb, gb->reg.named.a, other, TRUE);
-    thalia_proc_end_opcode(gb, 2, 1);
+    thalia_alu_sub(gb, gb->reg.named.a, operand, TRUE);
 }
 
 // Processes the "POP r" opcode (Pop word from stack into register r)
-static inline void thalia_proc_pop_r(ThaliaGB* gb, thalia_regname_double_t reg)
+static inline void thalia_proc_pop_r(ThaliaGB* gb, guint8 opcode,
+                                     guint16 operand)
 {
-    thalia_reg_write_double(gb, reg, thalia_mmu_pop_word(gb), TRUE);
-    thalia_proc_end_opcode(gb, 3, 0);
+    thalia_reg_write_double(
+        gb,
+        THALIA_PROC_REG_PAIR(opcode),
+        thalia_mmu_pop_word(gb),
+        TRUE
+    );
 }
 
 // Processes the "PUSH r" opcode (Push register r into stack).
-static inline void thalia_proc_push_r(ThaliaGB* gb,
-                                      thalia_regname_double_t reg)
+static inline void thalia_proc_push_r(ThaliaGB* gb, guint8 opcode,
+                                      guint16 operand)
 {
-    thalia_mmu_push_word(gb, thalia_reg_read_double(gb, reg, TRUE));
-    thalia_proc_end_opcode(gb, 4, 0);
+    thalia_mmu_push_word(
+        gb,
+        thalia_reg_read_double(gb, THALIA_PROC_REG_PAIR(opcode), TRUE)
+    );
 }
 
 // Processes the "RST n" opcode (Call code at n << 3).
-static inline void thalia_proc_rst_n(ThaliaGB* gb, guint8 offset)
+static inline void thalia_proc_rst_n(ThaliaGB* gb, guint8 opcode,
+                                     guint16 operand)
 {
-    thalia_mmu_push_word(gb, gb->pc + 1);
-    gb->pc = offset << 3;
-    thalia_proc_end_opcode(gb, 8, -1);
+    thalia_mmu_push_word(gb, gb->pc);
+    gb->pc = THALIA_PROC_REG_DST(opcode) << 3;
 }
 
 // Processes the "RET f" opcode (Conditional return).
-static inline void thalia_proc_ret_f(ThaliaGB* gb, thalia_cond_t condition)
+static inline void thalia_proc_ret_f(ThaliaGB* gb, guint8 opcode,
+                                     guint16 operand)
 {
-    if(thalia_alu_condition_satisfied(gb, condition)) {
+    if(thalia_alu_condition_satisfied(gb, THALIA_PROC_COND(opcode))) {
         gb->pc = thalia_mmu_pop_word(gb);
-        thalia_proc_end_opcode(gb, 2, -1);
-    } else
-        thalia_proc_end_opcode(gb, 2, 0);
+        gb->cycles += 3; // Popping and jumping
+    }
 }
 
 // Processes the "RET(I)" opcode
 // (Unconditional return, possibly enabling interrupts).
-static inline void thalia_proc_ret(ThaliaGB* gb, gboolean interrupts)
+static inline void thalia_proc_ret(ThaliaGB* gb, guint8 opcode,
+                                   guint16 operand)
 {
     gb->pc = thalia_mmu_pop_word(gb);
-    if(interrupts)
+    if(THALIA_PROC_OPERATION(opcode)) {
         gb->interrupts = TRUE;
-    thalia_proc_end_opcode(gb, 3, -1);
+        thalia_sched_check(gb);
+    }
 }
 
 // Processes the "JP f, n" opcode (Conditional absolute jump).
-static inline void thalia_proc_jp_f_n(ThaliaGB* gb, thalia_cond_t condition,
- guint16 immediate)
+static inline void thalia_proc_jp_f_n(ThaliaGB* gb, guint8 opcode,
+                                      guint16 operand)
 {
-    if(thalia_alu_condition_satisfied(gb, condition)) {
-        gb->pc = immediate;
-        thalia_proc_end_opcode(gb, 3, -1);
-    } else
-        thalia_proc_end_opcode(gb, 3, 2);
+    if(thalia_alu_condition_satisfied(gb, THALIA_PROC_COND(opcode))) {
+        gb->pc = operand;
+        gb->cycles += 1; // Taking the jump costs a cycle more
+    }
 }
 
 // Processes the "JP n" opcode (Absolute jump).
-static inline void thalia_proc_jp_n(ThaliaGB* gb, guint16 immediate)
+static inline void thalia_proc_jp_n(ThaliaGB* gb, guint8 opcode,
+                                    guint16 operand)
 {
-    gb->pc = immediate;
-    thalia_proc_end_opcode(gb, 3, -1);
+    gb->pc = operand;
 }
 
 // Processes the "CALL f, n" opcode (Conditional call).
-static inline void thalia_proc_call_f_n(ThaliaGB* gb, thalia_cond_t condition,
- guint16 immediate)
+static inline void thalia_proc_call_f_n(ThaliaGB* gb, guint8 opcode,
+                                        guint16 operand)
 {
-    if(thalia_alu_condition_satisfied(gb, condition)) {
-        thalia_mmu_push_word(gb, gb->pc + 3);
-        gb->pc = immediate;
-        thalia_proc_end_opcode(gb, 3, -1);
-    } else
-        thalia_proc_end_opcode(gb, 3, 2);
+    if(thalia_alu_condition_satisfied(gb, THALIA_PROC_COND(opcode))) {
+        thalia_mmu_push_word(gb, gb->pc);
+        gb->pc = operand;
+        gb->cycles += 3; // Pushing and jumping
+    }
 }
 
 // Processes the "CALL n" opcode (Unconditional call).
-static inline void thalia_proc_call_n(ThaliaGB* gb, guint16 immediate)
+static inline void thalia_proc_call_n(ThaliaGB* gb, guint8 opcode,
+                                      guint16 operand)
 {
-    thalia_mmu_push_word(gb, gb->pc + 3);
-    gb->pc = immediate;
-    thalia_proc_end_opcode(gb, 3, -1);
+    thalia_mmu_push_word(gb, gb->pc);
+    gb->pc = operand;
 }
 
 // Processes the "ADD SP, n" opcode (Add immediate to SP).
-static inline void thalia_proc_add_sp_n(ThaliaGB* gb, guint8 immediate)
+static inline void thalia_proc_add_sp_n(ThaliaGB* gb, guint8 opcode,
+                                        guint16 operand)
 {
-    gb->sp = thalia_alu_add_16bit_mixed(gb, gb->sp, immediate);
-    thalia_proc_end_opcode(gb, 4, 1);
+    gb->sp = thalia_alu_add_16bit_mixed(gb, gb->sp, operand);
 }
 
 // Processes the "LD HL, SP+n" opcode (Store SP+n in HL).
-static inline void thalia_proc_ld_hl_sp_n(ThaliaGB* gb, guint8 immediate)
+static inline void thalia_proc_ld_hl_sp_n(ThaliaGB* gb, guint8 opcode,
+                                          guint16 operand)
 {
-    guint16 res = thalia_alu_add_16bit_mixed(gb, gb->sp, immediate);
-    thalia_reg_write_double(gb, THALIA_REG_HL, res, FALSE);
-    thalia_proc_end_opcode(gb, 3, 1);
+    guint16 res = thalia_alu_add_16bit_mixed(gb, gb->sp, operand);
+    gb->reg.pairs[THALIA_REG_HL] = res;
 }
 
 // Processes the "LD (0xFF00+n), A" opcode
 // (Load register A from address 0xFF00+immediate).
-static inline void thalia_proc_ld_ff00_n_a(ThaliaGB* gb, guint8 immediate)
+static inline void thalia_proc_ld_ff00_n_a(ThaliaGB* gb, guint8 opcode,
+                                           guint16 operand)
 {
-    thalia_mmu_write_byte(gb, 0xFF00 + immediate, gb->reg.named.a);
-    thalia_proc_end_opcode(gb, 3, 1);
+    thalia_mmu_write_byte(gb, 0xFF00 + operand, gb->reg.named.a);
 }
 
 // Processes the "LD A, (0xFF00+n)" opcode.
 // (Store register A in address 0xFF00+immediate).
-static inline void thalia_proc_ld_a_ff00_n(ThaliaGB* gb, guint8 immediate)
+static inline void thalia_proc_ld_a_ff00_n(ThaliaGB* gb, guint8 opcode,
+                                           guint16 operand)
 {
-    gb->reg.named.a = thalia_mmu_read_byte(gb, 0xFF00 + immediate);
-    thalia_proc_end_opcode(gb, 3, 1);
+    gb->reg.named.a = thalia_mmu_read_byte(gb, 0xFF00 + operand);
 }
 
 // Processes the "LD A, (0xFF00+C)" opcode.
 // (Load register A from address 0xFF00+register C)
-static inline void thalia_proc_ld_a_c(ThaliaGB* gb)
+static inline void thalia_proc_ld_a_c(ThaliaGB* gb, guint8 opcode,
+                                      guint16 operand)
 {
     gb->reg.named.a = thalia_mmu_read_byte(gb, 0xFF00+gb->reg.named.c);
-    thalia_proc_end_opcode(gb, 2, 0);
 }
 
 // Processes the "LD (0xFF00+C), A" opcode.
 // (Store register A at address 0xFF00+register C)
-static inline void thalia_proc_ld_c_a(ThaliaGB* gb)
+static inline void thalia_proc_ld_c_a(ThaliaGB* gb, guint8 opcode,
+                                      guint16 operand)
 {
     thalia_mmu_write_byte(gb, 0xFF00+gb->reg.named.c, gb->reg.named.a);
-    thalia_proc_end_opcode(gb, 2, 0);
 }
 
 // Processes the "LD (n), A" opcode (Store register A at immediate address).
-static inline void thalia_proc_ld_n_a(ThaliaGB* gb, guint16 immediate)
+static inline void thalia_proc_ld_n_a(ThaliaGB* gb, guint8 opcode,
+                                      guint16 operand)
 {
-    thalia_mmu_write_byte(gb, immediate, gb->reg.named.a);
-    thalia_proc_end_opcode(gb, 4, 2);
+    thalia_mmu_write_byte(gb, operand, gb->reg.named.a);
 }
 
 // Processes the "LD A, (n)" opcode (Load A from immediate address).
-static inline void thalia_proc_ld_a_n(ThaliaGB* gb, guint16 immediate)
+static inline void thalia_proc_ld_a_n(ThaliaGB* gb, guint8 opcode,
+                                      guint16 operand)
 {
-    gb->reg.named.a = thalia_mmu_read_byte(gb, immediate);
-    thalia_proc_end_opcode(gb, 4, 2);
+    gb->reg.named.a = thalia_mmu_read_byte(gb, operand);
 }
 
 // Processes the "JP HL" opcode (Jump to address in register HL).
-static inline void thalia_proc_jp_hl(ThaliaGB* gb)
+static inline void thalia_proc_jp_hl(ThaliaGB* gb, guint8 opcode,
+                                     guint16 operand)
 {
-    gb->pc = thalia_reg_read_double(gb, THALIA_REG_HL, TRUE);
-    thalia_proc_end_opcode(gb, 1, -1);
+    gb->pc = gb->reg.pairs[THALIA_REG_HL];
 }
 
 // Processes the "LD SP, HL" opcode (Set SP to HL).
-static inline void thalia_proc_ld_sp_hl(ThaliaGB* gb)
+static inline void thalia_proc_ld_sp_hl(ThaliaGB* gb, guint8 opcode,
+                                        guint16 operand)
 {
-    gb->sp = thalia_reg_read_double(gb, THALIA_REG_HL, TRUE);
-    thalia_proc_end_opcode(gb, 2, 0);
+    gb->sp = gb->reg.pairs[THALIA_REG_HL];
 }
 
 // Processes the "DI" opcode (Disable interrupts after next instruction).
-static inline void thalia_proc_di(ThaliaGB* gb)
+static inline void thalia_proc_di(ThaliaGB* gb, guint8 opcode,
+                                  guint16 operand)
 {
     gb->disable_interrupts_in = 2;
-    thalia_proc_end_opcode(gb, 1, 0);
+    thalia_sched_check(gb);
 }
 
 // Processes the "EI" opcode (Enable interrupts after next instruction).
-static inline void thalia_proc_ei(ThaliaGB* gb)
+static inline void thalia_proc_ei(ThaliaGB* gb, guint8 opcode,
+                                  guint16 operand)
 {
     gb->enable_interrupts_in = 2;
-    thalia_proc_end_opcode(gb, 1, 0);
+    thalia_sched_check(gb);
 }
 
 // Processes the "RdC d" opcode (Rotate left/right with carry register d).
-static inline void thalia_proc_rdc_d(ThaliaGB* gb, thalia_dir_t dir,
- thalia_regname_single_t reg)
+static inline void thalia_proc_rdc_d(ThaliaGB* gb, guint8 opcode,
+                                     guint16 operand)
 {
+    thalia_regname_single_t reg = THALIA_PROC_REG_SRC(opcode);
     guint8 res;
-    switch(dir) {
+    switch(THALIA_PROC_DIR(opcode)) {
     case THALIA_DIR_RIGHT:
-      res = thalia_alu_rrc(gb, thalia_reg_read_single(gb, reg));
+        res = thalia_alu_rrc(gb, thalia_reg_read_single(gb, reg));
         break;
     case THALIA_DIR_LEFT:
         res = thalia_alu_rlc(gb, thalia_reg_read_single(gb, reg));
@@ -575,15 +590,15 @@ static inline void thalia_proc_rdc_d(ThaliaGB* gb, thalia_dir_t dir,
     }
 
     thalia_reg_write_single(gb, reg, res);
-    thalia_proc_end_opcode(gb, 2, 1);
 }
 
 // Processes the "Rd d" opcode (Rotate left/right register d).
-static inline void thalia_proc_rd_d(ThaliaGB* gb, thalia_dir_t dir,
- thalia_regname_single_t reg)
+static inline void thalia_proc_rd_d(ThaliaGB* gb, guint8 opcode,
+                                    guint16 operand)
 {
+    thalia_regname_single_t reg = THALIA_PROC_REG_SRC(opcode);
     guint8 res;
-    switch(dir) {
+    switch(THALIA_PROC_DIR(opcode)) {
     case THALIA_DIR_RIGHT:
         res = thalia_alu_rr(gb, thalia_reg_read_single(gb, reg));
         break;
@@ -596,15 +611,15 @@ static inline void thalia_proc_rd_d(ThaliaGB* gb, thalia_dir_t dir,
     }
 
     thalia_reg_write_single(gb, reg, res);
-    thalia_proc_end_opcode(gb, 2, 1);
 }
 
 // Processes the "SdA d" opcode (Shift register d left/right arithmetically).
-static inline void thalia_proc_sda_d(ThaliaGB* gb, thalia_dir_t dir,
- thalia_regname_single_t reg)
+static inline void thalia_proc_sda_d(ThaliaGB* gb, guint8 opcode,
+                                     guint16 operand)
 {
+    thalia_regname_single_t reg = THALIA_PROC_REG_SRC(opcode);
     guint8 res;
-    switch(dir) {
+    switch(THALIA_PROC_DIR(opcode)) {
     case THALIA_DIR_RIGHT:
         res = thalia_alu_sra(gb, thalia_reg_read_single(gb, reg));
         break;
@@ -617,723 +632,1227 @@ static inline void thalia_proc_sda_d(ThaliaGB* gb, thalia_dir_t dir,
     }
 
     thalia_reg_write_single(gb, reg, res);
-    thalia_proc_end_opcode(gb, 2, 1);
 }
 
 // Processes the "SWAP d" opcode (Swap nibbles in register d).
-static inline void thalia_proc_swap_d(ThaliaGB* gb,
-                                      thalia_regname_single_t reg)
+static inline void thalia_proc_swap_d(ThaliaGB* gb, guint8 opcode,
+                                      guint16 operand)
 {
+    thalia_regname_single_t reg = THALIA_PROC_REG_SRC(opcode);
     guint8 res = thalia_alu_swap(gb, thalia_reg_read_single(gb, reg));
     thalia_reg_write_single(gb, reg, res);
-    thalia_proc_end_opcode(gb, 2, 1);
 }
 
 // Processes the "SRL" d opcode (Shift register d right logically).
-static inline void thalia_proc_srl_d(ThaliaGB* gb, thalia_regname_single_t reg)
+static inline void thalia_proc_srl_d(ThaliaGB* gb, guint8 opcode,
+                                     guint16 operand)
 {
+    thalia_regname_single_t reg = THALIA_PROC_REG_SRC(opcode);
     guint8 res = thalia_alu_srl(gb, thalia_reg_read_single(gb, reg));
     thalia_reg_write_single(gb, reg, res);
-    thalia_proc_end_opcode(gb, 2, 1);
 }
 
 // Processes the "BIT n, d" opcode (Test for bit n to be set in register d).
-static inline void thalia_proc_bit_n_d(ThaliaGB* gb, guint8 bit,
- thalia_regname_single_t reg)
+static inline void thalia_proc_bit_n_d(ThaliaGB* gb, guint8 opcode,
+                                       guint16 operand)
 {
-    thalia_alu_bit(gb, thalia_reg_read_single(gb, reg), bit);
-    thalia_proc_end_opcode(gb, 2, 1);
+    thalia_regname_single_t reg = THALIA_PROC_REG_SRC(opcode);
+    thalia_alu_bit(gb, thalia_reg_read_single(gb, reg), THALIA_PROC_BIT(opcode));
 }
 
 // Processes the "RES n, d" opcode (Reset bit n in register d).
-static inline void thalia_proc_res_n_d(ThaliaGB* gb, guint8 bit,
- thalia_regname_single_t reg)
+static inline void thalia_proc_res_n_d(ThaliaGB* gb, guint8 opcode,
+                                       guint16 operand)
 {
-    guint8 res = thalia_alu_res(gb, thalia_reg_read_single(gb,reg), bit);
+    thalia_regname_single_t reg = THALIA_PROC_REG_SRC(opcode);
+    guint8 res = thalia_alu_res(
+        gb,
+        thalia_reg_read_single(gb, reg),
+        THALIA_PROC_BIT(opcode)
+    );
     thalia_reg_write_single(gb, reg, res);
-    thalia_proc_end_opcode(gb, 2, 1);
 }
 
 // Processes the "SET n, d" opcode (Set bit n in register d).
-static inline void thalia_proc_set_n_d(ThaliaGB* gb, guint8 bit,
- thalia_regname_single_t reg)
+static inline void thalia_proc_set_n_d(ThaliaGB* gb, guint8 opcode,
+                                       guint16 operand)
 {
-    guint8 res = thalia_alu_set(gb, thalia_reg_read_single(gb,reg), bit);
+    thalia_regname_single_t reg = THALIA_PROC_REG_SRC(opcode);
+    guint8 res = thalia_alu_set(
+        gb,
+        thalia_reg_read_single(gb, reg),
+        THALIA_PROC_BIT(opcode)
+    );
     thalia_reg_write_single(gb, reg, res);
-    thalia_proc_end_opcode(gb, 2, 1);
 }
 
-// Decodes an extended opcode.
-static inline void thalia_proc_decode_extended(ThaliaGB* gb, guint8 opcode)
-{
-    switch(opcode) {
+static inline void thalia_proc_extended(ThaliaGB* gb, guint8 opcode,
+                                        guint16 operand);
+
+// Shorthands for the opcode tables below.
+#define THALIA_PROC_OP(name, length, cycles, operand, flags) \
+    { thalia_proc_##name, length, cycles, THALIA_OPERAND_##operand, \
+      THALIA_PROC_FLAG_##flags }
+#define THALIA_PROC_OP_NONE \
+    { NULL, 1, 0, THALIA_OPERAND_NONE, THALIA_PROC_FLAG_BRANCH }
+
+// Main opcode table, indexed by the first byte of an instruction.
+static const thalia_proc_op_t thalia_proc_ops[256] = {
     // High 0
-    case 0x00: thalia_proc_rdc_d(gb, 0, 0); return;
-    case 0x01: thalia_proc_rdc_d(gb, 0, 1); return;
-    case 0x02: thalia_proc_rdc_d(gb, 0, 2); return;
-    case 0x03: thalia_proc_rdc_d(gb, 0, 3); return;
-    case 0x04: thalia_proc_rdc_d(gb, 0, 4); return;
-    case 0x05: thalia_proc_rdc_d(gb, 0, 5); return;
-    case 0x06: thalia_proc_rdc_d(gb, 0, 6); return;
-    case 0x07: thalia_proc_rdc_d(gb, 0, 7); return;
-    case 0x08: thalia_proc_rdc_d(gb, 1, 0); return;
-    case 0x09: thalia_proc_rdc_d(gb, 1, 1); return;
-    case 0x0A: thalia_proc_rdc_d(gb, 1, 2); return;
-    case 0x0B: thalia_proc_rdc_d(gb, 1, 3); return;
-    case 0x0C: thalia_proc_rdc_d(gb, 1, 4); return;
-    case 0x0D: thalia_proc_rdc_d(gb, 1, 5); return;
-    case 0x0E: thalia_proc_rdc_d(gb, 1, 6); return;
-    case 0x0F: thalia_proc_rdc_d(gb, 1, 7); return;
+    THALIA_PROC_OP(nop,         1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_r_n,      3, 3, WORD, NONE),
+    THALIA_PROC_OP(ld_r_a,      1, 2, NONE, NONE),
+    THALIA_PROC_OP(inc_r,       1, 2, NONE, NONE),
+    THALIA_PROC_OP(inc_d,       1, 1, NONE, NONE),
+    THALIA_PROC_OP(dec_d,       1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_n,      2, 2, BYTE, NONE),
+    THALIA_PROC_OP(rdca,        1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_n_sp,     3, 5, WORD, NONE),
+    THALIA_PROC_OP(add_hl_r,    1, 2, NONE, NONE),
+    THALIA_PROC_OP(ld_a_r,      1, 2, NONE, NONE),
+    THALIA_PROC_OP(dec_r,       1, 2, NONE, NONE),
+    THALIA_PROC_OP(inc_d,       1, 1, NONE, NONE),
+    THALIA_PROC_OP(dec_d,       1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_n,      2, 2, BYTE, NONE),
+    THALIA_PROC_OP(rdca,        1, 1, NONE, NONE),
 
     // High 1
-    case 0x10: thalia_proc_rd_d(gb, 0, 0); return;
-    case 0x11: thalia_proc_rd_d(gb, 0, 1); return;
-    case 0x12: thalia_proc_rd_d(gb, 0, 2); return;
-    case 0x13: thalia_proc_rd_d(gb, 0, 3); return;
-    case 0x14: thalia_proc_rd_d(gb, 0, 4); return;
-    case 0x15: thalia_proc_rd_d(gb, 0, 5); return;
-    case 0x16: thalia_proc_rd_d(gb, 0, 6); return;
-    case 0x17: thalia_proc_rd_d(gb, 0, 7); return;
-    case 0x18: thalia_proc_rd_d(gb, 1, 0); return;
-    case 0x19: thalia_proc_rd_d(gb, 1, 1); return;
-    case 0x1A: thalia_proc_rd_d(gb, 1, 2); return;
-    case 0x1B: thalia_proc_rd_d(gb, 1, 3); return;
-    case 0x1C: thalia_proc_rd_d(gb, 1, 4); return;
-    case 0x1D: thalia_proc_rd_d(gb, 1, 5); return;
-    case 0x1E: thalia_proc_rd_d(gb, 1, 6); return;
-    case 0x1F: thalia_proc_rd_d(gb, 1, 7); return;
+    THALIA_PROC_OP(stop,        1, 1, NONE, BRANCH),
+    THALIA_PROC_OP(ld_r_n,      3, 3, WORD, NONE),
+    THALIA_PROC_OP(ld_r_a,      1, 2, NONE, NONE),
+    THALIA_PROC_OP(inc_r,       1, 2, NONE, NONE),
+    THALIA_PROC_OP(inc_d,       1, 1, NONE, NONE),
+    THALIA_PROC_OP(dec_d,       1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_n,      2, 2, BYTE, NONE),
+    THALIA_PROC_OP(rda,         1, 1, NONE, NONE),
+    THALIA_PROC_OP(jr_n,        2, 2, BYTE, BRANCH),
+    THALIA_PROC_OP(add_hl_r,    1, 2, NONE, NONE),
+    THALIA_PROC_OP(ld_a_r,      1, 2, NONE, NONE),
+    THALIA_PROC_OP(dec_r,       1, 2, NONE, NONE),
+    THALIA_PROC_OP(inc_d,       1, 1, NONE, NONE),
+    THALIA_PROC_OP(dec_d,       1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_n,      2, 2, BYTE, NONE),
+    THALIA_PROC_OP(rda,         1, 1, NONE, NONE),
 
     // High 2
-    case 0x20: thalia_proc_sda_d(gb, 0, 0); return;
-    case 0x21: thalia_proc_sda_d(gb, 0, 1); return;
-    case 0x22: thalia_proc_sda_d(gb, 0, 2); return;
-    case 0x23: thalia_proc_sda_d(gb, 0, 3); return;
-    case 0x24: thalia_proc_sda_d(gb, 0, 4); return;
-    case 0x25: thalia_proc_sda_d(gb, 0, 5); return;
-    case 0x26: thalia_proc_sda_d(gb, 0, 6); return;
-    case 0x27: thalia_proc_sda_d(gb, 0, 7); return;
-    case 0x28: thalia_proc_sda_d(gb, 1, 0); return;
-    case 0x29: thalia_proc_sda_d(gb, 1, 1); return;
-    case 0x2A: thalia_proc_sda_d(gb, 1, 2); return;
-    case 0x2B: thalia_proc_sda_d(gb, 1, 3); return;
-    case 0x2C: thalia_proc_sda_d(gb, 1, 4); return;
-    case 0x2D: thalia_proc_sda_d(gb, 1, 5); return;
-    case 0x2E: thalia_proc_sda_d(gb, 1, 6); return;
-    case 0x2F: thalia_proc_sda_d(gb, 1, 7); return;
+    THALIA_PROC_OP(jr_f_n,      2, 2, BYTE, BRANCH),
+    THALIA_PROC_OP(ld_r_n,      3, 3, WORD, NONE),
+    THALIA_PROC_OP(ldo_hl_a,    1, 2, NONE, NONE),
+    THALIA_PROC_OP(inc_r,       1, 2, NONE, NONE),
+    THALIA_PROC_OP(inc_d,       1, 1, NONE, NONE),
+    THALIA_PROC_OP(dec_d,       1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_n,      2, 2, BYTE, NONE),
+    THALIA_PROC_OP(daa,         1, 1, NONE, NONE),
+    THALIA_PROC_OP(jr_f_n,      2, 2, BYTE, BRANCH),
+    THALIA_PROC_OP(add_hl_r,    1, 2, NONE, NONE),
+    THALIA_PROC_OP(ldo_a_hl,    1, 2, NONE, NONE),
+    THALIA_PROC_OP(dec_r,       1, 2, NONE, NONE),
+    THALIA_PROC_OP(inc_d,       1, 1, NONE, NONE),
+    THALIA_PROC_OP(dec_d,       1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_n,      2, 2, BYTE, NONE),
+    THALIA_PROC_OP(cpl,         1, 1, NONE, NONE),
 
     // High 3
-    case 0x30: thalia_proc_swap_d(gb, 0); return;
-    case 0x31: thalia_proc_swap_d(gb, 1); return;
-    case 0x32: thalia_proc_swap_d(gb, 2); return;
-    case 0x33: thalia_proc_swap_d(gb, 3); return;
-    case 0x34: thalia_proc_swap_d(gb, 4); return;
-    case 0x35: thalia_proc_swap_d(gb, 5); return;
-    case 0x36: thalia_proc_swap_d(gb, 6); return;
-    case 0x37: thalia_proc_swap_d(gb, 7); return;
-    case 0x38: thalia_proc_srl_d(gb, 0); return;
-    case 0x39: thalia_proc_srl_d(gb, 1); return;
-    case 0x3A: thalia_proc_srl_d(gb, 2); return;
-    case 0x3B: thalia_proc_srl_d(gb, 3); return;
-    case 0x3C: thalia_proc_srl_d(gb, 4); return;
-    case 0x3D: thalia_proc_srl_d(gb, 5); return;
-    case 0x3E: thalia_proc_srl_d(gb, 6); return;
-    case 0x3F: thalia_proc_srl_d(gb, 7); return;
+    THALIA_PROC_OP(jr_f_n,      2, 2, BYTE, BRANCH),
+    THALIA_PROC_OP(ld_r_n,      3, 3, WORD, NONE),
+    THALIA_PROC_OP(ldo_hl_a,    1, 2, NONE, NONE),
+    THALIA_PROC_OP(inc_r,       1, 2, NONE, NONE),
+    THALIA_PROC_OP(inc_d,       1, 1, NONE, NONE),
+    THALIA_PROC_OP(dec_d,       1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_n,      2, 2, BYTE, NONE),
+    THALIA_PROC_OP(scf,         1, 1, NONE, NONE),
+    THALIA_PROC_OP(jr_f_n,      2, 2, BYTE, BRANCH),
+    THALIA_PROC_OP(add_hl_r,    1, 2, NONE, NONE),
+    THALIA_PROC_OP(ldo_a_hl,    1, 2, NONE, NONE),
+    THALIA_PROC_OP(dec_r,       1, 2, NONE, NONE),
+    THALIA_PROC_OP(inc_d,       1, 1, NONE, NONE),
+    THALIA_PROC_OP(dec_d,       1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_n,      2, 2, BYTE, NONE),
+    THALIA_PROC_OP(ccf,         1, 1, NONE, NONE),
 
     // High 4
-    case 0x40: thalia_proc_bit_n_d(gb, 0, 0); return;
-    case 0x41: thalia_proc_bit_n_d(gb, 0, 1); return;
-    case 0x42: thalia_proc_bit_n_d(gb, 0, 2); return;
-    case 0x43: thalia_proc_bit_n_d(gb, 0, 3); return;
-    case 0x44: thalia_proc_bit_n_d(gb, 0, 4); return;
-    case 0x45: thalia_proc_bit_n_d(gb, 0, 5); return;
-    case 0x46: thalia_proc_bit_n_d(gb, 0, 6); return;
-    case 0x47: thalia_proc_bit_n_d(gb, 0, 7); return;
-    case 0x48: thalia_proc_bit_n_d(gb, 1, 0); return;
-    case 0x49: thalia_proc_bit_n_d(gb, 1, 1); return;
-    case 0x4A: thalia_proc_bit_n_d(gb, 1, 2); return;
-    case 0x4B: thalia_proc_bit_n_d(gb, 1, 3); return;
-    case 0x4C: thalia_proc_bit_n_d(gb, 1, 4); return;
-    case 0x4D: thalia_proc_bit_n_d(gb, 1, 5); return;
-    case 0x4E: thalia_proc_bit_n_d(gb, 1, 6); return;
-    case 0x4F: thalia_proc_bit_n_d(gb, 1, 7); return;
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
 
     // High 5
-    case 0x50: thalia_proc_bit_n_d(gb, 2, 0); return;
-    case 0x51: thalia_proc_bit_n_d(gb, 2, 1); return;
-    case 0x52: thalia_proc_bit_n_d(gb, 2, 2); return;
-    case 0x53: thalia_proc_bit_n_d(gb, 2, 3); return;
-    case 0x54: thalia_proc_bit_n_d(gb, 2, 4); return;
-    case 0x55: thalia_proc_bit_n_d(gb, 2, 5); return;
-    case 0x56: thalia_proc_bit_n_d(gb, 2, 6); return;
-    case 0x57: thalia_proc_bit_n_d(gb, 2, 7); return;
-    case 0x58: thalia_proc_bit_n_d(gb, 3, 0); return;
-    case 0x59: thalia_proc_bit_n_d(gb, 3, 1); return;
-    case 0x5A: thalia_proc_bit_n_d(gb, 3, 2); return;
-    case 0x5B: thalia_proc_bit_n_d(gb, 3, 3); return;
-    case 0x5C: thalia_proc_bit_n_d(gb, 3, 4); return;
-    case 0x5D: thalia_proc_bit_n_d(gb, 3, 5); return;
-    case 0x5E: thalia_proc_bit_n_d(gb, 3, 6); return;
-    case 0x5F: thalia_proc_bit_n_d(gb, 3, 7); return;
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
 
     // High 6
-    case 0x60: thalia_proc_bit_n_d(gb, 4, 0); return;
-    case 0x61: thalia_proc_bit_n_d(gb, 4, 1); return;
-    case 0x62: thalia_proc_bit_n_d(gb, 4, 2); return;
-    case 0x63: thalia_proc_bit_n_d(gb, 4, 3); return;
-    case 0x64: thalia_proc_bit_n_d(gb, 4, 4); return;
-    case 0x65: thalia_proc_bit_n_d(gb, 4, 5); return;
-    case 0x66: thalia_proc_bit_n_d(gb, 4, 6); return;
-    case 0x67: thalia_proc_bit_n_d(gb, 4, 7); return;
-    case 0x68: thalia_proc_bit_n_d(gb, 5, 0); return;
-    case 0x69: thalia_proc_bit_n_d(gb, 5, 1); return;
-    case 0x6A: thalia_proc_bit_n_d(gb, 5, 2); return;
-    case 0x6B: thalia_proc_bit_n_d(gb, 5, 3); return;
-    case 0x6C: thalia_proc_bit_n_d(gb, 5, 4); return;
-    case 0x6D: thalia_proc_bit_n_d(gb, 5, 5); return;
-    case 0x6E: thalia_proc_bit_n_d(gb, 5, 6); return;
-    case 0x6F: thalia_proc_bit_n_d(gb, 5, 7); return;
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
 
     // High 7
-    case 0x70: thalia_proc_bit_n_d(gb, 6, 0); return;
-    case 0x71: thalia_proc_bit_n_d(gb, 6, 1); return;
-    case 0x72: thalia_proc_bit_n_d(gb, 6, 2); return;
-    case 0x73: thalia_proc_bit_n_d(gb, 6, 3); return;
-    case 0x74: thalia_proc_bit_n_d(gb, 6, 4); return;
-    case 0x75: thalia_proc_bit_n_d(gb, 6, 5); return;
-    case 0x76: thalia_proc_bit_n_d(gb, 6, 6); return;
-    case 0x77: thalia_proc_bit_n_d(gb, 6, 7); return;
-    case 0x78: thalia_proc_bit_n_d(gb, 7, 0); return;
-    case 0x79: thalia_proc_bit_n_d(gb, 7, 1); return;
-    case 0x7A: thalia_proc_bit_n_d(gb, 7, 2); return;
-    case 0x7B: thalia_proc_bit_n_d(gb, 7, 3); return;
-    case 0x7C: thalia_proc_bit_n_d(gb, 7, 4); return;
-    case 0x7D: thalia_proc_bit_n_d(gb, 7, 5); return;
-    case 0x7E: thalia_proc_bit_n_d(gb, 7, 6); return;
-    case 0x7F: thalia_proc_bit_n_d(gb, 7, 7); return;
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(halt,        1, 1, NONE, BRANCH),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(ld_d_d,      1, 1, NONE, NONE),
 
     // High 8
-    case 0x80: thalia_proc_res_n_d(gb, 0, 0); return;
-    case 0x81: thalia_proc_res_n_d(gb, 0, 1); return;
-    case 0x82: thalia_proc_res_n_d(gb, 0, 2); return;
-    case 0x83: thalia_proc_res_n_d(gb, 0, 3); return;
-    case 0x84: thalia_proc_res_n_d(gb, 0, 4); return;
-    case 0x85: thalia_proc_res_n_d(gb, 0, 5); return;
-    case 0x86: thalia_proc_res_n_d(gb, 0, 6); return;
-    case 0x87: thalia_proc_res_n_d(gb, 0, 7); return;
-    case 0x88: thalia_proc_res_n_d(gb, 1, 0); return;
-    case 0x89: thalia_proc_res_n_d(gb, 1, 1); return;
-    case 0x8A: thalia_proc_res_n_d(gb, 1, 2); return;
-    case 0x8B: thalia_proc_res_n_d(gb, 1, 3); return;
-    case 0x8C: thalia_proc_res_n_d(gb, 1, 4); return;
-    case 0x8D: thalia_proc_res_n_d(gb, 1, 5); return;
-    case 0x8E: thalia_proc_res_n_d(gb, 1, 6); return;
-    case 0x8F: thalia_proc_res_n_d(gb, 1, 7); return;
+    THALIA_PROC_OP(add_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(add_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(add_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(add_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(add_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(add_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(add_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(add_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(adc_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(adc_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(adc_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(adc_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(adc_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(adc_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(adc_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(adc_a_d,     1, 1, NONE, NONE),
 
     // High 9
-    case 0x90: thalia_proc_res_n_d(gb, 2, 0); return;
-    case 0x91: thalia_proc_res_n_d(gb, 2, 1); return;
-    case 0x92: thalia_proc_res_n_d(gb, 2, 2); return;
-    case 0x93: thalia_proc_res_n_d(gb, 2, 3); return;
-    case 0x94: thalia_proc_res_n_d(gb, 2, 4); return;
-    case 0x95: thalia_proc_res_n_d(gb, 2, 5); return;
-    case 0x96: thalia_proc_res_n_d(gb, 2, 6); return;
-    case 0x97: thalia_proc_res_n_d(gb, 2, 7); return;
-    case 0x98: thalia_proc_res_n_d(gb, 3, 0); return;
-    case 0x99: thalia_proc_res_n_d(gb, 3, 1); return;
-    case 0x9A: thalia_proc_res_n_d(gb, 3, 2); return;
-    case 0x9B: thalia_proc_res_n_d(gb, 3, 3); return;
-    case 0x9C: thalia_proc_res_n_d(gb, 3, 4); return;
-    case 0x9D: thalia_proc_res_n_d(gb, 3, 5); return;
-    case 0x9E: thalia_proc_res_n_d(gb, 3, 6); return;
-    case 0x9F: thalia_proc_res_n_d(gb, 3, 7); return;
+    THALIA_PROC_OP(sub_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(sub_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(sub_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(sub_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(sub_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(sub_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(sub_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(sub_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(sbc_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(sbc_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(sbc_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(sbc_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(sbc_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(sbc_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(sbc_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(sbc_a_d,     1, 1, NONE, NONE),
 
     // High A
-    case 0xA0: thalia_proc_res_n_d(gb, 4, 0); return;
-    case 0xA1: thalia_proc_res_n_d(gb, 4, 1); return;
-    case 0xA2: thalia_proc_res_n_d(gb, 4, 2); return;
-    case 0xA3: thalia_proc_res_n_d(gb, 4, 3); return;
-    case 0xA4: thalia_proc_res_n_d(gb, 4, 4); return;
-    case 0xA5: thalia_proc_res_n_d(gb, 4, 5); return;
-    case 0xA6: thalia_proc_res_n_d(gb, 4, 6); return;
-    case 0xA7: thalia_proc_res_n_d(gb, 4, 7); return;
-    case 0xA8: thalia_proc_res_n_d(gb, 5, 0); return;
-    case 0xA9: thalia_proc_res_n_d(gb, 5, 1); return;
-    case 0xAA: thalia_proc_res_n_d(gb, 5, 2); return;
-    case 0xAB: thalia_proc_res_n_d(gb, 5, 3); return;
-    case 0xAC: thalia_proc_res_n_d(gb, 5, 4); return;
-    case 0xAD: thalia_proc_res_n_d(gb, 5, 5); return;
-    case 0xAE: thalia_proc_res_n_d(gb, 5, 6); return;
-    case 0xAF: thalia_proc_res_n_d(gb, 5, 7); return;
+    THALIA_PROC_OP(and_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(and_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(and_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(and_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(and_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(and_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(and_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(and_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(xor_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(xor_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(xor_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(xor_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(xor_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(xor_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(xor_a_d,     1, 1, NONE, NONE),
+    THALIA_PROC_OP(xor_a_d,     1, 1, NONE, NONE),
 
     // High B
-    case 0xB0: thalia_proc_res_n_d(gb, 6, 0); return;
-    case 0xB1: thalia_proc_res_n_d(gb, 6, 1); return;
-    case 0xB2: thalia_proc_res_n_d(gb, 6, 2); return;
-    case 0xB3: thalia_proc_res_n_d(gb, 6, 3); return;
-    case 0xB4: thalia_proc_res_n_d(gb, 6, 4); return;
-    case 0xB5: thalia_proc_res_n_d(gb, 6, 5); return;
-    case 0xB6: thalia_proc_res_n_d(gb, 6, 6); return;
-    case 0xB7: thalia_proc_res_n_d(gb, 6, 7); return;
-    case 0xB8: thalia_proc_res_n_d(gb, 7, 0); return;
-    case 0xB9: thalia_proc_res_n_d(gb, 7, 1); return;
-    case 0xBA: thalia_proc_res_n_d(gb, 7, 2); return;
-    case 0xBB: thalia_proc_res_n_d(gb, 7, 3); return;
-    case 0xBC: thalia_proc_res_n_d(gb, 7, 4); return;
-    case 0xBD: thalia_proc_res_n_d(gb, 7, 5); return;
-    case 0xBE: thalia_proc_res_n_d(gb, 7, 6); return;
-    case 0xBF: thalia_proc_res_n_d(gb, 7, 7); return;
+    THALIA_PROC_OP(or_a_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(or_a_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(or_a_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(or_a_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(or_a_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(or_a_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(or_a_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(or_a_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(cp_a_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(cp_a_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(cp_a_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(cp_a_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(cp_a_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(cp_a_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(cp_a_d,      1, 1, NONE, NONE),
+    THALIA_PROC_OP(cp_a_d,      1, 1, NONE, NONE),
 
     // High C
-    case 0xC0: thalia_proc_set_n_d(gb, 0, 0); return;
-    case 0xC1: thalia_proc_set_n_d(gb, 0, 1); return;
-    case 0xC2: thalia_proc_set_n_d(gb, 0, 2); return;
-    case 0xC3: thalia_proc_set_n_d(gb, 0, 3); return;
-    case 0xC4: thalia_proc_set_n_d(gb, 0, 4); return;
-    case 0xC5: thalia_proc_set_n_d(gb, 0, 5); return;
-    case 0xC6: thalia_proc_set_n_d(gb, 0, 6); return;
-    case 0xC7: thalia_proc_set_n_d(gb, 0, 7); return;
-    case 0xC8: thalia_proc_set_n_d(gb, 1, 0); return;
-    case 0xC9: thalia_proc_set_n_d(gb, 1, 1); return;
-    case 0xCA: thalia_proc_set_n_d(gb, 1, 2); return;
-    case 0xCB: thalia_proc_set_n_d(gb, 1, 3); return;
-    case 0xCC: thalia_proc_set_n_d(gb, 1, 4); return;
-    case 0xCD: thalia_proc_set_n_d(gb, 1, 5); return;
-    case 0xCE: thalia_proc_set_n_d(gb, 1, 6); return;
-    case 0xCF: thalia_proc_set_n_d(gb, 1, 7); return;
+    THALIA_PROC_OP(ret_f,       1, 2, NONE, BRANCH),
+    THALIA_PROC_OP(pop_r,       1, 3, NONE, NONE),
+    THALIA_PROC_OP(jp_f_n,      3, 3, WORD, BRANCH),
+    THALIA_PROC_OP(jp_n,        3, 3, WORD, BRANCH),
+    THALIA_PROC_OP(call_f_n,    3, 3, WORD, BRANCH),
+    THALIA_PROC_OP(push_r,      1, 4, NONE, NONE),
+    THALIA_PROC_OP(add_a_n,     2, 2, BYTE, NONE),
+    THALIA_PROC_OP(rst_n,       1, 8, NONE, BRANCH),
+    THALIA_PROC_OP(ret_f,       1, 2, NONE, BRANCH),
+    THALIA_PROC_OP(ret,         1, 3, NONE, BRANCH),
+    THALIA_PROC_OP(jp_f_n,      3, 3, WORD, BRANCH),
+    THALIA_PROC_OP(extended,    2, 0, BYTE, NONE),
+    THALIA_PROC_OP(call_f_n,    3, 3, WORD, BRANCH),
+    THALIA_PROC_OP(call_n,      3, 3, WORD, BRANCH),
+    THALIA_PROC_OP(adc_a_n,     2, 2, BYTE, NONE),
+    THALIA_PROC_OP(rst_n,       1, 8, NONE, BRANCH),
 
     // High D
-    case 0xD0: thalia_proc_set_n_d(gb, 2, 0); return;
-    case 0xD1: thalia_proc_set_n_d(gb, 2, 1); return;
-    case 0xD2: thalia_proc_set_n_d(gb, 2, 2); return;
-    case 0xD3: thalia_proc_set_n_d(gb, 2, 3); return;
-    case 0xD4: thalia_proc_set_n_d(gb, 2, 4); return;
-    case 0xD5: thalia_proc_set_n_d(gb, 2, 5); return;
-    case 0xD6: thalia_proc_set_n_d(gb, 2, 6); return;
-    case 0xD7: thalia_proc_set_n_d(gb, 2, 7); return;
-    case 0xD8: thalia_proc_set_n_d(gb, 3, 0); return;
-    case 0xD9: thalia_proc_set_n_d(gb, 3, 1); return;
-    case 0xDA: thalia_proc_set_n_d(gb, 3, 2); return;
-    case 0xDB: thalia_proc_set_n_d(gb, 3, 3); return;
-    case 0xDC: thalia_proc_set_n_d(gb, 3, 4); return;
-    case 0xDD: thalia_proc_set_n_d(gb, 3, 5); return;
-    case 0xDE: thalia_proc_set_n_d(gb, 3, 6); return;
-    case 0xDF: thalia_proc_set_n_d(gb, 3, 7); return;
+    THALIA_PROC_OP(ret_f,       1, 2, NONE, BRANCH),
+    THALIA_PROC_OP(pop_r,       1, 3, NONE, NONE),
+    THALIA_PROC_OP(jp_f_n,      3, 3, WORD, BRANCH),
+    THALIA_PROC_OP_NONE,
+    THALIA_PROC_OP(call_f_n,    3, 3, WORD, BRANCH),
+    THALIA_PROC_OP(push_r,      1, 4, NONE, NONE),
+    THALIA_PROC_OP(sub_a_n,     2, 2, BYTE, NONE),
+    THALIA_PROC_OP(rst_n,       1, 8, NONE, BRANCH),
+    THALIA_PROC_OP(ret_f,       1, 2, NONE, BRANCH),
+    THALIA_PROC_OP(ret,         1, 3, NONE, BRANCH),
+    THALIA_PROC_OP(jp_f_n,      3, 3, WORD, BRANCH),
+    THALIA_PROC_OP_NONE,
+    THALIA_PROC_OP(call_f_n,    3, 3, WORD, BRANCH),
+    THALIA_PROC_OP_NONE,
+    THALIA_PROC_OP(sbc_a_n,     2, 2, BYTE, NONE),
+    THALIA_PROC_OP(rst_n,       1, 8, NONE, BRANCH),
 
     // High E
-    case 0xE0: thalia_proc_set_n_d(gb, 4, 0); return;
-    case 0xE1: thalia_proc_set_n_d(gb, 4, 1); return;
-    case 0xE2: thalia_proc_set_n_d(gb, 4, 2); return;
-    case 0xE3: thalia_proc_set_n_d(gb, 4, 3); return;
-    case 0xE4: thalia_proc_set_n_d(gb, 4, 4); return;
-    case 0xE5: thalia_proc_set_n_d(gb, 4, 5); return;
-    case 0xE6: thalia_proc_set_n_d(gb, 4, 6); return;
-    case 0xE7: thalia_proc_set_n_d(gb, 4, 7); return;
-    case 0xE8: thalia_proc_set_n_d(gb, 5, 0); return;
-    case 0xE9: thalia_proc_set_n_d(gb, 5, 1); return;
-    case 0xEA: thalia_proc_set_n_d(gb, 5, 2); return;
-    case 0xEB: thalia_proc_set_n_d(gb, 5, 3); return;
-    case 0xEC: thalia_proc_set_n_d(gb, 5, 4); return;
-    case 0xED: thalia_proc_set_n_d(gb, 5, 5); return;
-    case 0xEE: thalia_proc_set_n_d(gb, 5, 6); return;
-    case 0xEF: thalia_proc_set_n_d(gb, 5, 7); return;
+    THALIA_PROC_OP(ld_ff00_n_a, 2, 3, BYTE, NONE),
+    THALIA_PROC_OP(pop_r,       1, 3, NONE, NONE),
+    THALIA_PROC_OP(ld_c_a,      1, 2, NONE, NONE),
+    THALIA_PROC_OP_NONE,
+    THALIA_PROC_OP_NONE,
+    THALIA_PROC_OP(push_r,      1, 4, NONE, NONE),
+    THALIA_PROC_OP(and_a_n,     2, 2, BYTE, NONE),
+    THALIA_PROC_OP(rst_n,       1, 8, NONE, BRANCH),
+    THALIA_PROC_OP(add_sp_n,    2, 4, BYTE, NONE),
+    THALIA_PROC_OP(jp_hl,       1, 1, NONE, BRANCH),
+    THALIA_PROC_OP(ld_n_a,      3, 4, WORD, NONE),
+    THALIA_PROC_OP_NONE,
+    THALIA_PROC_OP_NONE,
+    THALIA_PROC_OP_NONE,
+    THALIA_PROC_OP(xor_a_n,     2, 2, BYTE, NONE),
+    THALIA_PROC_OP(rst_n,       1, 8, NONE, BRANCH),
 
     // High F
-    case 0xF0: thalia_proc_set_n_d(gb, 6, 0); return;
-    case 0xF1: thalia_proc_set_n_d(gb, 6, 1); return;
-    case 0xF2: thalia_proc_set_n_d(gb, 6, 2); return;
-    case 0xF3: thalia_proc_set_n_d(gb, 6, 3); return;
-    case 0xF4: thalia_proc_set_n_d(gb, 6, 4); return;
-    case 0xF5: thalia_proc_set_n_d(gb, 6, 5); return;
-    case 0xF6: thalia_proc_set_n_d(gb, 6, 6); return;
-    case 0xF7: thalia_proc_set_n_d(gb, 6, 7); return;
-    case 0xF8: thalia_proc_set_n_d(gb, 7, 0); return;
-    case 0xF9: thalia_proc_set_n_d(gb, 7, 1); return;
-    case 0xFA: thalia_proc_set_n_d(gb, 7, 2); return;
-    case 0xFB: thalia_proc_set_n_d(gb, 7, 3); return;
-    case 0xFC: thalia_proc_set_n_d(gb, 7, 4); return;
-    case 0xFD: thalia_proc_set_n_d(gb, 7, 5); return;
-    case 0xFE: thalia_proc_set_n_d(gb, 7, 6); return;
-    case 0xFF: thalia_proc_set_n_d(gb, 7, 7); return;
-
+    THALIA_PROC_OP(ld_a_ff00_n, 2, 3, BYTE, NONE),
+    THALIA_PROC_OP(pop_r,       1, 3, NONE, NONE),
+    THALIA_PROC_OP(ld_a_c,      1, 2, NONE, NONE),
+    THALIA_PROC_OP(di,          1, 1, NONE, NONE),
+    THALIA_PROC_OP_NONE,
+    THALIA_PROC_OP(push_r,      1, 4, NONE, NONE),
+    THALIA_PROC_OP(or_a_n,      2, 2, BYTE, NONE),
+    THALIA_PROC_OP(rst_n,       1, 8, NONE, BRANCH),
+    THALIA_PROC_OP(ld_hl_sp_n,  2, 3, BYTE, NONE),
+    THALIA_PROC_OP(ld_sp_hl,    1, 2, NONE, NONE),
+    THALIA_PROC_OP(ld_a_n,      3, 4, WORD, NONE),
+    THALIA_PROC_OP(ei,          1, 1, NONE, NONE),
+    THALIA_PROC_OP_NONE,
+    THALIA_PROC_OP_NONE,
+    THALIA_PROC_OP(cp_a_n,      2, 2, BYTE, NONE),
+    THALIA_PROC_OP(rst_n,       1, 8, NONE, BRANCH),
+};
+
+// Rows of eight extended opcodes sharing a handler.
+#define THALIA_PROC_OP_ROW(name) \
+    THALIA_PROC_OP(name, 0, 2, NONE, NONE), \
+    THALIA_PROC_OP(name, 0, 2, NONE, NONE), \
+    THALIA_PROC_OP(name, 0, 2, NONE, NONE), \
+    THALIA_PROC_OP(name, 0, 2, NONE, NONE), \
+    THALIA_PROC_OP(name, 0, 2, NONE, NONE), \
+    THALIA_PROC_OP(name, 0, 2, NONE, NONE), \
+    THALIA_PROC_OP(name, 0, 2, NONE, NONE), \
+    THALIA_PROC_OP(name, 0, 2, NONE, NONE)
+
+// Extended opcode table, indexed by the byte following the 0xCB prefix. The
+// prefix entry in the main table already accounts for the instruction length.
+static const thalia_proc_op_t thalia_proc_ops_extended[256] = {
+    THALIA_PROC_OP_ROW(rdc_d),   THALIA_PROC_OP_ROW(rdc_d),   // High 0
+    THALIA_PROC_OP_ROW(rd_d),    THALIA_PROC_OP_ROW(rd_d),    // High 1
+    THALIA_PROC_OP_ROW(sda_d),   THALIA_PROC_OP_ROW(sda_d),   // High 2
+    THALIA_PROC_OP_ROW(swap_d),  THALIA_PROC_OP_ROW(srl_d),   // High 3
+    THALIA_PROC_OP_ROW(bit_n_d), THALIA_PROC_OP_ROW(bit_n_d), // High 4
+    THALIA_PROC_OP_ROW(bit_n_d), THALIA_PROC_OP_ROW(bit_n_d), // High 5
+    THALIA_PROC_OP_ROW(bit_n_d), THALIA_PROC_OP_ROW(bit_n_d), // High 6
+    THALIA_PROC_OP_ROW(bit_n_d), THALIA_PROC_OP_ROW(bit_n_d), // High 7
+    THALIA_PROC_OP_ROW(res_n_d), THALIA_PROC_OP_ROW(res_n_d), // High 8
+    THALIA_PROC_OP_ROW(res_n_d), THALIA_PROC_OP_ROW(res_n_d), // High 9
+    THALIA_PROC_OP_ROW(res_n_d), THALIA_PROC_OP_ROW(res_n_d), // High A
+    THALIA_PROC_OP_ROW(res_n_d), THALIA_PROC_OP_ROW(res_n_d), // High B
+    THALIA_PROC_OP_ROW(set_n_d), THALIA_PROC_OP_ROW(set_n_d), // High C
+    THALIA_PROC_OP_ROW(set_n_d), THALIA_PROC_OP_ROW(set_n_d), // High D
+    THALIA_PROC_OP_ROW(set_n_d), THALIA_PROC_OP_ROW(set_n_d), // High E
+    THALIA_PROC_OP_ROW(set_n_d), THALIA_PROC_OP_ROW(set_n_d), // High F
+};
+
+// Idioms run as a single operation, in the order of thalia_proc_execute_fused.
+// Entry zero stands for no idiom.
+typedef struct {
+    guint8 opcodes[4];
+    guint8 n_insns;
+} thalia_proc_idiom_t;
+
+static const thalia_proc_idiom_t thalia_proc_idioms[] = {
+    { { 0 }, 0 },
+    { { 0x0B, 0x78, 0xB1, 0x20 }, 4 }, // DEC BC; LD A,B; OR C; JR NZ
+    { { 0x1B, 0x7A, 0xB3, 0x20 }, 4 }, // DEC DE; LD A,D; OR E; JR NZ
+    { { 0x2A, 0x12, 0x13 }, 3 },       // LD A,(HL+); LD (DE),A; INC DE
+    { { 0x0A, 0x22, 0x03 }, 3 },       // LD A,(BC); LD (HL+),A; INC BC
+    { { 0x22, 0x05, 0x20 }, 3 },       // LD (HL+),A; DEC B; JR NZ
+    { { 0xAF, 0xE0 }, 2 }              // XOR A; LDH (n),A
+};
+
+// Fetches the immediate operand of the instruction at 'addr'.
+static inline guint16 thalia_proc_fetch_operand(ThaliaGB* gb, guint16 addr,
+                                                thalia_operand_t operand)
+{
+    switch(operand) {
+    case THALIA_OPERAND_BYTE:
+        return thalia_mmu_fetch_byte(gb, addr + 1);
+    case THALIA_OPERAND_WORD:
+        return thalia_mmu_fetch_word(gb, addr + 1);
     default:
-        g_error(
-            "Unhandled extended opcode 0x%02X @ 0x%04X\r\n",
-            opcode,
-            gb->pc
-        );
+        return 0;
     }
 }
 
+// Executes 'opcode' as described by table entry 'op': moves the program
+// counter past the instruction, accounts for the base cycles and runs the
+// handler. When 'op' is a compile time constant, as it is in the threaded
+// interpreter, all of this folds into straight-line code.
+static inline gboolean thalia_proc_execute(ThaliaGB* gb,
+                                           const thalia_proc_op_t* op,
+                                           guint8 opcode, guint16 operand)
+{
+    if(!op->handler) {
+        g_warning("Unhandled opcode 0x%02X @ 0x%04X", opcode, gb->pc);
+        return FALSE;
+    }
+
+    gb->pc += op->length;
+    gb->sched.start = gb->cycles;
+    gb->cycles += op->cycles;
+    op->handler(gb, opcode, operand);
+    return TRUE;
+}
+
+// Executes the extended opcode 'opcode', which followed the prefix.
+static inline void thalia_proc_execute_extended(ThaliaGB* gb, guint8 opcode)
+{
+    const thalia_proc_op_t* op = &thalia_proc_ops_extended[opcode];
+    gb->pc += thalia_proc_ops[THALIA_PROC_PREFIX].length;
+    gb->sched.start = gb->cycles;
+    gb->cycles += thalia_proc_ops[THALIA_PROC_PREFIX].cycles + op->cycles;
+    op->handler(gb, opcode, 0);
+}
+
+// Decodes an extended opcode.
+static inline void thalia_proc_extended(ThaliaGB* gb, guint8 opcode,
+                                        guint16 operand)
+{
+    const thalia_proc_op_t* op = &thalia_proc_ops_extended[operand];
+    gb->cycles += op->cycles;
+    op->handler(gb, operand, 0);
+}
+
 // Decodes a normal opcode.
 gboolean thalia_proc_decode(ThaliaGB* gb, guint8 opcode)
 {
-    // Caution: big ugly switch up ahead.
-    switch(opcode) {
-    // High 0
-    case 0x00: thalia_proc_nop(gb); return TRUE;
-    case 0x01:
-        thalia_proc_ld_r_n(gb, 0, thalia_mmu_immediate_word(gb));
-        return TRUE;
-    case 0x02: thalia_proc_ld_r_a(gb, 0); return TRUE;
-    case 0x03: thalia_proc_inc_r(gb, 0); return TRUE;
-    case 0x04: thalia_proc_inc_d(gb, 0); return TRUE;
-    case 0x05: thalia_proc_dec_d(gb, 0); return TRUE;
-    case 0x06:
-        thalia_proc_ld_d_n(gb, 0, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0x07: thalia_proc_rdca(gb, 0); return TRUE;
-    case 0x08:
-        thalia_proc_ld_n_sp(gb, thalia_mmu_immediate_word(gb));
-        return TRUE;
-    case 0x09: thalia_proc_add_hl_r(gb, 0); return TRUE;
-    case 0x0A: thalia_proc_ld_a_r(gb, 0); return TRUE;
-    case 0x0B: thalia_proc_dec_r(gb, 0); return TRUE;
-    case 0x0C: thalia_proc_inc_d(gb, 1); return TRUE;
-    case 0x0D: thalia_proc_dec_d(gb, 1); return TRUE;
-    case 0x0E:
-        thalia_proc_ld_d_n(gb, 1, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0x0F: thalia_proc_rdca(gb, 1); return TRUE;
+    const thalia_proc_op_t* op = &thalia_proc_ops[opcode];
+    return thalia_proc_execute(
+        gb,
+        op,
+        opcode,
+        thalia_proc_fetch_operand(gb, gb->pc, op->operand)
+    );
+}
 
-    // High 1
-    case 0x10: thalia_proc_stop(gb); return TRUE;
-    case 0x11:
-        thalia_proc_ld_r_n(gb, 1, thalia_mmu_immediate_word(gb));
-        return TRUE;
-    case 0x12: thalia_proc_ld_r_a(gb, 1); return TRUE;
-    case 0x13: thalia_proc_inc_r(gb, 1); return TRUE;
-    case 0x14: thalia_proc_inc_d(gb, 2); return TRUE;
-    case 0x15: thalia_proc_dec_d(gb, 2); return TRUE;
-    case 0x16:
-        thalia_proc_ld_d_n(gb, 2, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0x17: thalia_proc_rda(gb, 0); return TRUE;
-    case 0x18:
-        thalia_proc_jr_n(gb, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0x19: thalia_proc_add_hl_r(gb, 1); return TRUE;
-    case 0x1A: thalia_proc_ld_a_r(gb, 1); return TRUE;
-    case 0x1B: thalia_proc_dec_r(gb, 1); return TRUE;
-    case 0x1C: thalia_proc_inc_d(gb, 3); return TRUE;
-    case 0x1D: thalia_proc_dec_d(gb, 3); return TRUE;
-    case 0x1E:
-        thalia_proc_ld_d_n(gb, 3, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0x1F: thalia_proc_rda(gb, 1); return TRUE;
+// Tells whether 'opcode' ends a block, as it may change the flow of control.
+gboolean thalia_proc_ends_block(guint16 opcode)
+{
+    if(opcode & THALIA_PROC_EXTENDED)
+        return FALSE;
+    return thalia_proc_ops[opcode].flags & THALIA_PROC_FLAG_BRANCH;
+}
 
-    // High 2
-    case 0x20:
-        thalia_proc_jr_f_n(gb, 0, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0x21:
-        thalia_proc_ld_r_n(gb, 2, thalia_mmu_immediate_word(gb));
-        return TRUE;
-    case 0x22: thalia_proc_ldo_hl_a(gb, 0); return TRUE;
-    case 0x23: thalia_proc_inc_r(gb, 2); return TRUE;
-    case 0x24: thalia_proc_inc_d(gb, 4); return TRUE;
-    case 0x25: thalia_proc_dec_d(gb, 4); return TRUE;
-    case 0x26:
-        thalia_proc_ld_d_n(gb, 4, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0x27: thalia_proc_daa(gb); return TRUE;
-    case 0x28:
-        thalia_proc_jr_f_n(gb, 1, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0x29: thalia_proc_add_hl_r(gb, 2); return TRUE;
-    case 0x2A: thalia_proc_ldo_a_hl(gb, 0); return TRUE;
-    case 0x2B: thalia_proc_dec_r(gb, 2); return TRUE;
-    case 0x2C: thalia_proc_inc_d(gb, 5); return TRUE;
-    case 0x2D: thalia_proc_dec_d(gb, 5); return TRUE;
-    case 0x2E:
-        thalia_proc_ld_d_n(gb, 5, thalia_mmu_immediate_byte(gb));
+// Executes the pre-decoded instruction 'insn'.
+static inline gboolean thalia_proc_execute_insn(ThaliaGB* gb,
+                                                const thalia_proc_insn_t* insn)
+{
+    if(insn->opcode & THALIA_PROC_EXTENDED) {
+        thalia_proc_execute_extended(gb, insn->opcode);
         return TRUE;
-    case 0x2F: thalia_proc_cpl(gb); return TRUE;
+    }
+    return thalia_proc_execute(
+        gb,
+        &thalia_proc_ops[insn->opcode],
+        insn->opcode,
+        insn->operand
+    );
+}
 
-    // High 3
-    case 0x30:
-        thalia_proc_jr_f_n(gb, 2, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0x31:
-        thalia_proc_ld_r_n(gb, 3, thalia_mmu_immediate_word(gb));
-        return TRUE;
-    case 0x32: thalia_proc_ldo_hl_a(gb, 1); return TRUE;
-    case 0x33: thalia_proc_inc_r(gb, 3); return TRUE;
-    case 0x34: thalia_proc_inc_d(gb, 6); return TRUE;
-    case 0x35: thalia_proc_dec_d(gb, 6); return TRUE;
-    case 0x36:
-        thalia_proc_ld_d_n(gb, 6, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0x37: thalia_proc_scf(gb); return TRUE;
-    case 0x38:
-        thalia_proc_jr_f_n(gb, 3, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0x39: thalia_proc_add_hl_r(gb, 3); return TRUE;
-    case 0x3A: thalia_proc_ldo_a_hl(gb, 1); return TRUE;
-    case 0x3B: thalia_proc_dec_r(gb, 3); return TRUE;
-    case 0x3C: thalia_proc_inc_d(gb, 7); return TRUE;
-    case 0x3D: thalia_proc_dec_d(gb, 7); return TRUE;
-    case 0x3E:
-        thalia_proc_ld_d_n(gb, 7, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0x3F: thalia_proc_ccf(gb); return TRUE;
+// Runs the instruction at index 'i' of a fused idiom, which has 'opcode'.
+#define THALIA_PROC_FUSED_RUN(i, opcode) \
+    thalia_proc_execute(gb, &thalia_proc_ops[opcode], opcode, insn[i].operand)
+
+// Stops a fused idiom after its instruction at index 'i' wrote to memory, if
+// that made an event due or changed code. The rest is run opcode by opcode.
+#define THALIA_PROC_FUSED_WRITTEN(i) \
+    if(THALIA_SCHED_DUE(gb) || gb->cache.stale) \
+        return (i) + 1
+
+// Runs the instructions of the idiom starting at 'insn' in one go, without
+// checking for events in between. Returns the number of instructions run.
+static inline guint8 thalia_proc_execute_idiom(ThaliaGB* gb,
+                                               const thalia_proc_insn_t* insn)
+{
+    switch(insn->fused) {
+    case 1:
+        THALIA_PROC_FUSED_RUN(0, 0x0B);
+        THALIA_PROC_FUSED_RUN(1, 0x78);
+        THALIA_PROC_FUSED_RUN(2, 0xB1);
+        THALIA_PROC_FUSED_RUN(3, 0x20);
+        return 4;
+    case 2:
+        THALIA_PROC_FUSED_RUN(0, 0x1B);
+        THALIA_PROC_FUSED_RUN(1, 0x7A);
+        THALIA_PROC_FUSED_RUN(2, 0xB3);
+        THALIA_PROC_FUSED_RUN(3, 0x20);
+        return 4;
+    case 3:
+        THALIA_PROC_FUSED_RUN(0, 0x2A);
+        THALIA_PROC_FUSED_RUN(1, 0x12);
+        THALIA_PROC_FUSED_WRITTEN(1);
+        THALIA_PROC_FUSED_RUN(2, 0x13);
+        return 3;
+    case 4:
+        THALIA_PROC_FUSED_RUN(0, 0x0A);
+        THALIA_PROC_FUSED_RUN(1, 0x22);
+        THALIA_PROC_FUSED_WRITTEN(1);
+        THALIA_PROC_FUSED_RUN(2, 0x03);
+        return 3;
+    case 5:
+        THALIA_PROC_FUSED_RUN(0, 0x22);
+        THALIA_PROC_FUSED_WRITTEN(0);
+        THALIA_PROC_FUSED_RUN(1, 0x05);
+        THALIA_PROC_FUSED_RUN(2, 0x20);
+        return 3;
+    default:
+        THALIA_PROC_FUSED_RUN(0, 0xAF);
+        THALIA_PROC_FUSED_RUN(1, 0xE0);
+        return 2;
+    }
+}
 
-    // High 4
-    case 0x40: thalia_proc_ld_d_d(gb, 0, 0); return TRUE;
-    case 0x41: thalia_proc_ld_d_d(gb, 0, 1); return TRUE;
-    case 0x42: thalia_proc_ld_d_d(gb, 0, 2); return TRUE;
-    case 0x43: thalia_proc_ld_d_d(gb, 0, 3); return TRUE;
-    case 0x44: thalia_proc_ld_d_d(gb, 0, 4); return TRUE;
-    case 0x45: thalia_proc_ld_d_d(gb, 0, 5); return TRUE;
-    case 0x46: thalia_proc_ld_d_d(gb, 0, 6); return TRUE;
-    case 0x47: thalia_proc_ld_d_d(gb, 0, 7); return TRUE;
-    case 0x48: thalia_proc_ld_d_d(gb, 1, 0); return TRUE;
-    case 0x49: thalia_proc_ld_d_d(gb, 1, 1); return TRUE;
-    case 0x4A: thalia_proc_ld_d_d(gb, 1, 2); return TRUE;
-    case 0x4B: thalia_proc_ld_d_d(gb, 1, 3); return TRUE;
-    case 0x4C: thalia_proc_ld_d_d(gb, 1, 4); return TRUE;
-    case 0x4D: thalia_proc_ld_d_d(gb, 1, 5); return TRUE;
-    case 0x4E: thalia_proc_ld_d_d(gb, 1, 6); return TRUE;
-    case 0x4F: thalia_proc_ld_d_d(gb, 1, 7); return TRUE;
+// Runs the idiom starting at 'insn' as a single operation, when no event is
+// due before its last instruction is done. An idiom making up a whole loop is
+// run again for as long as it jumps back and no event is due. Returns the
+// number of instructions run in the last go, or zero if the idiom has to be
+// run opcode by opcode.
+static inline guint8 thalia_proc_execute_fused(ThaliaGB* gb,
+                                               const thalia_proc_insn_t* insn)
+{
+    const thalia_proc_idiom_t* idiom = &thalia_proc_idioms[insn->fused];
+    guint32 cycles = 0;
+    guint8 i, n;
 
-    // High 5
-    case 0x50: thalia_proc_ld_d_d(gb, 2, 0); return TRUE;
-    case 0x51: thalia_proc_ld_d_d(gb, 2, 1); return TRUE;
-    case 0x52: thalia_proc_ld_d_d(gb, 2, 2); return TRUE;
-    case 0x53: thalia_proc_ld_d_d(gb, 2, 3); return TRUE;
-    case 0x54: thalia_proc_ld_d_d(gb, 2, 4); return TRUE;
-    case 0x55: thalia_proc_ld_d_d(gb, 2, 5); return TRUE;
-    case 0x56: thalia_proc_ld_d_d(gb, 2, 6); return TRUE;
-    case 0x57: thalia_proc_ld_d_d(gb, 2, 7); return TRUE;
-    case 0x58: thalia_proc_ld_d_d(gb, 3, 0); return TRUE;
-    case 0x59: thalia_proc_ld_d_d(gb, 3, 1); return TRUE;
-    case 0x5A: thalia_proc_ld_d_d(gb, 3, 2); return TRUE;
-    case 0x5B: thalia_proc_ld_d_d(gb, 3, 3); return TRUE;
-    case 0x5C: thalia_proc_ld_d_d(gb, 3, 4); return TRUE;
-    case 0x5D: thalia_proc_ld_d_d(gb, 3, 5); return TRUE;
-    case 0x5E: thalia_proc_ld_d_d(gb, 3, 6); return TRUE;
-    case 0x5F: thalia_proc_ld_d_d(gb, 3, 7); return TRUE;
+    for(i = 0; i < idiom->n_insns; i++)
+        cycles += thalia_proc_ops[idiom->opcodes[i]].cycles;
+    if(gb->cycles + cycles >= gb->sched.next) {
+        gb->cache.fused_misses++;
+        return 0;
+    }
 
-    // High 6
-    case 0x60: thalia_proc_ld_d_d(gb, 4, 0); return TRUE;
-    case 0x61: thalia_proc_ld_d_d(gb, 4, 1); return TRUE;
-    case 0x62: thalia_proc_ld_d_d(gb, 4, 2); return TRUE;
-    case 0x63: thalia_proc_ld_d_d(gb, 4, 3); return TRUE;
-    case 0x64: thalia_proc_ld_d_d(gb, 4, 4); return TRUE;
-    case 0x65: thalia_proc_ld_d_d(gb, 4, 5); return TRUE;
-    case 0x66: thalia_proc_ld_d_d(gb, 4, 6); return TRUE;
-    case 0x67: thalia_proc_ld_d_d(gb, 4, 7); return TRUE;
-    case 0x68: thalia_proc_ld_d_d(gb, 5, 0); return TRUE;
-    case 0x69: thalia_proc_ld_d_d(gb, 5, 1); return TRUE;
-    case 0x6A: thalia_proc_ld_d_d(gb, 5, 2); return TRUE;
-    case 0x6B: thalia_proc_ld_d_d(gb, 5, 3); return TRUE;
-    case 0x6C: thalia_proc_ld_d_d(gb, 5, 4); return TRUE;
-    case 0x6D: thalia_proc_ld_d_d(gb, 5, 5); return TRUE;
-    case 0x6E: thalia_proc_ld_d_d(gb, 5, 6); return TRUE;
-    case 0x6F: thalia_proc_ld_d_d(gb, 5, 7); return TRUE;
+    do {
+        gb->cache.fused_hits++;
+        n = thalia_proc_execute_idiom(gb, insn);
+    } while(n == idiom->n_insns && gb->pc == insn->pc &&
+            gb->cycles + cycles < gb->sched.next && !gb->cache.stale);
+    return n;
+}
 
-    // High 7
-    case 0x70: thalia_proc_ld_d_d(gb, 6, 0); return TRUE;
-    case 0x71: thalia_proc_ld_d_d(gb, 6, 1); return TRUE;
-    case 0x72: thalia_proc_ld_d_d(gb, 6, 2); return TRUE;
-    case 0x73: thalia_proc_ld_d_d(gb, 6, 3); return TRUE;
-    case 0x74: thalia_proc_ld_d_d(gb, 6, 4); return TRUE;
-    case 0x75: thalia_proc_ld_d_d(gb, 6, 5); return TRUE;
-    case 0x76: thalia_proc_halt(gb); return TRUE;
-    case 0x77: thalia_proc_ld_d_d(gb, 6, 7); return TRUE;
-    case 0x78: thalia_proc_ld_d_d(gb, 7, 0); return TRUE;
-    case 0x79: thalia_proc_ld_d_d(gb, 7, 1); return TRUE;
-    case 0x7A: thalia_proc_ld_d_d(gb, 7, 2); return TRUE;
-    case 0x7B: thalia_proc_ld_d_d(gb, 7, 3); return TRUE;
-    case 0x7C: thalia_proc_ld_d_d(gb, 7, 4); return TRUE;
-    case 0x7D: thalia_proc_ld_d_d(gb, 7, 5); return TRUE;
-    case 0x7E: thalia_proc_ld_d_d(gb, 7, 6); return TRUE;
-    case 0x7F: thalia_proc_ld_d_d(gb, 7, 7); return TRUE;
+// Returns the handler for 'opcode', which has THALIA_PROC_EXTENDED set for
+// extended opcodes, and stores its total length and base cycle count.
+gpointer thalia_proc_describe(guint16 opcode, guint8* length, guint8* cycles)
+{
+    const thalia_proc_op_t* op = &thalia_proc_ops[opcode & 0xFF];
+    *length = op->length;
+    *cycles = op->cycles;
 
-    // High 8
-    case 0x80: thalia_proc_add_a_d(gb, 0); return TRUE;
-    case 0x81: thalia_proc_add_a_d(gb, 1); return TRUE;
-    case 0x82: thalia_proc_add_a_d(gb, 2); return TRUE;
-    case 0x83: thalia_proc_add_a_d(gb, 3); return TRUE;
-    case 0x84: thalia_proc_add_a_d(gb, 4); return TRUE;
-    case 0x85: thalia_proc_add_a_d(gb, 5); return TRUE;
-    case 0x86: thalia_proc_add_a_d(gb, 6); return TRUE;
-    case 0x87: thalia_proc_add_a_d(gb, 7); return TRUE;
-    case 0x88: thalia_proc_adc_a_d(gb, 0); return TRUE;
-    case 0x89: thalia_proc_adc_a_d(gb, 1); return TRUE;
-    case 0x8A: thalia_proc_adc_a_d(gb, 2); return TRUE;
-    case 0x8B: thalia_proc_adc_a_d(gb, 3); return TRUE;
-    case 0x8C: thalia_proc_adc_a_d(gb, 4); return TRUE;
-    case 0x8D: thalia_proc_adc_a_d(gb, 5); return TRUE;
-    case 0x8E: thalia_proc_adc_a_d(gb, 6); return TRUE;
-    case 0x8F: thalia_proc_adc_a_d(gb, 7); return TRUE;
+    if(opcode & THALIA_PROC_EXTENDED) {
+        op = &thalia_proc_ops_extended[opcode & 0xFF];
+        *length = thalia_proc_ops[THALIA_PROC_PREFIX].length;
+        *cycles = thalia_proc_ops[THALIA_PROC_PREFIX].cycles + op->cycles;
+    }
+    return op->handler;
+}
+
+// Returns the end of the cacheable region holding 'addr', or zero if code at
+// 'addr' should not be cached. ROM is only ever changed by switching banks,
+// internal and zero-page RAM are watched for writes. Anything else (video
+// and external RAM, echo RAM and I/O) is decoded afresh every time.
+static inline guint32 thalia_proc_cache_limit(guint16 addr)
+{
+    if(addr < 0x4000)
+        return 0x4000;
+    if(addr < 0x8000)
+        return 0x8000;
+    if(addr >= 0xC000 && addr < 0xE000)
+        return 0xE000;
+    if(addr >= 0xFF80 && addr < 0xFFFF)
+        return 0xFFFF;
+    return 0;
+}
+
+// Tells whether a polling loop may read 'addr'. Reading has to be free of side
+// effects, and the value read may only change when an event is handled: LY
+// and STAT are updated by the GPU, RAM is written by interrupt handlers.
+static inline gboolean thalia_proc_cache_idle_read(guint16 addr)
+{
+    return addr == 0xFF41 || addr == 0xFF44 ||
+           (addr >= 0xC000 && addr < 0xE000) ||
+           (addr >= 0xFF80 && addr < 0xFFFF);
+}
+
+// Tells whether 'block' is a polling loop that does nothing but wait: it reads
+// the LCD status or a flag in RAM, tests the value read and jumps back to its
+// start. Such a loop only writes A and the flags, as a function of the value
+// read and of registers it leaves alone, so every run of it is the same until
+// the value read changes.
+static gboolean thalia_proc_cache_idle(const thalia_proc_block_t* block)
+{
+    const thalia_proc_insn_t* insn;
+    const thalia_proc_insn_t* last = &block->insns[block->n_insns - 1];
+    guint16 target;
+
+    for(insn = block->insns; insn < last; insn++) {
+        switch(insn->opcode) {
+        case 0xF0:
+            // LDH A,(n)
+            if(!thalia_proc_cache_idle_read(0xFF00 | insn->operand))
+                return FALSE;
+            break;
+        case 0xFA:
+            // LD A,(nn)
+            if(!thalia_proc_cache_idle_read(insn->operand))
+                return FALSE;
+            break;
+        case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+            // AND, XOR, OR and CP with an immediate
+            break;
+        default:
+            // AND, XOR, OR and CP with a register, BIT on A
+            if((insn->opcode & 0xE0) == 0xA0 &&
+               (insn->opcode & 0x07) != THALIA_REG_IHL)
+                break;
+            if((insn->opcode & 0x1C7) == (THALIA_PROC_EXTENDED | 0x47))
+                break;
+            return FALSE;
+        }
+    }
 
-    // High 9
-    case 0x90: thalia_proc_sub_a_d(gb, 0); return TRUE;
-    case 0x91: thalia_proc_sub_a_d(gb, 1); return TRUE;
-    case 0x92: thalia_proc_sub_a_d(gb, 2); return TRUE;
-    case 0x93: thalia_proc_sub_a_d(gb, 3); return TRUE;
-    case 0x94: thalia_proc_sub_a_d(gb, 4); return TRUE;
-    case 0x95: thalia_proc_sub_a_d(gb, 5); return TRUE;
-    case 0x96: thalia_proc_sub_a_d(gb, 6); return TRUE;
-    case 0x97: thalia_proc_sub_a_d(gb, 7); return TRUE;
-    case 0x98: thalia_proc_sbc_a_d(gb, 0); return TRUE;
-    case 0x99: thalia_proc_sbc_a_d(gb, 1); return TRUE;
-    case 0x9A: thalia_proc_sbc_a_d(gb, 2); return TRUE;
-    case 0x9B: thalia_proc_sbc_a_d(gb, 3); return TRUE;
-    case 0x9C: thalia_proc_sbc_a_d(gb, 4); return TRUE;
-    case 0x9D: thalia_proc_sbc_a_d(gb, 5); return TRUE;
-    case 0x9E: thalia_proc_sbc_a_d(gb, 6); return TRUE;
-    case 0x9F: thalia_proc_sbc_a_d(gb, 7); return TRUE;
+    switch(last->opcode) {
+    case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+        // JR
+        target = last->pc + 2 + (gint8) last->operand;
+        break;
+    case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA:
+        // JP
+        target = last->operand;
+        break;
+    default:
+        return FALSE;
+    }
+    return target == block->pc;
+}
+
+// Marks the instructions in 'block' that start an idiom run as a single
+// operation. Idioms do not reach beyond the end of the block.
+static void thalia_proc_cache_fuse(thalia_proc_block_t* block)
+{
+    const thalia_proc_idiom_t* idiom;
+    guint8 i, j, k;
+
+    for(i = 0; i < block->n_insns; i++)
+        for(k = 1; k < G_N_ELEMENTS(thalia_proc_idioms); k++) {
+            idiom = &thalia_proc_idioms[k];
+            if(i + idiom->n_insns > block->n_insns)
+                continue;
+            for(j = 0; j < idiom->n_insns; j++)
+                if(block->insns[i + j].opcode != idiom->opcodes[j])
+                    break;
+            if(j == idiom->n_insns) {
+                block->insns[i].fused = k;
+                block->insns[i].dispatch = THALIA_PROC_FUSED;
+                break;
+            }
+        }
+}
+
+// Decodes at most 'max' instructions starting at 'addr' into 'block', without
+// reading beyond 'limit'. Decoding stops after the first instruction that may
+// change the flow of control, so every block runs from top to bottom. Returns
+// the address following the last instruction decoded.
+static guint32 thalia_proc_cache_decode(ThaliaGB* gb,
+                                        thalia_proc_block_t* block,
+                                        guint32 addr, guint32 limit,
+                                        guint8 max)
+{
+    const thalia_proc_op_t* op;
+    thalia_proc_insn_t* insn;
+
+    block->code = NULL;
+    block->hits = 0;
+    for(block->n_insns = 0; block->n_insns < max; addr += op->length) {
+        guint8 opcode = thalia_mmu_fetch_byte(gb, addr);
+        op = &thalia_proc_ops[opcode];
+        if(addr + op->length > limit)
+            break;
+
+        insn = &block->insns[block->n_insns++];
+        insn->pc = addr;
+        insn->opcode = opcode;
+        insn->operand = thalia_proc_fetch_operand(gb, addr, op->operand);
+        if(opcode == THALIA_PROC_PREFIX)
+            insn->opcode = THALIA_PROC_EXTENDED | insn->operand;
+        insn->dispatch = insn->opcode;
+        insn->fused = 0;
+
+        if(op->flags & THALIA_PROC_FLAG_BRANCH) {
+            addr += op->length;
+            break;
+        }
+    }
 
-    // High A
-    case 0xA0: thalia_proc_and_a_d(gb, 0); return TRUE;
-    case 0xA1: thalia_proc_and_a_d(gb, 1); return TRUE;
-    case 0xA2: thalia_proc_and_a_d(gb, 2); return TRUE;
-    case 0xA3: thalia_proc_and_a_d(gb, 3); return TRUE;
-    case 0xA4: thalia_proc_and_a_d(gb, 4); return TRUE;
-    case 0xA5: thalia_proc_and_a_d(gb, 5); return TRUE;
-    case 0xA6: thalia_proc_and_a_d(gb, 6); return TRUE;
-    case 0xA7: thalia_proc_and_a_d(gb, 7); return TRUE;
-    case 0xA8: thalia_proc_xor_a_d(gb, 0); return TRUE;
-    case 0xA9: thalia_proc_xor_a_d(gb, 1); return TRUE;
-    case 0xAA: thalia_proc_xor_a_d(gb, 2); return TRUE;
-    case 0xAB: thalia_proc_xor_a_d(gb, 3); return TRUE;
-    case 0xAC: thalia_proc_xor_a_d(gb, 4); return TRUE;
-    case 0xAD: thalia_proc_xor_a_d(gb, 5); return TRUE;
-    case 0xAE: thalia_proc_xor_a_d(gb, 6); return TRUE;
-    case 0xAF: thalia_proc_xor_a_d(gb, 7); return TRUE;
+    block->idle = block->n_insns && thalia_proc_cache_idle(block);
+    thalia_proc_cache_fuse(block);
+    return addr;
+}
 
-    // High B
-    case 0xB0: thalia_proc_or_a_d(gb, 0); return TRUE;
-    case 0xB1: thalia_proc_or_a_d(gb, 1); return TRUE;
-    case 0xB2: thalia_proc_or_a_d(gb, 2); return TRUE;
-    case 0xB3: thalia_proc_or_a_d(gb, 3); return TRUE;
-    case 0xB4: thalia_proc_or_a_d(gb, 4); return TRUE;
-    case 0xB5: thalia_proc_or_a_d(gb, 5); return TRUE;
-    case 0xB6: thalia_proc_or_a_d(gb, 6); return TRUE;
-    case 0xB7: thalia_proc_or_a_d(gb, 7); return TRUE;
-    case 0xB8: thalia_proc_cp_a_d(gb, 0); return TRUE;
-    case 0xB9: thalia_proc_cp_a_d(gb, 1); return TRUE;
-    case 0xBA: thalia_proc_cp_a_d(gb, 2); return TRUE;
-    case 0xBB: thalia_proc_cp_a_d(gb, 3); return TRUE;
-    case 0xBC: thalia_proc_cp_a_d(gb, 4); return TRUE;
-    case 0xBD: thalia_proc_cp_a_d(gb, 5); return TRUE;
-    case 0xBE: thalia_proc_cp_a_d(gb, 6); return TRUE;
-    case 0xBF: thalia_proc_cp_a_d(gb, 7); return TRUE;
+// Skips the runs of polling loop 'block' that are bound to go the same way as
+// the last one, which is when no event was handled since it started. Nothing
+// the loop reads changes before the next event, so the cycle count is moved
+// ahead by as many whole runs as fit in before it.
+static void thalia_proc_cache_skip_idle(ThaliaGB* gb,
+                                        thalia_proc_block_t* block)
+{
+    thalia_proc_cache_t* cache = &gb->cache;
+    guint64 length = gb->cycles - cache->idle_since;
+    guint64 runs;
 
-    // High C
-    case 0xC0: thalia_proc_ret_f(gb, 0); return TRUE;
-    case 0xC1: thalia_proc_pop_r(gb, 0); return TRUE;
-    case 0xC2:
-        thalia_proc_jp_f_n(gb, 0, thalia_mmu_immediate_word(gb));
-        return TRUE;
-    case 0xC3:
-        thalia_proc_jp_n(gb, thalia_mmu_immediate_word(gb));
-        return TRUE;
-    case 0xC4:
-        thalia_proc_call_f_n(gb, 0, thalia_mmu_immediate_word(gb));
-        return TRUE;
-    case 0xC5: thalia_proc_push_r(gb, 0); return TRUE;
-    case 0xC6:
-        thalia_proc_add_a_n(gb, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0xC7: thalia_proc_rst_n(gb, 0); return TRUE;
-    case 0xC8: thalia_proc_ret_f(gb, 1); return TRUE;
-    case 0xC9: thalia_proc_ret(gb, 0); return TRUE;
-    case 0xCA:
-        thalia_proc_jp_f_n(gb, 1, thalia_mmu_immediate_word(gb));
-        return TRUE;
-    case 0xCC:
-        thalia_proc_call_f_n(gb, 1, thalia_mmu_immediate_word(gb));
-        return TRUE;
-    case 0xCB: // Extended opcode
-        thalia_proc_decode_extended(gb, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0xCD:
-        thalia_proc_call_n(gb, thalia_mmu_immediate_word(gb));
-        return TRUE;
-    case 0xCE:
-        thalia_proc_adc_a_n(gb, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0xCF: thalia_proc_rst_n(gb, 1); return TRUE;
+    if(cache->idle == block && gb->sched.last <= cache->idle_since &&
+       length && gb->sched.next != THALIA_SCHED_NEVER &&
+       gb->sched.next > gb->cycles) {
+        runs = (gb->sched.next - gb->cycles - 1) / length;
+        gb->cycles += runs * length;
+        cache->idle_skipped += runs * length;
+    }
 
-    // High D
-    case 0xD0: thalia_proc_ret_f(gb, 2); return TRUE;
-    case 0xD1: thalia_proc_pop_r(gb, 1); return TRUE;
-    case 0xD2:
-        thalia_proc_jp_f_n(gb, 2, thalia_mmu_immediate_word(gb));
-        return TRUE;
-    case 0xD4:
-        thalia_proc_call_f_n(gb, 2, thalia_mmu_immediate_word(gb));
-        return TRUE;
-    case 0xD5: thalia_proc_push_r(gb, 1); return TRUE;
-    case 0xD6:
-        thalia_proc_sub_a_n(gb, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0xD7: thalia_proc_rst_n(gb, 2); return TRUE;
-    case 0xD8: thalia_proc_ret_f(gb, 3); return TRUE;
-    case 0xD9: thalia_proc_ret(gb, 1); return TRUE;
-    case 0xDA:
-        thalia_proc_jp_f_n(gb, 3, thalia_mmu_immediate_word(gb));
-        return TRUE;
-    case 0xDC:
-        thalia_proc_call_f_n(gb, 3, thalia_mmu_immediate_word(gb));
-        return TRUE;
-    case 0xDE:
-        thalia_proc_sbc_a_n(gb, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0xDF: thalia_proc_rst_n(gb, 3); return TRUE;
+    cache->idle = block;
+    cache->idle_since = gb->cycles;
+}
+
+// Returns the decoded block starting at the program counter, decoding it first
+// if it is not in the cache yet.
+static thalia_proc_block_t* thalia_proc_cache_lookup(ThaliaGB* gb)
+{
+    thalia_proc_cache_t* cache = &gb->cache;
+    thalia_proc_block_t* block;
+    guint16 pc = gb->pc;
+    guint16 bank = pc < 0x4000 ? gb->mmu.mbc.rom_bank0 :
+                   pc < 0x8000 ? gb->mmu.mbc.rom_bank : 0;
+    guint32 limit = thalia_proc_cache_limit(pc);
+    guint32 line, last;
+
+    // The last slot is scratch space for code that is not cached.
+    if(G_UNLIKELY(!cache->blocks))
+        cache->blocks = g_new0(thalia_proc_block_t, THALIA_PROC_CACHE_SIZE + 1);
+    cache->stale = FALSE;
+
+    block = &cache->blocks[(pc ^ bank << 7) & (THALIA_PROC_CACHE_SIZE - 1)];
+    if(limit && (!block->n_insns || block->pc != pc || block->bank != bank ||
+                 (pc >= 0x8000 && block->generation != cache->generation))) {
+        block->pc = pc;
+        block->bank = bank;
+        block->generation = cache->generation;
+        last = thalia_proc_cache_decode(
+            gb, block, pc, limit, THALIA_PROC_BLOCK_SIZE) - 1;
+
+        // Remember which lines of RAM hold code, so writes can be caught.
+        if(pc >= 0x8000 && block->n_insns)
+            for(line = pc >> 6; line <= last >> 6; line++) {
+                cache->code_lines[line >> 3] |= 1 << (line & 7);
+                thalia_mmu_protect(gb, line << 6);
+            }
+
+        // Code in ROM may have been translated ahead of time.
+        if(pc < 0x8000)
+            block->code = thalia_aot_lookup(gb, bank, pc);
+    }
 
-    // High E
-    case 0xE0:
-        thalia_proc_ld_ff00_n_a(gb, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0xE1: thalia_proc_pop_r(gb, 2); return TRUE;
-    case 0xE2: thalia_proc_ld_c_a(gb); return TRUE;
-    case 0xE5: thalia_proc_push_r(gb, 2); return TRUE;
-    case 0xE6:
-        thalia_proc_and_a_n(gb, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0xE7: thalia_proc_rst_n(gb, 4); return TRUE;
-    case 0xE8:
-        thalia_proc_add_sp_n(gb, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0xE9: thalia_proc_jp_hl(gb); return TRUE;
-    case 0xEA:
-        thalia_proc_ld_n_a(gb, thalia_mmu_immediate_word(gb));
-        return TRUE;
-    case 0xEE:
-        thalia_proc_xor_a_n(gb, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0xEF: thalia_proc_rst_n(gb, 5); return TRUE;
+    // Instructions crossing the end of a region are not cached either.
+    if(!limit || !block->n_insns) {
+        block = &cache->blocks[THALIA_PROC_CACHE_SIZE];
+        thalia_proc_cache_decode(gb, block, pc, G_MAXUINT32, 1);
+    }
 
-    // High F
-    case 0xF0:
-        thalia_proc_ld_a_ff00_n(gb, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0xF1: thalia_proc_pop_r(gb, 3); return TRUE;
-    case 0xF2: thalia_proc_ld_a_c(gb); return TRUE;
-    case 0xF3: thalia_proc_di(gb); return TRUE;
-    case 0xF5: thalia_proc_push_r(gb, 3); return TRUE;
-    case 0xF6:
-        thalia_proc_or_a_n(gb, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0xF7: thalia_proc_rst_n(gb, 6); return TRUE;
-    case 0xF8:
-        thalia_proc_ld_hl_sp_n(gb, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0xF9: thalia_proc_ld_sp_hl(gb); return TRUE;
-    case 0xFA:
-        thalia_proc_ld_a_n(gb, thalia_mmu_immediate_word(gb));
-        return TRUE;
-    case 0xFB: thalia_proc_ei(gb); return TRUE;
-    case 0xFE:
-        thalia_proc_cp_a_n(gb, thalia_mmu_immediate_byte(gb));
-        return TRUE;
-    case 0xFF: thalia_proc_rst_n(gb, 7); return TRUE;
+    if(G_UNLIKELY(block->idle))
+        thalia_proc_cache_skip_idle(gb, block);
+    else
+        cache->idle = NULL;
+    return block;
+}
 
-    default:
-        g_error("Unhandled opcode 0x%02X @ 0x%04X\r\n", opcode, gb->pc);
-        return FALSE;
+// Flushes all blocks decoded from RAM if 'addr' is on a line holding any.
+// Called on writes to zero-page RAM and to pages of internal RAM holding code.
+void thalia_proc_cache_invalidate(ThaliaGB* gb, guint16 addr)
+{
+    thalia_proc_cache_t* cache = &gb->cache;
+    if(!(cache->code_lines[addr >> 9] & 1 << ((addr >> 6) & 7)))
+        return;
+
+    memset(cache->code_lines, 0, sizeof(cache->code_lines));
+    cache->generation++;
+    cache->stale = TRUE;
+    thalia_mmu_map_ram(gb);
+}
+
+// Makes sure the running block is not continued, e.g. after a bank switch.
+void thalia_proc_cache_mark_stale(ThaliaGB* gb)
+{
+    gb->cache.stale = TRUE;
+}
+
+
+// Selects how 'gb' executes opcodes from here on. The JIT modes are only
+// available on x86-64, the AOT mode only for ROMs translated beforehand.
+// Elsewhere the interpreter is kept.
+void thalia_proc_set_mode(ThaliaGB* gb, thalia_proc_mode_t mode)
+{
+    if(mode == THALIA_PROC_MODE_AOT && !gb->aot.module) {
+        g_warning("ROM has not been translated, using the interpreter");
+        mode = THALIA_PROC_MODE_INTERPRETER;
+    } else if((mode == THALIA_PROC_MODE_JIT ||
+               mode == THALIA_PROC_MODE_LOCKSTEP) &&
+              !thalia_jit_available(gb)) {
+        g_warning("JIT not available, using the interpreter");
+        mode = THALIA_PROC_MODE_INTERPRETER;
+    }
+    gb->mode = mode;
+}
+
+// Runs the instructions in 'block' one by one, for as long as control stays
+// inside it. Returns FALSE on an unhandled opcode.
+static gboolean thalia_proc_interpret(ThaliaGB* gb,
+                                      const thalia_proc_block_t* block)
+{
+    const thalia_proc_insn_t* insn = block->insns;
+    const thalia_proc_insn_t* end = block->insns + block->n_insns;
+    guint8 n;
+
+    while(TRUE) {
+        n = insn->fused ? thalia_proc_execute_fused(gb, insn) : 0;
+        if(!n) {
+            if(!thalia_proc_execute_insn(gb, insn))
+                return FALSE;
+            n = 1;
+        }
+        if(THALIA_SCHED_DUE(gb))
+            thalia_gb_step(gb);
+        insn += n;
+        if(insn == end || insn->pc != gb->pc || gb->cache.stale)
+            return TRUE;
+    }
+}
+
+// Runs blocks that have native code as such, interpreting the others. In JIT
+// mode, blocks are compiled once they have run often enough. Returns FALSE on
+// an unhandled opcode, TRUE when the mode is changed or the run ends.
+static gboolean thalia_proc_run_native(ThaliaGB* gb)
+{
+    thalia_proc_mode_t mode = gb->mode;
+    thalia_proc_block_t* block;
+
+    while(gb->mode == mode && !gb->run.ended) {
+        block = thalia_proc_cache_lookup(gb);
+        if(!block->code && mode == THALIA_PROC_MODE_JIT &&
+           ++block->hits == THALIA_JIT_THRESHOLD &&
+           block != &gb->cache.blocks[THALIA_PROC_CACHE_SIZE])
+            block->code = thalia_jit_compile(gb, block);
+
+        if(block->code)
+            thalia_jit_run(gb, block->code);
+        else if(!thalia_proc_interpret(gb, block))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+// Machine state an opcode can change, saved to roll back the native run and to
+// compare it with the interpreter's. Of cartridge RAM, only the bank mapped
+// can be written.
+typedef struct {
+    thalia_reg_t reg;
+    thalia_alu_flags_t flags;
+    guint8 f;                      // Flags as read, pending or not
+    guint16 pc;
+    guint16 sp;
+    guint64 cycles;
+    gboolean halted;
+    gboolean stopped;
+    gboolean interrupts;
+    guint8 enable_interrupts_in;
+    guint8 disable_interrupts_in;
+    thalia_proc_cache_t cache;
+    thalia_timer_t timer;
+    thalia_serial_t serial;
+    thalia_key_region_t keypad_region;
+    guint8 keypad_lines;
+    guint keypad_seen;
+    thalia_sched_t sched;
+    thalia_gpu_dirty_t dirty;
+    thalia_mmu_t mmu;
+    guint64 save_dirty[THALIA_SAVE_WORDS];
+    guint32 ext_offset;            // Start of the bank in ram_ext
+    guint32 ext_size;              // Bytes of it saved, zero without RAM
+    guint8 ext[0x2000];
+} thalia_proc_state_t;
+
+// Copies the state of 'gb' that opcodes can change into 'state'.
+static void thalia_proc_save_state(ThaliaGB* gb, thalia_proc_state_t* state)
+{
+    state->reg = gb->reg;
+    state->flags = gb->flags;
+    state->f = thalia_alu_get_flags(gb);
+    state->pc = gb->pc;
+    state->sp = gb->sp;
+    state->cycles = gb->cycles;
+    state->halted = gb->halted;
+    state->stopped = gb->stopped;
+    state->interrupts = gb->interrupts;
+    state->enable_interrupts_in = gb->enable_interrupts_in;
+    state->disable_interrupts_in = gb->disable_interrupts_in;
+    state->cache = gb->cache;
+    state->timer = gb->timer;
+    state->serial = gb->serial;
+    state->keypad_region = gb->keypad.region;
+    state->keypad_lines = gb->keypad.lines;
+    state->keypad_seen = gb->keypad.seen;
+    state->sched = gb->sched;
+    state->dirty = gb->gpu.dirty;
+    state->mmu = gb->mmu;
+    memcpy(state->save_dirty, gb->save.dirty, sizeof(state->save_dirty));
+
+    state->ext_size = MIN(gb->mmu.ram_ext_size, sizeof(state->ext));
+    state->ext_offset = gb->mmu.ram_ext_size ?
+        gb->mmu.mbc.ram_bank * 0x2000 % gb->mmu.ram_ext_size : 0;
+    if(gb->mmu.ram_ext)
+        memcpy(state->ext, gb->mmu.ram_ext + state->ext_offset,
+               state->ext_size);
+}
+
+// Puts the state saved in 'state' back into 'gb'.
+static void thalia_proc_restore_state(ThaliaGB* gb,
+                                      const thalia_proc_state_t* state)
+{
+    gb->reg = state->reg;
+    gb->flags = state->flags;
+    gb->pc = state->pc;
+    gb->sp = state->sp;
+    gb->cycles = state->cycles;
+    gb->halted = state->halted;
+    gb->stopped = state->stopped;
+    gb->interrupts = state->interrupts;
+    gb->enable_interrupts_in = state->enable_interrupts_in;
+    gb->disable_interrupts_in = state->disable_interrupts_in;
+    gb->cache = state->cache;
+    gb->timer = state->timer;
+    gb->serial = state->serial;
+    gb->keypad.region = state->keypad_region;
+    gb->keypad.lines = state->keypad_lines;
+    gb->keypad.seen = state->keypad_seen;
+    gb->sched = state->sched;
+    gb->gpu.dirty = state->dirty;
+    gb->mmu = state->mmu;
+    memcpy(gb->save.dirty, state->save_dirty, sizeof(state->save_dirty));
+    if(gb->mmu.ram_ext)
+        memcpy(gb->mmu.ram_ext + state->ext_offset, state->ext,
+               state->ext_size);
+}
+
+// Tells whether 'field' differs between states 'a' and 'b'. Only for fields
+// without padding.
+#define THALIA_PROC_DIFFERS(field) \
+    (memcmp(&a->field, &b->field, sizeof(a->field)) != 0)
+
+// Compares the states 'a' and 'b' field by field, skipping padding, lookup
+// caches and the start of the opcode, which only matters while it runs.
+// Returns the name of the first field that differs, or NULL if none does.
+static const gchar* thalia_proc_compare_state(const thalia_proc_state_t* a,
+                                              const thalia_proc_state_t* b)
+{
+    const thalia_mbc_t* mbc_a = &a->mmu.mbc;
+    const thalia_mbc_t* mbc_b = &b->mmu.mbc;
+    guint8 reg;
+
+    for(reg = THALIA_REG_B; reg <= THALIA_REG_A; reg++)
+        if(reg != THALIA_REG_F && a->reg.indexed[THALIA_REG_INDEX(reg)] !=
+                                  b->reg.indexed[THALIA_REG_INDEX(reg)])
+            return "registers";
+    if(a->f != b->f)
+        return "flags";
+    if(a->pc != b->pc || a->sp != b->sp)
+        return "pc/sp";
+    if(a->cycles != b->cycles)
+        return "cycles";
+    if(a->halted != b->halted || a->stopped != b->stopped ||
+       a->interrupts != b->interrupts ||
+       a->enable_interrupts_in != b->enable_interrupts_in ||
+       a->disable_interrupts_in != b->disable_interrupts_in)
+        return "processor state";
+    if(a->cache.stale != b->cache.stale ||
+       a->cache.generation != b->cache.generation ||
+       THALIA_PROC_DIFFERS(cache.code_lines))
+        return "code cache";
+    if(THALIA_PROC_DIFFERS(timer.base_ticks_done) ||
+       THALIA_PROC_DIFFERS(serial.end) ||
+       THALIA_PROC_DIFFERS(sched.deadlines) ||
+       THALIA_PROC_DIFFERS(sched.next) || THALIA_PROC_DIFFERS(sched.last))
+        return "timers";
+    if(a->keypad_region != b->keypad_region ||
+       a->keypad_lines != b->keypad_lines || a->keypad_seen != b->keypad_seen)
+        return "keypad";
+    if(THALIA_PROC_DIFFERS(dirty.tiles) || THALIA_PROC_DIFFERS(dirty.rows) ||
+       THALIA_PROC_DIFFERS(dirty.oam) || THALIA_PROC_DIFFERS(dirty.log) ||
+       a->dirty.n_log != b->dirty.n_log ||
+       a->dirty.last_line != b->dirty.last_line ||
+       a->dirty.frame != b->dirty.frame)
+        return "video changes";
+    if(THALIA_PROC_DIFFERS(mmu.ram_page0.packed) ||
+       THALIA_PROC_DIFFERS(mmu.ram_io.packed) ||
+       THALIA_PROC_DIFFERS(mmu.ram_oam.packed) ||
+       THALIA_PROC_DIFFERS(mmu.ram_gpu.packed) ||
+       THALIA_PROC_DIFFERS(mmu.ram_int))
+        return "memory";
+    if(THALIA_PROC_DIFFERS(mmu.read_pages) ||
+       THALIA_PROC_DIFFERS(mmu.write_pages) ||
+       THALIA_PROC_DIFFERS(mmu.dma_read_pages) ||
+       THALIA_PROC_DIFFERS(mmu.dma_write_pages) ||
+       a->mmu.dma != b->mmu.dma || a->mmu.dma_end != b->mmu.dma_end)
+        return "memory map";
+    if(mbc_a->enable_ext_ram != mbc_b->enable_ext_ram ||
+       mbc_a->mode != mbc_b->mode || mbc_a->rom_bank != mbc_b->rom_bank ||
+       mbc_a->rom_bank0 != mbc_b->rom_bank0 ||
+       mbc_a->rom_low != mbc_b->rom_low ||
+       mbc_a->rom_high != mbc_b->rom_high ||
+       mbc_a->ram_bank != mbc_b->ram_bank ||
+       memcmp(mbc_a->rtc.regs, mbc_b->rtc.regs, sizeof(mbc_a->rtc.regs)) ||
+       memcmp(mbc_a->rtc.latched, mbc_b->rtc.latched,
+              sizeof(mbc_a->rtc.latched)) ||
+       mbc_a->rtc.latch != mbc_b->rtc.latch ||
+       mbc_a->rtc.synced != mbc_b->rtc.synced)
+        return "bank controller";
+    if(THALIA_PROC_DIFFERS(save_dirty) || a->ext_offset != b->ext_offset ||
+       memcmp(a->ext, b->ext, a->ext_size))
+        return "cartridge RAM";
+    return NULL;
+}
+
+// Runs every opcode both as native code and in the interpreter, starting from
+// the same state, and stops with a warning as soon as they disagree. The
+// native run is rolled back, so the interpreter's results are the ones kept.
+// This is meant for debugging the JIT and is far slower than either on its
+// own. Returns FALSE on an unhandled opcode or a disagreement.
+static gboolean thalia_proc_run_lockstep(ThaliaGB* gb)
+{
+    thalia_proc_state_t* before = g_new0(thalia_proc_state_t, 1);
+    thalia_proc_state_t* native = g_new0(thalia_proc_state_t, 1);
+    thalia_proc_state_t* after = g_new0(thalia_proc_state_t, 1);
+    const thalia_proc_insn_t* insn;
+    const thalia_proc_block_t* block;
+    const gchar* differs;
+    gboolean ret = TRUE;
+
+    while(ret && gb->mode == THALIA_PROC_MODE_LOCKSTEP && !gb->run.ended) {
+        block = thalia_proc_cache_lookup(gb);
+        for(insn = block->insns; insn < block->insns + block->n_insns;
+            insn++) {
+            if(insn->pc != gb->pc || gb->cache.stale)
+                break;
+
+            thalia_proc_save_state(gb, before);
+            thalia_jit_run(gb, thalia_jit_compile_insn(gb, insn));
+            thalia_proc_save_state(gb, native);
+            thalia_proc_restore_state(gb, before);
+
+            if(!thalia_proc_execute_insn(gb, insn)) {
+                ret = FALSE;
+                break;
+            }
+            thalia_proc_save_state(gb, after);
+            differs = thalia_proc_compare_state(native, after);
+            if(differs) {
+                g_warning(
+                    "JIT and interpreter disagree on %s after opcode "
+                    "0x%03X @ 0x%04X",
+                    differs,
+                    insn->opcode,
+                    insn->pc
+                );
+                ret = FALSE;
+                break;
+            }
+            thalia_gb_step(gb);
+        }
+    }
+
+    g_free(before);
+    g_free(native);
+    g_free(after);
+    return ret;
+}
+
+#if defined(__GNUC__) && !defined(THALIA_PROC_NO_THREADING)
+// Expands 'X' for every opcode value, 0x00 up to and including 0xFF.
+#define THALIA_PROC_ROW(X, h) \
+    X(0x##h##0) X(0x##h##1) X(0x##h##2) X(0x##h##3) \
+    X(0x##h##4) X(0x##h##5) X(0x##h##6) X(0x##h##7) \
+    X(0x##h##8) X(0x##h##9) X(0x##h##A) X(0x##h##B) \
+    X(0x##h##C) X(0x##h##D) X(0x##h##E) X(0x##h##F)
+#define THALIA_PROC_FOR_EACH(X) \
+    THALIA_PROC_ROW(X, 0) THALIA_PROC_ROW(X, 1) THALIA_PROC_ROW(X, 2) \
+    THALIA_PROC_ROW(X, 3) THALIA_PROC_ROW(X, 4) THALIA_PROC_ROW(X, 5) \
+    THALIA_PROC_ROW(X, 6) THALIA_PROC_ROW(X, 7) THALIA_PROC_ROW(X, 8) \
+    THALIA_PROC_ROW(X, 9) THALIA_PROC_ROW(X, A) THALIA_PROC_ROW(X, B) \
+    THALIA_PROC_ROW(X, C) THALIA_PROC_ROW(X, D) THALIA_PROC_ROW(X, E) \
+    THALIA_PROC_ROW(X, F)
+
+#define THALIA_PROC_LABEL(n) [n] = &&thalia_proc_op_##n,
+#define THALIA_PROC_LABEL_EXTENDED(n) \
+    [THALIA_PROC_EXTENDED | n] = &&thalia_proc_op_ext_##n,
+
+// Lets the hardware catch up if an event is due, then jumps straight to the
+// next opcode. Leaves at block boundaries once another mode has been selected
+// or the run has ended.
+#define THALIA_PROC_NEXT() do {                                         \
+        if(THALIA_SCHED_DUE(gb))                                        \
+            thalia_gb_step(gb);                                         \
+        if(G_UNLIKELY(++insn == end || insn->pc != gb->pc ||            \
+                      gb->cache.stale)) {                               \
+            if(gb->mode != THALIA_PROC_MODE_INTERPRETER ||              \
+               gb->run.ended)                                           \
+                return TRUE;                                            \
+            block = thalia_proc_cache_lookup(gb);                       \
+            insn = block->insns;                                        \
+            end = block->insns + block->n_insns;                        \
+        }                                                               \
+        goto *labels[insn->dispatch];                                   \
+    } while(0)
+
+// Every opcode gets its own copy of the dispatch code, so the indirect jump at
+// the end of each one is predicted separately. Extended opcodes are decoded
+// into their own copies, so the prefix opcode itself never runs here.
+#define THALIA_PROC_THREAD(n)                                          \
+    thalia_proc_op_##n:                                                \
+        if(!thalia_proc_execute(gb, &thalia_proc_ops[n], n,            \
+                                insn->operand))                        \
+            return FALSE;                                              \
+        THALIA_PROC_NEXT();
+#define THALIA_PROC_THREAD_EXTENDED(n)                                 \
+    thalia_proc_op_ext_##n:                                            \
+        thalia_proc_execute_extended(gb, n);                           \
+        THALIA_PROC_NEXT();
+
+// Runs opcodes using threaded dispatch. Returns FALSE on an unhandled opcode,
+// TRUE when the mode is changed or the run ends.
+static gboolean thalia_proc_run_interpreter(ThaliaGB* gb)
+{
+    static const void* const labels[THALIA_PROC_FUSED + 1] = {
+        THALIA_PROC_FOR_EACH(THALIA_PROC_LABEL)
+        THALIA_PROC_FOR_EACH(THALIA_PROC_LABEL_EXTENDED)
+        [THALIA_PROC_FUSED] = &&thalia_proc_op_fused,
+    };
+    const thalia_proc_block_t* block = thalia_proc_cache_lookup(gb);
+    const thalia_proc_insn_t* insn = block->insns;
+    const thalia_proc_insn_t* end = block->insns + block->n_insns;
+    guint8 n;
+
+    goto *labels[insn->dispatch];
+    THALIA_PROC_FOR_EACH(THALIA_PROC_THREAD)
+    THALIA_PROC_FOR_EACH(THALIA_PROC_THREAD_EXTENDED)
+
+    // Idioms that can not run in one go start over as plain opcodes.
+    thalia_proc_op_fused:
+        n = thalia_proc_execute_fused(gb, insn);
+        if(!n)
+            goto *labels[insn->opcode];
+        insn += n - 1;
+        THALIA_PROC_NEXT();
+}
+#else
+// Runs opcodes. Returns FALSE on an unhandled opcode, TRUE when the mode is
+// changed or the run ends.
+static gboolean thalia_proc_run_interpreter(ThaliaGB* gb)
+{
+    while(gb->mode == THALIA_PROC_MODE_INTERPRETER && !gb->run.ended)
+        if(!thalia_proc_interpret(gb, thalia_proc_cache_lookup(gb)))
+            return FALSE;
+    return TRUE;
+}
+#endif
+
+// Runs opcodes in the selected mode until the running call to one of the
+// thalia_gb_run functions ends. Returns FALSE on an unhandled opcode.
+gboolean thalia_proc_run(ThaliaGB* gb)
+{
+    gboolean running = TRUE;
+    while(running && !gb->run.ended) {
+        switch(gb->mode) {
+        case THALIA_PROC_MODE_JIT:
+        case THALIA_PROC_MODE_AOT:
+            running = thalia_proc_run_native(gb);
+            break;
+        case THALIA_PROC_MODE_LOCKSTEP:
+            running = thalia_proc_run_lockstep(gb);
+            break;
+        default:
+            running = thalia_proc_run_interpreter(gb);
+            break;
+        }
     }
+    return running;
 }
@@ -1,6 +1,12 @@
 #ifndef __THALIA_PROC_H__
 #define __THALIA_PROC_H__
 
+#include <glib.h>
+#include "thalia_gb.h"
+
+#define THALIA_PROC_CACHE_SIZE 1024 // Number of cached blocks, power of two
+#define THALIA_PROC_BLOCK_SIZE 16   // Maximum number of opcodes in a block
+
 // Shifting direction, corresponds with opcode encoding.
 typedef enum {
     THALIA_DIR_LEFT  = 0,
@@ -12,8 +18,72 @@ typedef enum {
     THALIA_OPERATION_INC = 0,
     THALIA_OPERATION_DEC = 1
 } thalia_operation_t;
+
+// Kind of immediate operand following an opcode.
+typedef enum {
+    THALIA_OPERAND_NONE = 0,
+    THALIA_OPERAND_BYTE = 1,
+    THALIA_OPERAND_WORD = 2
+} thalia_operand_t;
+
+// Ways of executing opcodes, selected with thalia_proc_set_mode.
+typedef enum {
+    THALIA_PROC_MODE_INTERPRETER = 0,
+    THALIA_PROC_MODE_JIT         = 1, // Native code for frequently run blocks
+    THALIA_PROC_MODE_LOCKSTEP    = 2, // Both, comparing state after opcodes
+    THALIA_PROC_MODE_AOT         = 3  // Translated ROM code, if available
+} thalia_proc_mode_t;
+
+// Opcode prefixing the extended opcodes.
+#define THALIA_PROC_PREFIX 0xCB
+
+// Bit marking an extended opcode in a decoded instruction.
+#define THALIA_PROC_EXTENDED 0x100
+
+// Dispatch value of an instruction starting a fused idiom.
+#define THALIA_PROC_FUSED 0x200
+
+// Pre-decoded instruction. Extended opcodes are stored with bit 8 set.
+typedef struct {
+    guint16 pc;                    // Address of the instruction
+    guint16 opcode;                // Opcode, plus 0x100 if extended
+    guint16 operand;               // Immediate operand, if any
+    guint16 dispatch;              // Opcode, or THALIA_PROC_FUSED
+    guint8 fused;                  // Idiom starting here, zero for none
+} thalia_proc_insn_t;
+
+// Run of instructions ending in (at most) one change of control flow.
+typedef struct {
+    guint16 pc;                    // Address of the first instruction
+    guint16 bank;                  // ROM bank, if mapped to 0x4000-0x7FFF
+    guint32 generation;            // Cache generation, for code in RAM
+    guint8 n_insns;                // Zero for an empty slot
+    gboolean idle;                 // Whether this is a polling loop
+    guint16 hits;                  // Runs so far, while not yet compiled
+    gpointer code;                 // Native code for the block, if compiled
+    thalia_proc_insn_t insns[THALIA_PROC_BLOCK_SIZE];
+} thalia_proc_block_t;
+
+// Direct-mapped cache of decoded blocks, keyed by ROM bank and address.
+typedef struct {
+    thalia_proc_block_t* blocks;   // Allocated on first use
+    guint32 generation;            // Bumped when code in RAM is overwritten
+    gboolean stale;                // Set when the running block may be stale
+    thalia_proc_block_t* idle;     // Polling loop last entered, if any
+    guint64 idle_since;            // Cycle count it was last entered at
+    guint8 code_lines[0x80];       // Bitmap of 64-byte lines with cached code
+    guint64 idle_skipped;          // Cycles skipped in polling loops
+    guint64 fused_hits;            // Idioms run as a single operation
+    guint64 fused_misses;          // Idioms run opcode by opcode instead
+} thalia_proc_cache_t;
 #endif
 
 #ifdef __THALIA_GB_T__
 gboolean thalia_proc_decode(ThaliaGB* gb, guint8 opcode);
+gboolean thalia_proc_run(ThaliaGB* gb);
+void thalia_proc_set_mode(ThaliaGB* gb, thalia_proc_mode_t mode);
+gpointer thalia_proc_describe(guint16 opcode, guint8* length, guint8* cycles);
+gboolean thalia_proc_ends_block(guint16 opcode);
+void thalia_proc_cache_invalidate(ThaliaGB* gb, guint16 addr);
+void thalia_proc_cache_mark_stale(ThaliaGB* gb);
 #endif
@@ -1,30 +1,32 @@
 #include <glib.h>
 #include "thalia_gb.h"
 #include "thalia_reg.h"
+#include "thalia_alu.h"
 #include "thalia_mmu.h"
 
 // Reads byte register 'reg'.
 guint8 thalia_reg_read_single(ThaliaGB* gb, const thalia_regname_single_t reg)
 {
 #ifdef THALIA_DEBUG_REGS
+    guint8 value = gb->reg.indexed[THALIA_REG_INDEX(reg)];
     switch(reg) {
     case THALIA_REG_B:
-        g_debug("(0x%04X) READ B: 0x%02X", gb->pc, gb->reg.indexed[reg]);
+        g_debug("(0x%04X) READ B: 0x%02X", gb->pc, value);
         break;
     case THALIA_REG_C:
-        g_debug("(0x%04X) READ C: 0x%02X", gb->pc, gb->reg.indexed[reg]);
+        g_debug("(0x%04X) READ C: 0x%02X", gb->pc, value);
         break;
     case THALIA_REG_D:
-        g_debug("(0x%04X) READ D: 0x%02X", gb->pc, gb->reg.indexed[reg]);
+        g_debug("(0x%04X) READ D: 0x%02X", gb->pc, value);
         break;
     case THALIA_REG_E:
-        g_debug("(0x%04X) READ E: 0x%02X", gb->pc, gb->reg.indexed[reg]);
+        g_debug("(0x%04X) READ E: 0x%02X", gb->pc, value);
         break;
     case THALIA_REG_H:
-        g_debug("(0x%04X) READ H: 0x%02X", gb->pc, gb->reg.indexed[reg]);
+        g_debug("(0x%04X) READ H: 0x%02X", gb->pc, value);
         break;
     case THALIA_REG_L:
-        g_debug("(0x%04X) READ L: 0x%02X", gb->pc, gb->reg.indexed[reg]);
+        g_debug("(0x%04X) READ L: 0x%02X", gb->pc, value);
         break;
     case THALIA_REG_IHL:
         g_debug(
@@ -36,37 +38,34 @@ guint8 thalia_reg_read_single(ThaliaGB* gb, const thalia_regname_single_t reg)
         );
         break;
     case THALIA_REG_A:
-        g_debug("(0x%04X) READ A: 0x%02X", gb->pc, gb->reg.indexed[reg]);
+        g_debug("(0x%04X) READ A: 0x%02X", gb->pc, value);
         break;
     }
 #endif
 
-    if(reg == THALIA_REG_IHL) {
-        // Read from (HL)
-        guint16 offset = thalia_reg_read_double(gb, THALIA_REG_HL, TRUE);
-        return thalia_mmu_read_byte(gb, offset);
-        gb->cycles++;
-    }
-    else
-        return gb->reg.indexed[reg];
+    if(G_UNLIKELY(reg == THALIA_REG_IHL))
+        return thalia_reg_read_indirect(gb);
+    return gb->reg.indexed[THALIA_REG_INDEX(reg)];
+}
+
+// Reads the byte at (HL).
+guint8 thalia_reg_read_indirect(ThaliaGB* gb)
+{
+    return thalia_mmu_read_byte(gb, gb->reg.pairs[THALIA_REG_HL]);
 }
 
 // Reads word register 'reg'. If 'type' is TRUE, the SP's index is read as AF.
 guint16 thalia_reg_read_double(ThaliaGB* gb, const thalia_regname_double_t reg,
                                gboolean type)
 {
-    switch(reg) {
-    case THALIA_REG_BC:
-        return (gb->reg.named.b << 8) | gb->reg.named.c;
-    case THALIA_REG_DE:
-        return (gb->reg.named.d << 8) | gb->reg.named.e;
-    case THALIA_REG_HL:
-        return (gb->reg.named.h << 8) | gb->reg.named.l;
-    case THALIA_REG_SP:
-        return type ? ((gb->reg.named.a << 8) | gb->reg.indexed[6]) : gb->sp;
-    }
+    if(G_LIKELY(reg != THALIA_REG_SP))
+        return gb->reg.pairs[reg];
+    if(!type)
+        return gb->sp;
 
-    g_error("Unknown double register: %d", reg);
+    // The flags may not have been computed yet.
+    thalia_alu_sync_flags(gb);
+    return gb->reg.pairs[THALIA_REG_AF];
 }
 
 // Writes 'val' to byte register 'reg'.
@@ -102,14 +101,17 @@ void thalia_reg_write_single(ThaliaGB* gb, const thalia_regname_single_t reg,
     }
 #endif
 
-    if(reg == THALIA_REG_IHL) {
-        // Write to (HL)
-        guint16 offset = thalia_reg_read_double(gb, THALIA_REG_HL, TRUE);
-        thalia_mmu_write_byte(gb, offset, value);
-        gb->cycles++;
-    }
+    if(G_UNLIKELY(reg == THALIA_REG_IHL))
+        thalia_reg_write_indirect(gb, value);
     else
-        gb->reg.indexed[reg] = value;
+        gb->reg.indexed[THALIA_REG_INDEX(reg)] = value;
+}
+
+// Writes 'value' to the byte at (HL).
+void thalia_reg_write_indirect(ThaliaGB* gb, const guint8 value)
+{
+    thalia_mmu_write_byte(gb, gb->reg.pairs[THALIA_REG_HL], value);
+    gb->cycles++;
 }
 
 // Write 'val' to word register 'reg'; 'type' works the same as when reading.
@@ -136,26 +138,12 @@ void thalia_reg_write_double(ThaliaGB* gb, const thalia_regname_double_t reg,
     }
 #endif
 
-    // Save the word into individual byte registers.
-    switch(reg) {
-    case THALIA_REG_BC:
-        gb->reg.named.b = (value >> 8) & 0xFF;
-        gb->reg.named.c = value & 0xFF;
-        break;
-    case THALIA_REG_DE:
-        gb->reg.named.d = (value >> 8) & 0xFF;
-        gb->reg.named.e = value & 0xFF;
-        break;
-    case THALIA_REG_HL:
-        gb->reg.named.h = (value >> 8) & 0xFF;
-        gb->reg.named.l = value & 0xFF;
-        break;
-    case THALIA_REG_SP:
-        if(type) {
-            gb->reg.named.a = (value >> 8) & 0xFF;
-            gb->reg.indexed[6] = value & 0xF0;
-        } else {
-            gb->sp = value;
-        }
+    if(G_LIKELY(reg != THALIA_REG_SP)) {
+        gb->reg.pairs[reg] = value;
+    } else if(type) {
+        gb->reg.named.a = (value >> 8) & 0xFF;
+        thalia_alu_set_flags(gb, value & 0xF0);
+    } else {
+        gb->sp = value;
     }
 }
@@ -26,18 +26,21 @@ typedef enum {
     THALIA_REG_A   = 7
 } thalia_regname_single_t;
 
-// Register substructure, laid out to allow for indexed access.
+// Position of byte register 'reg' within the register file. The pairs are
+// stored little-endian, so the low register comes first in every pair.
+#define THALIA_REG_INDEX(reg) ((reg) ^ ((reg) < THALIA_REG_IHL))
+
+// Register substructure. Bytes are indexed through THALIA_REG_INDEX, pairs
+// by their opcode encoding, with AF in place of SP. Big-endian targets are
+// refused at build time, so the pairs line up with the bytes.
 typedef union {
     guint8 indexed[8];
+    guint16 pairs[4];
     struct {
-        guint8 b, c;
-        guint8 d, e;
-        guint8 h, l;
-      guint8 dummy : 4;
-      gboolean flag_carry : 1;
-      gboolean flag_halfcarry : 1;
-      gboolean flag_operation : 1;
-      gboolean flag_zero : 1;
+        guint8 c, b;
+        guint8 e, d;
+        guint8 l, h;
+        guint8 f; // Flags
         guint8 a; // Accumulator
     } named;
 } thalia_reg_t;
@@ -45,8 +48,10 @@ typedef union {
 
 #ifdef __THALIA_GB_T__
 guint8 thalia_reg_read_single(ThaliaGB* gb, const thalia_regname_single_t reg);
+guint8 thalia_reg_read_indirect(ThaliaGB* gb);
 guint16 thalia_reg_read_double(ThaliaGB* gb, const thalia_regname_double_t reg, gboolean format);
 void thalia_reg_write_single(ThaliaGB* gb, const thalia_regname_single_t reg, const guint8 value);
+void thalia_reg_write_indirect(ThaliaGB* gb, const guint8 value);
 void thalia_reg_write_double(ThaliaGB* gb, const thalia_regname_double_t reg,
 guint16 value, gboolean format);
 #endif
@@ -0,0 +1,79 @@
+#include <glib.h>
+#include "thalia_gb.h"
+#include "thalia_mmu.h"
+#include "thalia_rom.h"
+
+// Images currently mapped, keyed by path, and the lock guarding them.
+static GHashTable* thalia_rom_images = NULL;
+static GMutex thalia_rom_lock;
+
+// Maps the ROM file at 'path', or takes another reference to it if some
+// instance has it mapped already.
+thalia_rom_t* thalia_rom_open(const gchar* path, GError** error)
+{
+    thalia_rom_t* rom;
+    GMappedFile* file;
+    guint i;
+
+    g_mutex_lock(&thalia_rom_lock);
+    if(!thalia_rom_images)
+        thalia_rom_images = g_hash_table_new(g_str_hash, g_str_equal);
+
+    rom = g_hash_table_lookup(thalia_rom_images, path);
+    if(rom) {
+        rom->ref_count++;
+        g_mutex_unlock(&thalia_rom_lock);
+        return rom;
+    }
+
+    file = g_mapped_file_new(path, FALSE, error);
+    if(!file) {
+        g_mutex_unlock(&thalia_rom_lock);
+        return NULL;
+    }
+
+    // There should at least be a bank holding the header.
+    if(g_mapped_file_get_length(file) < THALIA_MMU_BANK_SIZE) {
+        g_mapped_file_unref(file);
+        g_mutex_unlock(&thalia_rom_lock);
+        g_set_error(
+            error,
+            THALIA_ERROR,
+            THALIA_ERROR_BANK_SIZE,
+            "Could not read entire bank, is the file a ROM?"
+        );
+        return NULL;
+    }
+
+    // Banks are just offsets into the mapping, nothing is copied.
+    rom = g_new0(thalia_rom_t, 1);
+    rom->ref_count = 1;
+    rom->path = g_strdup(path);
+    rom->file = file;
+    rom->size = g_mapped_file_get_length(file);
+    rom->bank_count = MIN(rom->size / THALIA_MMU_BANK_SIZE,
+                          THALIA_MMU_MAX_BANK_COUNT);
+    for(i = 0; i < rom->bank_count; i++)
+        rom->banks[i] = (guint8*) g_mapped_file_get_contents(file) +
+                        i * THALIA_MMU_BANK_SIZE;
+
+    g_hash_table_insert(thalia_rom_images, rom->path, rom);
+    g_mutex_unlock(&thalia_rom_lock);
+    return rom;
+}
+
+// Drops a reference to 'rom', unmapping it if it was the last one.
+void thalia_rom_unref(thalia_rom_t* rom)
+{
+    g_mutex_lock(&thalia_rom_lock);
+    if(--rom->ref_count) {
+        g_mutex_unlock(&thalia_rom_lock);
+        return;
+    }
+    g_hash_table_remove(thalia_rom_images, rom->path);
+    g_mutex_unlock(&thalia_rom_lock);
+
+    g_mapped_file_unref(rom->file);
+    g_free(rom->path);
+    g_free(rom);
+}
@@ -0,0 +1,22 @@
+#ifndef __THALIA_ROM_H__
+#define __THALIA_ROM_H__
+
+#include <glib.h>
+#include "thalia_gb.h"
+
+// ROM file mapped read-only into memory. Instances loading the same file
+// share one image, which is unmapped when the last of them lets go of it.
+typedef struct {
+    gint ref_count;
+    gchar* path;                  // File the image was mapped from
+    GMappedFile* file;            // The mapping itself
+    gsize size;                   // Length of the file in bytes
+    guint bank_count;             // Number of complete banks in the file
+    guint8* banks[THALIA_MMU_MAX_BANK_COUNT]; // Banks within the mapping
+} thalia_rom_t;
+#endif
+
+#ifdef __THALIA_GB_T__
+thalia_rom_t* thalia_rom_open(const gchar* path, GError** error);
+void thalia_rom_unref(thalia_rom_t* rom);
+#endif
@@ -0,0 +1,222 @@
+#include <glib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "thalia_gb.h"
+#include "thalia_mmu.h"
+#include "thalia_mbc.h"
+#include "thalia_save.h"
+
+// Tells whether any page is set in 'pages'.
+static gboolean thalia_save_any(const guint64* pages)
+{
+    guint64 any = 0;
+    guint i;
+    for(i = 0; i < THALIA_SAVE_WORDS; i++)
+        any |= pages[i];
+    return any != 0;
+}
+
+// Writes the pages set in 'pages' back to the save file.
+static void thalia_save_sync(thalia_save_t* save, const guint64* pages)
+{
+    gsize system = sysconf(_SC_PAGESIZE);
+    gsize start, last = G_MAXSIZE;
+    guint page;
+
+    for(page = 0; page < save->size / THALIA_MMU_PAGE_SIZE; page++) {
+        if(!(pages[page / 64] >> (page % 64) & 1))
+            continue;
+
+        // Several of our pages may share a page of the system.
+        start = page * THALIA_MMU_PAGE_SIZE / system * system;
+        if(start == last)
+            continue;
+        msync(save->data + start, MIN(system, save->size - start), MS_SYNC);
+        last = start;
+    }
+}
+
+// Syncs pages as they are committed, until told to quit.
+static gpointer thalia_save_flush(gpointer data)
+{
+    thalia_save_t* save = data;
+    guint64 pages[THALIA_SAVE_WORDS];
+    gboolean quit;
+
+    g_mutex_lock(&save->mutex);
+    for(;;) {
+        // Take all pending pages at once, and sync them without the lock.
+        memcpy(pages, save->pending, sizeof(pages));
+        memset(save->pending, 0, sizeof(save->pending));
+        quit = save->quit;
+        g_mutex_unlock(&save->mutex);
+
+        thalia_save_sync(save, pages);
+        if(quit)
+            return NULL;
+
+        g_mutex_lock(&save->mutex);
+        while(!save->quit && !thalia_save_any(save->pending))
+            g_cond_wait(&save->wake, &save->mutex);
+    }
+}
+
+// Copies the save file 'fd' into 'size' bytes of private RAM, for when the
+// file cannot be shared. Whatever is missing reads as zeroes.
+static guint8* thalia_save_copy(gint fd, gsize size)
+{
+    guint8* data = g_new0(guint8, size);
+    gsize done = 0;
+    gssize n;
+
+    while(done < size && (n = pread(fd, data + done, size - done, done)) > 0)
+        done += n;
+    return data;
+}
+
+// Maps 'size' bytes of the save file belonging to the ROM at 'path', creating
+// it if needed. If another instance holds the file, its contents are copied
+// to private RAM instead. Returns NULL if all of that fails.
+static guint8* thalia_save_map(thalia_save_t* save, const gchar* path,
+                               gsize size)
+{
+    const gchar* dot = strrchr(path, '.');
+    gchar* base;
+    gchar* file;
+    struct stat st;
+    gpointer data;
+    gint fd;
+
+    // Saves sit next to the ROM, with the extension replaced by .sav.
+    if(dot && !strchr(dot, G_DIR_SEPARATOR))
+        base = g_strndup(path, dot - path);
+    else
+        base = g_strdup(path);
+    file = g_strconcat(base, ".sav", NULL);
+    g_free(base);
+
+    // Instances of the same ROM would write over each other's progress, so
+    // only the first one to lock the file gets to keep it.
+    fd = open(file, O_RDWR | O_CREAT, 0644);
+    if(fd >= 0 && flock(fd, LOCK_EX | LOCK_NB) && errno == EWOULDBLOCK) {
+        g_warning("Save file %s is in use, progress will be lost", file);
+        data = thalia_save_copy(fd, size);
+        close(fd);
+        g_free(file);
+        return data;
+    }
+
+    // New saves read as zeroes. Saves from elsewhere may be larger.
+    if(fd < 0 || fstat(fd, &st) ||
+       ((gsize) st.st_size < size && ftruncate(fd, size)) ||
+       (data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0)) == MAP_FAILED) {
+        g_warning("Could not map save file %s, progress will be lost", file);
+        if(fd >= 0)
+            close(fd);
+        g_free(file);
+        return NULL;
+    }
+
+    g_free(file);
+    save->fd = fd;
+    save->data = data;
+    save->size = size;
+    return data;
+}
+
+// Sets up the cartridge RAM for the ROM loaded from 'path'. If the cartridge
+// has a battery, the RAM is mapped from a save file.
+void thalia_save_open(ThaliaGB* gb, const gchar* path)
+{
+    static const guint32 sizes[] = { 0, 0x800, 0x2000, 0x8000, 0x20000,
+                                     0x10000 };
+    thalia_save_t* save = &gb->save;
+    thalia_mmu_t* mmu = &gb->mmu;
+    guint8 code = mmu->rom_banks[0][THALIA_HEADER_RAMSIZE];
+
+    // The MBC2 has 512 half-bytes of its own, whatever the header says.
+    if(mmu->mbc.nibbles)
+        mmu->ram_ext_size = 0x200;
+    else
+        mmu->ram_ext_size = code < G_N_ELEMENTS(sizes) ? sizes[code] : 0;
+    if(!mmu->ram_ext_size)
+        return;
+
+    if(mmu->mbc.battery)
+        mmu->ram_ext = thalia_save_map(save, path, mmu->ram_ext_size);
+    if(save->fd >= 0)
+        save->flusher = g_thread_new("thalia-save", thalia_save_flush, save);
+    if(!mmu->ram_ext)
+        mmu->ram_ext = g_new0(guint8, mmu->ram_ext_size);
+    thalia_mmu_map_ext(gb);
+}
+
+// Syncs what is left of the cartridge RAM and lets go of it.
+void thalia_save_close(ThaliaGB* gb)
+{
+    thalia_save_t* save = &gb->save;
+    guint i;
+
+    if(save->fd < 0) {
+        g_free(gb->mmu.ram_ext);
+    } else {
+        g_mutex_lock(&save->mutex);
+        for(i = 0; i < THALIA_SAVE_WORDS; i++)
+            save->pending[i] |= save->dirty[i];
+        save->quit = TRUE;
+        g_cond_signal(&save->wake);
+        g_mutex_unlock(&save->mutex);
+        g_thread_join(save->flusher);
+
+        munmap(save->data, save->size);
+        close(save->fd);
+        memset(save->dirty, 0, sizeof(save->dirty));
+        save->fd = -1;
+        save->data = NULL;
+        save->flusher = NULL;
+        save->quit = FALSE;
+    }
+
+    gb->mmu.ram_ext = NULL;
+    gb->mmu.ram_ext_size = 0;
+    thalia_mmu_map_ext(gb);
+}
+
+// Notes a write to the cartridge RAM at 'offset'.
+void thalia_save_mark(ThaliaGB* gb, guint32 offset)
+{
+    guint page = offset / THALIA_MMU_PAGE_SIZE;
+    if(gb->save.fd < 0 || THALIA_SAVE_DIRTY(gb, offset))
+        return;
+
+    // Further writes to the page go straight to memory until the next commit.
+    gb->save.dirty[page / 64] |= G_GUINT64_CONSTANT(1) << (page % 64);
+    thalia_mmu_map_ext(gb);
+}
+
+// Hands the pages written since the last commit to the flusher. Called once a
+// frame, and whenever a run returns.
+void thalia_save_commit(ThaliaGB* gb)
+{
+    thalia_save_t* save = &gb->save;
+    guint i;
+
+    if(save->fd < 0 || !thalia_save_any(save->dirty))
+        return;
+
+    g_mutex_lock(&save->mutex);
+    for(i = 0; i < THALIA_SAVE_WORDS; i++)
+        save->pending[i] |= save->dirty[i];
+    g_cond_signal(&save->wake);
+    g_mutex_unlock(&save->mutex);
+
+    // Written pages go through the handler again, so new writes are noticed.
+    memset(save->dirty, 0, sizeof(save->dirty));
+    thalia_mmu_map_ext(gb);
+}
@@ -0,0 +1,37 @@
+#ifndef __THALIA_SAVE_H__
+#define __THALIA_SAVE_H__
+
+#include <glib.h>
+#include "thalia_gb.h"
+
+// Largest amount of cartridge RAM, in 16 banks of 8 KiB.
+#define THALIA_SAVE_MAX_SIZE 0x20000
+#define THALIA_SAVE_WORDS (THALIA_SAVE_MAX_SIZE / THALIA_MMU_PAGE_SIZE / 64)
+
+// Battery-backed cartridge RAM, mapped from a save file. Pages the game writes
+// are collected every frame and synced to disk by a thread of their own, so
+// the emulation never waits for the disk.
+typedef struct {
+    gint fd;                             // Save file, or -1 without one
+    guint8* data;                        // Its mapping, the cartridge RAM
+    gsize size;                          // Length of the mapping
+    guint64 dirty[THALIA_SAVE_WORDS];    // Pages written during this frame
+    guint64 pending[THALIA_SAVE_WORDS];  // Pages yet to be synced
+    gboolean quit;                       // Whether the flusher should stop
+    GThread* flusher;                    // Thread syncing the pending pages
+    GMutex mutex;                        // Guards pending and quit
+    GCond wake;                          // Signalled when pages are pending
+} thalia_save_t;
+
+// Tells whether the page of cartridge RAM at 'offset' is written this frame.
+#define THALIA_SAVE_DIRTY(gb, offset) \
+    ((gb)->save.dirty[(offset) / THALIA_MMU_PAGE_SIZE / 64] & \
+     G_GUINT64_CONSTANT(1) << ((offset) / THALIA_MMU_PAGE_SIZE % 64))
+#endif
+
+#ifdef __THALIA_GB_T__
+void thalia_save_open(ThaliaGB* gb, const gchar* path);
+void thalia_save_close(ThaliaGB* gb);
+void thalia_save_mark(ThaliaGB* gb, guint32 offset);
+void thalia_save_commit(ThaliaGB* gb);
+#endif
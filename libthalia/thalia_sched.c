@@ -0,0 +1,23 @@
+#include <glib.h>
+#include "thalia_gb.h"
+#include "thalia_sched.h"
+
+// Sets the deadline of 'event' to cycle count 'deadline'.
+void thalia_sched_set(ThaliaGB* gb, thalia_sched_event_t event,
+                      guint64 deadline)
+{
+    guint64 next = deadline;
+    guint i;
+
+    gb->sched.deadlines[event] = deadline;
+    for(i = 0; i < THALIA_SCHED_COUNT; i++)
+        next = MIN(next, gb->sched.deadlines[i]);
+    gb->sched.next = next;
+}
+
+// Makes the hardware catch up at the next step, after something changed that
+// may bring events forward or trigger an interrupt.
+void thalia_sched_check(ThaliaGB* gb)
+{
+    thalia_sched_set(gb, THALIA_SCHED_CHECK, gb->cycles);
+}
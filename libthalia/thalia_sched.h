@@ -0,0 +1,38 @@
+#ifndef __THALIA_SCHED_H__
+#define __THALIA_SCHED_H__
+
+#include <glib.h>
+#include "thalia_gb.h"
+
+// Hardware events, each with its own deadline.
+typedef enum {
+    THALIA_SCHED_GPU = 0,    // Next GPU mode change
+    THALIA_SCHED_TIMER,      // Next timer overflow
+    THALIA_SCHED_DMA,        // End of the running OAM DMA transfer
+    THALIA_SCHED_SERIAL,     // End of the running serial transfer
+    THALIA_SCHED_RUN,        // End of the running call, see thalia_gb_run_t
+    THALIA_SCHED_CHECK,      // Interrupt state to update at the next step
+    THALIA_SCHED_COUNT
+} thalia_sched_event_t;
+
+// Deadline of events that are not going to happen.
+#define THALIA_SCHED_NEVER G_MAXUINT64
+
+// Event scheduler. Deadlines are absolute cycle counts. There are only a few
+// events, so they sit in a fixed array with the earliest deadline cached.
+typedef struct {
+    guint64 deadlines[THALIA_SCHED_COUNT];
+    guint64 next;                  // Earliest of the deadlines
+    guint64 start;                 // Cycle count the current opcode started at
+    guint64 last;                  // Cycle count at the last full step
+} thalia_sched_t;
+
+// Tells whether the hardware needs to catch up before the next opcode.
+#define THALIA_SCHED_DUE(gb) ((gb)->cycles >= (gb)->sched.next)
+#endif
+
+#ifdef __THALIA_GB_T__
+void thalia_sched_set(ThaliaGB* gb, thalia_sched_event_t event,
+                      guint64 deadline);
+void thalia_sched_check(ThaliaGB* gb);
+#endif
@@ -0,0 +1,38 @@
+#include <glib.h>
+#include "thalia_gb.h"
+#include "thalia_mmu.h"
+#include "thalia_serial.h"
+
+// Tells whether a transfer is running that completes by itself, which is the
+// case when this side drives the clock.
+static gboolean thalia_serial_running(ThaliaGB* gb)
+{
+    return gb->mmu.ram_io.unpacked.sio_start &&
+           gb->mmu.ram_io.unpacked.sio_clock;
+}
+
+// Handles writes of 'val' to the serial control register.
+void thalia_serial_write(ThaliaGB* gb, guint8 val)
+{
+    gb->mmu.ram_io.packed[0x02] = val;
+    if(thalia_serial_running(gb))
+        gb->serial.end = gb->cycles + THALIA_SERIAL_DURATION;
+}
+
+// Returns the cycle count at which the running transfer ends.
+guint64 thalia_serial_deadline(ThaliaGB* gb)
+{
+    return thalia_serial_running(gb) ? gb->serial.end : THALIA_SCHED_NEVER;
+}
+
+// Ends the running transfer once its time is up. Without a partner, the bits
+// shifted in are all ones.
+void thalia_serial_step(ThaliaGB* gb)
+{
+    if(!thalia_serial_running(gb) || gb->cycles < gb->serial.end)
+        return;
+
+    gb->mmu.ram_io.unpacked.sio_data = 0xFF;
+    gb->mmu.ram_io.unpacked.sio_start = FALSE;
+    thalia_gb_interrupt(gb, THALIA_INT_SERIAL);
+}
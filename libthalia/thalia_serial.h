@@ -0,0 +1,19 @@
+#ifndef __THALIA_SERIAL_H__
+#define __THALIA_SERIAL_H__
+
+#include <glib.h>
+
+// M-cycles it takes to shift out a byte on the internal clock of 8192 Hz.
+#define THALIA_SERIAL_DURATION 1024
+
+// Serial port. There is never anything on the other end of the link cable.
+typedef struct {
+    guint64 end;             // Cycle count the running transfer ends at
+} thalia_serial_t;
+#endif
+
+#ifdef __THALIA_GB_T__
+void thalia_serial_write(ThaliaGB* gb, guint8 val);
+guint64 thalia_serial_deadline(ThaliaGB* gb);
+void thalia_serial_step(ThaliaGB* gb);
+#endif
@@ -5,29 +5,55 @@
 // Updates timer state to be in line with machine state after opcode execution.
 void thalia_timer_step(ThaliaGB* gb)
 {
-    guint64 base_ticks = gb->cycles - gb->timer.base_ticks_done;
-    while(base_ticks > 0) {
-        base_ticks--;
-        gb->timer.base_ticks_done++;
-        // Increase the divider timer every 16 base ticks.
-        if(gb->timer.base_ticks_done % 4 == 0)
-            gb->mmu->ram_io.unpacked.time_divider++;
-
-        // If the timer is running, check if a tick has elapsed.
-        if(gb->mmu->ram_io.unpacked.time_start) {
-            // Step size depends on clock speed selection.
-            guint8 step = 1 << (2*gb->mmu->ram_io.unpacked.time_clock);
-            if(gb->timer.base_ticks_done % step == 0) {
-                // At this point we know that a tick has gone by.
-                gb->mmu->ram_io.unpacked.time_count++;
-                if(gb->mmu->ram_io.unpacked.time_count == 0x00) {
-                    // Restore the contents from the modulo register.
-                    gb->mmu->ram_io.unpacked.time_count = \
-                     gb->mmu->ram_io.unpacked.time_modulo;
-                    // Overflow happened, flag for interrupt.
-                    gb->mmu->ram_io.unpacked.int_flag_timer = TRUE;
-                }
-            }
-        }
+    thalia_timer_sync(gb, gb->cycles);
+}
+
+// Runs the timer up to cycle count 'until'. Rather than going through every
+// base tick, this works out how many times each register went up since the
+// last catch-up, so the cost does not grow with the time elapsed.
+void thalia_timer_sync(ThaliaGB* gb, guint64 until)
+{
+    guint64 done = gb->timer.base_ticks_done;
+    guint64 step, ticks, left, period;
+
+    if(until <= done)
+        return;
+    gb->timer.base_ticks_done = until;
+
+    // The divider goes up on every multiple of 4 base ticks (16 clocks).
+    gb->mmu.ram_io.unpacked.time_divider += until / 4 - done / 4;
+
+    // If the timer is running, the counter goes up on every multiple of the
+    // step size, which depends on clock speed selection.
+    if(!gb->mmu.ram_io.unpacked.time_start)
+        return;
+    step = 1 << (2*gb->mmu.ram_io.unpacked.time_clock);
+    ticks = until / step - done / step;
+
+    left = 0x100 - gb->mmu.ram_io.unpacked.time_count;
+    if(ticks < left) {
+        gb->mmu.ram_io.unpacked.time_count += ticks;
+        return;
     }
+
+    // Overflow happened, flag for interrupt. After that, the counter starts
+    // over from the modulo register every time it overflows.
+    thalia_gb_interrupt(gb, THALIA_INT_TIMER);
+    period = 0x100 - gb->mmu.ram_io.unpacked.time_modulo;
+    gb->mmu.ram_io.unpacked.time_count =
+        gb->mmu.ram_io.unpacked.time_modulo + (ticks - left) % period;
+}
+
+// Returns the cycle count at which the timer overflows next, which is where
+// the timer interrupt is raised.
+guint64 thalia_timer_deadline(ThaliaGB* gb)
+{
+    guint64 step, first;
+    if(!gb->mmu.ram_io.unpacked.time_start)
+        return THALIA_SCHED_NEVER;
+
+    // The counter goes up on every multiple of the step size.
+    step = 1 << (2*gb->mmu.ram_io.unpacked.time_clock);
+    first = (gb->timer.base_ticks_done / step + 1) * step;
+    return first + (0xFF - gb->mmu.ram_io.unpacked.time_count) * step;
 }
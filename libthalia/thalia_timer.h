@@ -10,4 +10,6 @@ typedef struct {
 
 #ifdef __THALIA_GB_T__
 void thalia_timer_step(ThaliaGB* gb);
+void thalia_timer_sync(ThaliaGB* gb, guint64 until);
+guint64 thalia_timer_deadline(ThaliaGB* gb);
 #endif
@@ -0,0 +1,63 @@
+#include <glib.h>
+#include <glib/gprintf.h>
+#include <stdlib.h>
+
+#include "libthalia/thalia_gb.h"
+#include "libthalia/thalia_gpu.h"
+#include "libthalia/thalia_keypad.h"
+
+// Frames emulated unless told otherwise.
+#define THALIA_BENCH_FRAMES 3000
+
+static ThaliaGB* gb = NULL;
+
+static gpointer thalia_bench_thread(gpointer args)
+{
+    thalia_gb_run(gb);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    GError* error = NULL;
+    guint64 frames = THALIA_BENCH_FRAMES;
+    gint64 start;
+    gdouble secs;
+
+    if(argc < 2) {
+        g_printf("Usage: %s romfile.gb [frames]\r\n", argv[0]);
+        return 0;
+    }
+    if(argc > 2)
+        frames = g_ascii_strtoull(argv[2], NULL, 10);
+
+    gb = thalia_gb_new();
+    thalia_gb_load_rom(gb, argv[1], &error);
+    if(error) {
+        g_printerr("Could not load ROM file: %s.\r\n", error->message);
+        return 1;
+    }
+
+    // Run the emulation as fast as it goes, and see how long it takes to get
+    // through the frames. Frames are counted by cycles, as the screen is only
+    // rendered when it changes.
+    start = g_get_monotonic_time();
+    g_thread_new("emulation", thalia_bench_thread, NULL);
+    // Nobody is at the keypad, so ROMs waiting for it in STOP are woken up.
+    while(gb->cycles < frames * THALIA_GPU_DURATION_FRAME) {
+        g_usleep(1000);
+        thalia_keypad_lock(gb);
+        thalia_keypad_changed(gb);
+        thalia_keypad_unlock(gb);
+    }
+    secs = (g_get_monotonic_time() - start) / 1e6;
+
+    g_printf("%" G_GUINT64_FORMAT " frames in %.3f s: %.1f frames/s\r\n",
+             frames, secs, frames / secs);
+    g_printf("%.1f%% of cycles skipped in polling loops\r\n",
+             100.0 * gb->cache.idle_skipped / gb->cycles);
+    g_printf("%" G_GUINT64_FORMAT " idioms fused, %" G_GUINT64_FORMAT
+             " run opcode by opcode\r\n",
+             gb->cache.fused_hits, gb->cache.fused_misses);
+    exit(0);
+}
@@ -0,0 +1,119 @@
+#include <glib.h>
+#include <glib/gprintf.h>
+
+#include "libthalia/thalia_gb.h"
+#include "libthalia/thalia_alu.h"
+
+// Operations run by the benchmark, per round.
+#define THALIA_BENCH_OPS (1 << 24)
+
+// Number of distinct operations below.
+#define THALIA_BENCH_KINDS 16
+
+// Runs operation 'kind' of the ALU on 'a' and 'b', returning the result.
+static guint8 thalia_bench_op(ThaliaGB* gb, guint kind, guint8 a, guint8 b)
+{
+    switch(kind) {
+    case 0:  return thalia_alu_add(gb, a, b, TRUE);
+    case 1:  return thalia_alu_add_carry(gb, a, b);
+    case 2:  return thalia_alu_sub(gb, a, b, TRUE);
+    case 3:  return thalia_alu_sub_carry(gb, a, b);
+    case 4:  thalia_alu_sub(gb, a, b, TRUE); return a; // CP
+    case 5:  return thalia_alu_inc(gb, a);
+    case 6:  return thalia_alu_dec(gb, a);
+    case 7:  return thalia_alu_daa(gb, a);
+    case 8:  return thalia_alu_rrc(gb, a);
+    case 9:  return thalia_alu_rlc(gb, a);
+    case 10: return thalia_alu_rr(gb, a);
+    case 11: return thalia_alu_rl(gb, a);
+    case 12: return thalia_alu_sra(gb, a);
+    case 13: return thalia_alu_sla(gb, a);
+    case 14: return thalia_alu_srl(gb, a);
+    default: return thalia_alu_swap(gb, a);
+    }
+}
+
+// Runs every operation on every input and every set of flags with both
+// paths, and reports the first disagreement. Returns TRUE if there is none.
+static gboolean thalia_bench_check(ThaliaGB* arith, ThaliaGB* table)
+{
+    guint kind, a, b, flags;
+    guint8 res_arith, res_table;
+
+    for(kind = 0; kind < THALIA_BENCH_KINDS; kind++)
+        for(flags = 0; flags < 0x100; flags += 0x10)
+            for(a = 0; a < 0x100; a++)
+                for(b = 0; b < (kind < 5 ? 0x100 : 1); b++) {
+                    thalia_alu_set_flags(arith, flags);
+                    thalia_alu_set_flags(table, flags);
+                    res_arith = thalia_bench_op(arith, kind, a, b);
+                    res_table = thalia_bench_op(table, kind, a, b);
+                    if(res_arith != res_table ||
+                       thalia_alu_get_flags(arith) !=
+                       thalia_alu_get_flags(table)) {
+                        g_printf("Mismatch: operation %u, A=0x%02X, "
+                                 "operand 0x%02X, F=0x%02X\r\n",
+                                 kind, a, b, flags);
+                        return FALSE;
+                    }
+                }
+    return TRUE;
+}
+
+// Runs the operations in 'stream', each holding the operand in the high byte
+// and the kind in the low byte, checking a condition every fourth one the way
+// a loop would. Returns the time taken per operation in nanoseconds, and
+// folds the results into 'sum'.
+static gdouble thalia_bench_run(ThaliaGB* gb, const guint16* stream,
+                                guint32* sum)
+{
+    gint64 start = g_get_monotonic_time();
+    guint8 a = 0;
+    guint i;
+
+    *sum = 0;
+    for(i = 0; i < THALIA_BENCH_OPS; i++) {
+        a = thalia_bench_op(gb, stream[i] % THALIA_BENCH_KINDS, a,
+                            stream[i] >> 8);
+        if((i & 0x03) == 0x03)
+            *sum = *sum * 31 + thalia_alu_condition_satisfied(
+                gb, (thalia_cond_t) (i >> 2 & 0x03));
+    }
+    *sum = *sum * 31 + a;
+
+    return (g_get_monotonic_time() - start) * 1000.0 / THALIA_BENCH_OPS;
+}
+
+int main(int argc, char *argv[])
+{
+    ThaliaGB* arith = thalia_gb_new();
+    ThaliaGB* table = thalia_gb_new();
+    guint16* stream = g_new(guint16, THALIA_BENCH_OPS);
+    guint32 seed = 0x12345678, sum_arith, sum_table;
+    gdouble time_arith, time_table;
+    guint i;
+
+    thalia_alu_use_tables(table, TRUE);
+    if(!thalia_bench_check(arith, table))
+        return 1;
+
+    for(i = 0; i < THALIA_BENCH_OPS; i++) {
+        seed = seed * 1103515245 + 12345;
+        stream[i] = seed >> 16;
+    }
+
+    time_arith = thalia_bench_run(arith, stream, &sum_arith);
+    time_table = thalia_bench_run(table, stream, &sum_table);
+    if(sum_arith != sum_table) {
+        g_printf("Paths disagree on the operation stream.\r\n");
+        return 1;
+    }
+
+    g_printf("arithmetic: %.2f ns/op\r\n", time_arith);
+    g_printf("tables:     %.2f ns/op\r\n", time_table);
+
+    g_free(stream);
+    thalia_gb_destroy(arith);
+    thalia_gb_destroy(table);
+    return 0;
+}
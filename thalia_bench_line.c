@@ -0,0 +1,159 @@
+#include <glib.h>
+#include <glib/gprintf.h>
+#include <string.h>
+
+#include "libthalia/thalia_gb.h"
+#include "libthalia/thalia_line.h"
+
+// Pixels on a line, and lines drawn by the benchmark.
+#define THALIA_BENCH_WIDTH 160
+#define THALIA_BENCH_LINES (1 << 20)
+
+// Random lines of codes and shades the kernels are run on.
+#define THALIA_BENCH_INPUTS 64
+
+static guint8 codes[THALIA_BENCH_INPUTS][THALIA_BENCH_WIDTH];
+static guint8 shades[THALIA_BENCH_INPUTS][THALIA_BENCH_WIDTH];
+
+// Returns the shades of the four codes through 'palette'.
+static void thalia_bench_palette(guint8 palette, guint8 shades[4])
+{
+    guint8 code;
+    for(code = 0; code < 4; code++)
+        shades[code] = 0xFF - 85 * (palette >> (code * 2) & 3);
+}
+
+// Runs every kernel of 'kernels' on the same inputs as the reference
+// kernels in 'scalar', and reports the first disagreement. Returns TRUE if
+// there is none.
+static gboolean thalia_bench_check(const thalia_line_kernels_t* scalar,
+                                   const thalia_line_kernels_t* kernels)
+{
+    guint8 tile[16], expected[2][8][8], actual[2][8][8];
+    guint8 out_scalar[THALIA_BENCH_WIDTH * 3], out[THALIA_BENCH_WIDTH * 3];
+    guint8 palette[4];
+    guint row, planes, i, n, pal, behind, x;
+
+    // Every pair of bit planes, in every row of a tile.
+    for(row = 0; row < 8; row++)
+        for(planes = 0; planes < 0x10000; planes++) {
+            for(i = 0; i < 16; i++)
+                tile[i] = codes[planes % THALIA_BENCH_INPUTS][i] * 0x55 + i;
+            tile[row * 2] = planes;
+            tile[row * 2 + 1] = planes >> 8;
+            scalar->decode(tile, expected[0], expected[1]);
+            kernels->decode(tile, actual[0], actual[1]);
+            if(memcmp(expected, actual, sizeof(expected))) {
+                g_printf("decode: mismatch on row %u, planes 0x%04X\r\n",
+                         row, planes);
+                return FALSE;
+            }
+        }
+
+    // Every palette, on lines of every length up to a full one.
+    for(pal = 0; pal < 0x100; pal++)
+        for(n = 0; n <= THALIA_BENCH_WIDTH; n++) {
+            thalia_bench_palette(pal, palette);
+            i = (pal + n) % THALIA_BENCH_INPUTS;
+            memset(out_scalar, 0, sizeof(out_scalar));
+            memset(out, 0, sizeof(out));
+            scalar->shade(out_scalar, codes[i], palette, n);
+            kernels->shade(out, codes[i], palette, n);
+            if(memcmp(out_scalar, out, sizeof(out))) {
+                g_printf("shade: mismatch with palette 0x%02X, %u pixels\r\n",
+                         pal, n);
+                return FALSE;
+            }
+
+            memset(out_scalar, 0, sizeof(out_scalar));
+            memset(out, 0, sizeof(out));
+            scalar->expand(out_scalar, shades[i], n);
+            kernels->expand(out, shades[i], n);
+            if(memcmp(out_scalar, out, sizeof(out))) {
+                g_printf("expand: mismatch on %u pixels\r\n", n);
+                return FALSE;
+            }
+        }
+
+    // Every palette and priority, at every position on the lines.
+    for(pal = 0; pal < 0x100; pal++)
+        for(behind = 0; behind < 2; behind++)
+            for(i = 0; i < THALIA_BENCH_INPUTS; i++)
+                for(x = 0; x + 8 <= THALIA_BENCH_WIDTH; x++) {
+                    thalia_bench_palette(pal, palette);
+                    memcpy(out_scalar, shades[i], THALIA_BENCH_WIDTH);
+                    memcpy(out, shades[i], THALIA_BENCH_WIDTH);
+                    scalar->merge(out_scalar + x, codes[i] + x, palette,
+                                  behind);
+                    kernels->merge(out + x, codes[i] + x, palette, behind);
+                    if(memcmp(out_scalar, out, THALIA_BENCH_WIDTH)) {
+                        g_printf("merge: mismatch with palette 0x%02X, "
+                                 "behind %u, at %u\r\n", pal, behind, x);
+                        return FALSE;
+                    }
+                }
+    return TRUE;
+}
+
+// Draws lines the way the GPU does with 'kernels': decoding a tile, looking
+// up the background, merging ten sprites and expanding the result. Returns
+// the time taken per line in nanoseconds.
+static gdouble thalia_bench_run(const thalia_line_kernels_t* kernels)
+{
+    static guint8 rows[8][8], flipped[8][8];
+    guint8 line[THALIA_BENCH_WIDTH], pixels[THALIA_BENCH_WIDTH * 3];
+    guint8 palette[4];
+    gint64 start = g_get_monotonic_time();
+    guint i, sprite;
+
+    thalia_bench_palette(0xE4, palette);
+    for(i = 0; i < THALIA_BENCH_LINES; i++) {
+        const guint8* in = codes[i % THALIA_BENCH_INPUTS];
+        kernels->decode(in, rows, flipped);
+        kernels->shade(line, in, palette, THALIA_BENCH_WIDTH);
+        for(sprite = 0; sprite < 10; sprite++)
+            kernels->merge(line + sprite * 15, rows[sprite & 7], palette,
+                           sprite & 1);
+        kernels->expand(pixels, line, THALIA_BENCH_WIDTH);
+    }
+
+    return (g_get_monotonic_time() - start) * 1000.0 / THALIA_BENCH_LINES;
+}
+
+int main(int argc, char *argv[])
+{
+    const thalia_line_kernels_t* scalar =
+        thalia_line_kernels(THALIA_LINE_ISA_SCALAR);
+    const thalia_line_kernels_t* kernels;
+    guint32 seed = 0x12345678;
+    thalia_line_isa_t isa;
+    guint i, x;
+
+    // Codes are 0 to 3. Shades are mostly white, which sprites behind the
+    // background are drawn over.
+    for(i = 0; i < THALIA_BENCH_INPUTS; i++)
+        for(x = 0; x < THALIA_BENCH_WIDTH; x++) {
+            seed = seed * 1103515245 + 12345;
+            codes[i][x] = seed >> 16 & 0x03;
+            shades[i][x] = seed >> 24 & 0x01 ? 0xFF : seed >> 18;
+        }
+
+    for(isa = THALIA_LINE_ISA_SCALAR + 1; isa < THALIA_LINE_ISA_COUNT; isa++) {
+        kernels = thalia_line_kernels(isa);
+        if(kernels && !thalia_bench_check(scalar, kernels)) {
+            g_printf("%s kernels disagree with scalar ones.\r\n",
+                     thalia_line_isa_name(isa));
+            return 1;
+        }
+    }
+
+    for(isa = THALIA_LINE_ISA_SCALAR; isa < THALIA_LINE_ISA_COUNT; isa++) {
+        kernels = thalia_line_kernels(isa);
+        if(kernels)
+            g_printf("%-7s %.1f ns/line\r\n", thalia_line_isa_name(isa),
+                     thalia_bench_run(kernels));
+        else
+            g_printf("%-7s not available\r\n", thalia_line_isa_name(isa));
+    }
+    return 0;
+}
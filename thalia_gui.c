@@ -104,6 +104,7 @@ static void thalia_gui_update_key(guint16 keyval, gboolean value)
         gb->keypad.key_select = value;
         break;
     }
+    thalia_keypad_changed(gb);
     thalia_keypad_unlock(gb);
 }
 
@@ -0,0 +1,336 @@
+#include <glib.h>
+#include <glib/gprintf.h>
+#include <stddef.h>
+
+#include "libthalia/thalia_gb.h"
+#include "libthalia/thalia_mmu.h"
+#include "libthalia/thalia_proc.h"
+#include "libthalia/thalia_aot.h"
+
+// Addresses execution may start at without a jump: the entry point, the RST
+// vectors and the interrupt vectors.
+static const guint16 thalia_translate_entries[] = {
+    0x0100,
+    0x0000, 0x0008, 0x0010, 0x0018, 0x0020, 0x0028, 0x0030, 0x0038,
+    0x0040, 0x0048, 0x0050, 0x0058, 0x0060
+};
+
+// Key of a block in the tables below, never NULL.
+#define THALIA_TRANSLATE_KEY(bank, addr) \
+    GUINT_TO_POINTER(1u << 31 | (bank) << 16 | (addr))
+
+static ThaliaGB* gb = NULL;
+static gint n_banks = 0;
+static GHashTable* seen = NULL;  // Blocks found so far, keyed by bank/address
+static GQueue* pending = NULL;   // Blocks yet to be translated
+
+// Returns the ROM bank holding 'addr' when 'bank' is mapped, or -1 for RAM.
+static gint thalia_translate_bank(gint bank, guint16 addr)
+{
+    if(addr < 0x4000)
+        return 0;
+    if(addr < 0x8000)
+        return bank;
+    return -1;
+}
+
+// Reads the byte at 'addr' with 'bank' mapped to 0x4000-0x7FFF.
+static guint8 thalia_translate_read(gint bank, guint16 addr)
+{
+    return gb->mmu.rom_banks[thalia_translate_bank(bank, addr)][addr & 0x3FFF];
+}
+
+// Queues the block at 'addr' for translation. Code in bank 0 may jump into
+// whatever bank is mapped, so such jumps are followed into all of them.
+static void thalia_translate_add(gint bank, guint16 addr)
+{
+    gpointer key;
+    gint i;
+
+    if(addr >= 0x4000 && addr < 0x8000 && bank == 0) {
+        for(i = 1; i < n_banks; i++)
+            thalia_translate_add(i, addr);
+        return;
+    }
+
+    // Code in RAM is left to the interpreter.
+    bank = thalia_translate_bank(bank, addr);
+    if(bank < 0)
+        return;
+
+    key = THALIA_TRANSLATE_KEY(bank, addr);
+    if(g_hash_table_lookup(seen, key))
+        return;
+
+    g_hash_table_insert(seen, key, key);
+    g_queue_push_tail(pending, key);
+}
+
+// Queues every block control may pass to after 'opcode' at 'addr'.
+static void thalia_translate_follow(gint bank, guint16 addr, guint16 opcode,
+                                    guint16 operand, guint8 length)
+{
+    guint16 next = addr + length;
+
+    switch(opcode) {
+    case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+        // JR
+        thalia_translate_add(bank, next + (gint8) operand);
+        break;
+    case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA:
+    case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC:
+        // JP and CALL
+        thalia_translate_add(bank, operand);
+        break;
+    case 0xC7: case 0xCF: case 0xD7: case 0xDF:
+    case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+        // RST
+        thalia_translate_add(bank, opcode & 0x38);
+        break;
+    }
+
+    // Everything but unconditional jumps and returns may carry on below.
+    switch(opcode) {
+    case 0x18: case 0xC3: case 0xC9: case 0xD9: case 0xE9:
+        break;
+    default:
+        thalia_translate_add(bank, next);
+        break;
+    }
+}
+
+// Emits C code performing the instruction 'opcode' at 'addr'. This uses the
+// interpreter's handlers, but does plain register loads inline.
+static void thalia_translate_insn(GString* out, guint16 addr, guint16 opcode,
+                                  guint16 operand, guint8 length,
+                                  guint8 cycles)
+{
+    g_string_append_printf(
+        out,
+        "    /* 0x%04X: 0x%03X */\n"
+        "    PC(gb) = 0x%04X;\n"
+        "    START(gb) = CYCLES(gb);\n",
+        addr,
+        opcode,
+        (guint16) (addr + length)
+    );
+    if(cycles)
+        g_string_append_printf(out, "    CYCLES(gb) += %u;\n", cycles);
+
+    if(opcode & THALIA_PROC_EXTENDED) {
+        g_string_append_printf(out, "    api->handlers[0x%03X](gb, 0x%02X, 0);\n",
+                               opcode, opcode & 0xFF);
+    } else if(opcode == 0x00) {
+        // NOP
+    } else if((opcode & 0xC0) == 0x40 && opcode != 0x76 &&
+              (opcode & 0x07) != THALIA_REG_IHL &&
+              (opcode & 0x38) != THALIA_REG_IHL << 3) {
+        g_string_append_printf(out, "    REG(gb)[%u] = REG(gb)[%u];\n",
+                               THALIA_REG_INDEX((opcode >> 3) & 0x07),
+                               THALIA_REG_INDEX(opcode & 0x07));
+    } else if((opcode & 0xC7) == 0x06 && opcode != 0x36) {
+        g_string_append_printf(out, "    REG(gb)[%u] = 0x%02X;\n",
+                               THALIA_REG_INDEX((opcode >> 3) & 0x07),
+                               operand);
+    } else {
+        g_string_append_printf(
+            out,
+            "    api->handlers[0x%03X](gb, 0x%02X, 0x%04X);\n",
+            opcode,
+            opcode & 0xFF,
+            operand
+        );
+    }
+    g_string_append(out,
+                    "    if(CYCLES(gb) >= NEXT(gb))\n        api->step(gb);\n");
+}
+
+// Emits a function running the block at 'addr' in 'bank', and queues the
+// blocks following it. Blocks end where the interpreter's blocks end. Returns
+// FALSE if the block is left to the interpreter instead.
+static gboolean thalia_translate_block(GString* out, gint bank, guint16 addr)
+{
+    guint32 limit = addr < 0x4000 ? 0x4000 : 0x8000;
+    guint16 start = addr;
+    guint8 length, cycles;
+    guint16 opcode, operand;
+    gpointer handler;
+    gint i;
+
+    // Empty blocks would never move on, leave them to the interpreter.
+    opcode = thalia_translate_read(bank, addr);
+    handler = thalia_proc_describe(opcode, &length, &cycles);
+    if(addr + length > limit || !handler)
+        return FALSE;
+
+    g_string_append_printf(out, "static void block_%02X_%04X(void* gb)\n{\n",
+                           bank, start);
+    for(i = 0; i < THALIA_PROC_BLOCK_SIZE; i++) {
+        opcode = thalia_translate_read(bank, addr);
+        handler = thalia_proc_describe(opcode, &length, &cycles);
+        if(addr + length > limit || !handler)
+            break;
+
+        operand = 0;
+        if(length > 1)
+            operand = thalia_translate_read(bank, addr + 1);
+        if(length > 2)
+            operand |= thalia_translate_read(bank, addr + 2) << 8;
+        if(opcode == THALIA_PROC_PREFIX) {
+            opcode = THALIA_PROC_EXTENDED | operand;
+            thalia_proc_describe(opcode, &length, &cycles);
+            operand = 0;
+        }
+
+        // Leave when an interrupt or a bank switch changes course.
+        if(i > 0)
+            g_string_append_printf(
+                out,
+                "    if(PC(gb) != 0x%04X || STALE(gb))\n        return;\n",
+                addr
+            );
+        thalia_translate_insn(out, addr, opcode, operand, length, cycles);
+
+        if(thalia_proc_ends_block(opcode)) {
+            thalia_translate_follow(bank, addr, opcode, operand, length);
+            break;
+        }
+        addr += length;
+    }
+
+    // Blocks cut short carry on in the next one.
+    if(i == THALIA_PROC_BLOCK_SIZE || addr == limit)
+        thalia_translate_add(bank, addr);
+    g_string_append(out, "}\n\n");
+    return TRUE;
+}
+
+// Translates the whole ROM into C code.
+static GString* thalia_translate_rom(const gchar* hash)
+{
+    GString* out = g_string_new(NULL);
+    GString* table = g_string_new(NULL);
+    gpointer key;
+    guint i;
+
+    g_string_append_printf(
+        out,
+        "/* ROM %s, translated by thalia-translate. Do not edit. */\n\n"
+        "#define PC(gb) (*(unsigned short*) ((char*) (gb) + %u))\n"
+        "#define CYCLES(gb) (*(unsigned long long*) ((char*) (gb) + %u))\n"
+        "#define START(gb) (*(unsigned long long*) ((char*) (gb) + %u))\n"
+        "#define NEXT(gb) (*(unsigned long long*) ((char*) (gb) + %u))\n"
+        "#define STALE(gb) (*(int*) ((char*) (gb) + %u))\n"
+        "#define REG(gb) ((unsigned char*) (gb) + %u)\n\n"
+        "static const struct {\n"
+        "    void (*step)(void* gb);\n"
+        "    void (*handlers[0x200])(void* gb, unsigned char opcode,\n"
+        "                            unsigned short operand);\n"
+        "}* api;\n\n",
+        hash,
+        (guint) offsetof(ThaliaGB, pc),
+        (guint) offsetof(ThaliaGB, cycles),
+        (guint) offsetof(ThaliaGB, sched.start),
+        (guint) offsetof(ThaliaGB, sched.next),
+        (guint) offsetof(ThaliaGB, cache.stale),
+        (guint) offsetof(ThaliaGB, reg)
+    );
+
+    for(i = 0; i < G_N_ELEMENTS(thalia_translate_entries); i++)
+        thalia_translate_add(0, thalia_translate_entries[i]);
+
+    while((key = g_queue_pop_head(pending))) {
+        guint bank = (GPOINTER_TO_UINT(key) >> 16) & 0x7FFF;
+        guint16 addr = GPOINTER_TO_UINT(key) & 0xFFFF;
+        if(thalia_translate_block(out, bank, addr))
+            g_string_append_printf(
+                table,
+                "    { 0x%02X, 0x%04X, block_%02X_%04X },\n",
+                bank, addr, bank, addr
+            );
+    }
+
+    g_string_append_printf(
+        out,
+        "const unsigned int thalia_aot_abi = %u;\n\n"
+        "const struct {\n"
+        "    unsigned short bank;\n"
+        "    unsigned short pc;\n"
+        "    void (*code)(void* gb);\n"
+        "} thalia_aot_blocks[] = {\n"
+        "%s"
+        "    { 0, 0, 0 }\n"
+        "};\n\n"
+        "void thalia_aot_init(const void* a)\n"
+        "{\n"
+        "    api = a;\n"
+        "}\n",
+        (guint) THALIA_AOT_ABI,
+        table->str
+    );
+    g_string_free(table, TRUE);
+    return out;
+}
+
+int main(int argc, char *argv[])
+{
+    GError* error = NULL;
+    GString* code;
+    gchar *hash, *source, *object, *dir, *command;
+    const gchar* cc = g_getenv("CC");
+    gint status;
+
+    if(argc < 2) {
+        g_printf("Usage: %s romfile.gb\r\n", argv[0]);
+        return 0;
+    }
+
+    gb = thalia_gb_new();
+    thalia_gb_load_rom(gb, argv[1], &error);
+    if(error) {
+        g_printerr("Could not load ROM file: %s.\r\n", error->message);
+        return 1;
+    }
+
+    // Translations are stored by ROM contents, where libthalia looks for them.
+    hash = thalia_aot_hash(gb);
+    source = thalia_aot_path(hash, ".c");
+    object = thalia_aot_path(hash, "." G_MODULE_SUFFIX);
+    dir = g_path_get_dirname(source);
+    g_mkdir_with_parents(dir, 0755);
+
+    n_banks = gb->mmu.rom_size / THALIA_MMU_BANK_SIZE;
+    seen = g_hash_table_new(g_direct_hash, g_direct_equal);
+    pending = g_queue_new();
+    code = thalia_translate_rom(hash);
+    g_file_set_contents(source, code->str, code->len, &error);
+    if(error) {
+        g_printerr("Could not write %s: %s.\r\n", source, error->message);
+        return 1;
+    }
+
+    // Compile it into a module libthalia can load.
+    command = g_strdup_printf(
+        "%s -O2 -fPIC -shared -fno-strict-aliasing -o '%s' '%s'",
+        cc ? cc : "cc",
+        object,
+        source
+    );
+    if(!g_spawn_command_line_sync(command, NULL, NULL, &status, &error) ||
+       status != 0) {
+        g_printerr("Could not compile %s.\r\n", source);
+        return 1;
+    }
+    g_printf("%s\r\n", object);
+
+    g_free(command);
+    g_free(dir);
+    g_free(object);
+    g_free(source);
+    g_free(hash);
+    g_string_free(code, TRUE);
+    g_hash_table_destroy(seen);
+    g_queue_free(pending);
+    thalia_gb_destroy(gb);
+    return 0;
+}